@@ -0,0 +1,72 @@
+#ifndef _ALLOC_HPP
+#define _ALLOC_HPP
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Counts every heap allocation the program makes, so we can check the frame
+// loop doesn't make any once a game is running. Everything a session needs
+// is allocated when it's created; a frame only reuses it. The count is
+// always kept (an atomic add per allocation), --check-alloc turns a frame
+// that allocates into an error.
+namespace alloc {
+
+std::atomic<long long> g_count(0);
+std::atomic<long long> g_bytes(0);
+bool g_check = false; // Report frames that allocate, see --check-alloc.
+
+// Allocations and bytes requested since the program started.
+inline long long count() { return g_count.load(std::memory_order_relaxed); }
+inline long long bytes() { return g_bytes.load(std::memory_order_relaxed); }
+
+// Allocations made since construction, e.g. around one frame.
+class counter {
+public:
+  counter() : m_count(count()), m_bytes(bytes()) {}
+
+  long long allocations() const { return count() - m_count; }
+  long long allocated_bytes() const { return bytes() - m_bytes; }
+
+protected:
+  long long m_count;
+  long long m_bytes;
+};
+
+inline void *allocate(size_t size) {
+  g_count.fetch_add(1, std::memory_order_relaxed);
+  g_bytes.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+
+} // namespace alloc
+
+// Everything that reaches the heap through new goes through here.
+void *operator new(size_t size) {
+  if (void *p = alloc::allocate(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+  if (void *p = alloc::allocate(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) throw() {
+  return alloc::allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) throw() {
+  return alloc::allocate(size);
+}
+
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+void operator delete(void *p, const std::nothrow_t &) throw() { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) throw() { free(p); }
+
+#endif // _ALLOC_HPP
@@ -0,0 +1,224 @@
+#ifndef _ASSETS_HPP
+#define _ASSETS_HPP
+#pragma once
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Game.hpp"
+#include "Tasks.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Loads textures in the background. Every request is a job on a task::pool:
+// a worker reads the file and decodes it into the pool (see texture::read()
+// and texture::decode()), so the assets load side by side instead of one
+// after another, and whoever asked can get on with something else. A
+// request's handle says when it's ready, how long it took and, if it
+// failed, why.
+//
+// Loading doesn't print anything by itself; report() says how it went.
+namespace assets {
+
+enum States { QUEUED, LOADING, READY, FAILED };
+
+class loader;
+
+// One requested texture and what became of it.
+struct request : public task::job {
+  loader *owner;
+  std::string name;
+  int format;
+  game::texture result; // Empty until ready.
+  std::atomic<int> state;
+  std::atomic<int> pending; // 1 until READY or FAILED.
+  std::string error;
+  double read_millis, decode_millis;
+  double finished; // Milliseconds after start() it was done.
+  int worker;
+
+  request(loader *o, const std::string &n, int f, util::mem_pool &pool)
+      : owner(o), name(n), format(f), result(pool), read_millis(0),
+        decode_millis(0), finished(0), worker(0) {
+    state.store(QUEUED);
+    pending.store(1);
+  }
+
+  void execute(int thread);
+};
+
+class loader {
+public:
+  // Textures go into |pool|, which must be able to take them.
+  loader(util::mem_pool &pool)
+      : m_pool(pool), m_workers(nullptr), m_own(nullptr), m_start(0) {
+    m_loading.store(0);
+  }
+
+  ~loader() {
+    wait_all();
+    for (size_t i = 0; i < m_requests.size(); ++i)
+      delete m_requests[i];
+  }
+
+  // Ask for the texture resource |name| kept as |format| (see
+  // game::TextureFormats). Returns its handle; nothing loads until start().
+  int add(const std::string &name, int format = game::FORMAT_ARGB) {
+    m_requests.push_back(new request(this, name, format, m_pool));
+    return static_cast<int>(m_requests.size()) - 1;
+  }
+
+  // Start loading everything asked for on |workers|, or if that's null on
+  // threads of our own, one per request but the one wait_all() can load.
+  // Reads mostly wait on the disk, so that's more than there are cores to
+  // spare. Our own threads go away once everything is loaded.
+  void start(task::pool *workers = nullptr) {
+    m_start = profile::now();
+    m_workers = workers;
+    if (!m_workers) {
+      int threads{static_cast<int>(m_requests.size()) - 1};
+      m_own = new task::pool(threads > 0 ? threads : 1);
+      m_workers = m_own;
+    }
+    m_loading.store(static_cast<int>(m_requests.size()));
+    for (size_t i = 0; i < m_requests.size(); ++i)
+      m_workers->submit(m_requests[i]);
+  }
+
+  int size() const { return static_cast<int>(m_requests.size()); }
+
+  // Whether request |handle| is done, loaded or not.
+  bool done(int handle) const {
+    return m_requests[handle]->pending.load(std::memory_order_acquire) == 0;
+  }
+  bool done() const { return m_loading.load(std::memory_order_acquire) == 0; }
+  // Requests not done yet.
+  int pending() const { return m_loading.load(std::memory_order_acquire); }
+
+  bool failed(int handle) const {
+    return done(handle) && m_requests[handle]->state.load() == FAILED;
+  }
+  int failures() const {
+    int count{0};
+    for (int i = 0; i < size(); ++i)
+      count += failed(i);
+    return count;
+  }
+
+  // Wait for |handle|. Doesn't help load: whatever is queued here could be
+  // the biggest asset, the one worth not waiting for.
+  void wait(int handle) {
+    while (m_workers && !done(handle))
+      SwitchToThread();
+  }
+
+  // Wait for everything, loading whatever is queued meanwhile, then let our
+  // own threads go and forget a borrowed pool.
+  void wait_all() {
+    if (m_workers && !done())
+      m_workers->help(m_loading);
+    release();
+  }
+
+  // The loaded texture of a done request, empty if it failed.
+  const game::texture &texture(int handle) const {
+    return m_requests[handle]->result;
+  }
+  const char *name(int handle) const {
+    return m_requests[handle]->name.c_str();
+  }
+
+  // Milliseconds from start() until the last request finished.
+  double millis() const {
+    double last{0};
+    for (int i = 0; i < size(); ++i)
+      last = m_requests[i]->finished > last ? m_requests[i]->finished : last;
+    return last;
+  }
+
+  // How request |handle| went, on one line.
+  void report(std::ostream &out, int handle) const {
+    const request &r{*m_requests[handle]};
+    if (!done(handle)) {
+      out << "  [" << r.name << "] still loading" << std::endl;
+      return;
+    }
+    if (r.state.load() == FAILED) {
+      out << "  [" << r.name << "] FAILED: " << r.error << std::endl;
+      return;
+    }
+    const game::texture &t{r.result};
+    out << "  [" << r.name << "] " << t.bounds.v[game::x_pos] << "x"
+        << t.bounds.v[game::y_pos] << " " << t.format_name() << ", "
+        << t.bytes() << " bytes: read " << r.read_millis << " ms, decoded "
+        << r.decode_millis << " ms on thread " << r.worker << ", ready at "
+        << r.finished << " ms" << std::endl;
+  }
+
+  void report(std::ostream &out) const {
+    out << "Assets: " << size() << " loaded in " << millis() << " ms, "
+        << failures() << " failed" << std::endl;
+    for (int i = 0; i < size(); ++i)
+      report(out, i);
+  }
+
+protected:
+  friend struct request;
+
+  void finished(request &r) {
+    r.finished = profile::to_millis(profile::now() - m_start);
+    r.pending.store(0, std::memory_order_release);
+    m_loading.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  // Once everything is loaded the workers have nothing left of ours to run.
+  // A borrowed pool may then be deleted before we are, so don't hold on to it.
+  void release() {
+    if (!done())
+      return;
+    delete m_own;
+    m_own = nullptr;
+    m_workers = nullptr;
+  }
+
+  util::mem_pool &m_pool;
+  std::vector<request *> m_requests;
+  task::pool *m_workers;
+  task::pool *m_own; // Threads started just for loading, if any.
+  std::atomic<int> m_loading; // Requests not done yet.
+  profile::ticks m_start;
+
+private:
+  loader(const loader &);
+  loader &operator=(const loader &);
+};
+
+inline void request::execute(int thread) {
+  state.store(LOADING);
+  worker = thread;
+  std::vector<detail::Uint32> argb;
+  profile::ticks start{profile::now()};
+  bool ok{game::texture::read(name, result.bounds, argb, error)};
+  profile::ticks read{profile::now()};
+  ok = ok && result.decode(argb, format, error);
+  read_millis = profile::to_millis(read - start);
+  decode_millis = profile::to_millis(profile::now() - read);
+  state.store(ok ? READY : FAILED);
+  owner->finished(*this);
+}
+
+// A 1x1 texture of |colour| to stand in for one that isn't loaded (yet).
+inline game::texture placeholder(util::mem_pool &pool,
+                                 detail::Uint32 colour) {
+  game::texture t(math::vec2i(1, 1), pool);
+  if (t.tex) {
+    t.tex[0] = colour;
+    t.build_mask();
+  }
+  return t;
+}
+
+} // namespace assets
+
+#endif // _ASSETS_HPP
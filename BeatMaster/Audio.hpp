@@ -0,0 +1,524 @@
+#ifndef _AUDIO_HPP
+#define _AUDIO_HPP
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <emmintrin.h>
+#include <iostream>
+#include <vector>
+#include "Profiler.hpp"
+#include "util.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Beat detection for the music a stage is played to. A worker thread decodes
+// a WAV file block by block as the music plays, runs every block through an
+// FFT and marks onsets where the spectral flux (how much louder the spectrum
+// got since the previous block) peaks above its recent average. Beats go to
+// the update thread through a lock-free queue, which folds them into the
+// frame's input (see input::KEY_BEAT) where they spawn and fire waves.
+namespace audio {
+
+// One detected onset.
+struct beat {
+  double seconds;          // Into the music.
+  float strength;          // Flux over the threshold it beat, 1 and up.
+  profile::ticks detected; // When the block that gave it away was decoded.
+};
+
+typedef util::spsc_queue<beat, 64> beat_queue;
+
+// Streams the samples of a PCM WAV file (8 or 16 bit, or 32 bit float, any
+// number of channels) as mono floats in [-1, 1].
+class wav_reader {
+public:
+  wav_reader()
+      : m_file(nullptr), m_format(0), m_channels(0), m_rate(0), m_bits(0),
+        m_align(0), m_data(0), m_frames(0), m_left(0) {}
+  ~wav_reader() { close(); }
+
+  // Read the header of |file|, sizing the decode buffer for reads of up to
+  // |block| frames.
+  bool open(const char *file, int block) {
+    close();
+    if (fopen_s(&m_file, file, "rb") != 0) {
+      std::cout << "Could not open music " << file << std::endl;
+      m_file = nullptr;
+      return false;
+    }
+    char id[4];
+    unsigned int size{0};
+    fread(id, 1, 4, m_file);
+    fread(&size, sizeof(size), 1, m_file);
+    bool riff{memcmp(id, "RIFF", 4) == 0};
+    fread(id, 1, 4, m_file);
+    if (!riff || memcmp(id, "WAVE", 4) != 0)
+      return fail(file, "is not a WAV file");
+
+    // Walk the chunks up to the samples, picking the format up on the way.
+    while (fread(id, 1, 4, m_file) == 4 &&
+           fread(&size, sizeof(size), 1, m_file) == 1) {
+      if (memcmp(id, "fmt ", 4) == 0) {
+        unsigned short format, channels, align, bits;
+        unsigned int rate, byte_rate;
+        fread(&format, sizeof(format), 1, m_file);
+        fread(&channels, sizeof(channels), 1, m_file);
+        fread(&rate, sizeof(rate), 1, m_file);
+        fread(&byte_rate, sizeof(byte_rate), 1, m_file);
+        fread(&align, sizeof(align), 1, m_file);
+        fread(&bits, sizeof(bits), 1, m_file);
+        m_format = format;
+        m_channels = channels;
+        m_rate = static_cast<int>(rate);
+        m_bits = bits;
+        m_align = align;
+        fseek(m_file, static_cast<long>(size + (size & 1)) - 16, SEEK_CUR);
+      } else if (memcmp(id, "data", 4) == 0) {
+        m_data = ftell(m_file);
+        m_frames = m_align ? static_cast<int>(size / m_align) : 0;
+        break;
+      } else {
+        fseek(m_file, static_cast<long>(size + (size & 1)), SEEK_CUR);
+      }
+    }
+
+    bool pcm{m_format == 1 && (m_bits == 8 || m_bits == 16)};
+    bool floats{m_format == 3 && m_bits == 32};
+    if (!m_data || !m_channels || !m_rate || !(pcm || floats) ||
+        m_align != m_channels * m_bits / 8)
+      return fail(file, "is not 8/16 bit PCM or 32 bit float audio");
+    if (!m_frames)
+      return fail(file, "has no samples");
+    m_raw.resize(static_cast<size_t>(block) * m_align);
+    m_left = m_frames;
+    return true;
+  }
+
+  void close() {
+    if (m_file)
+      fclose(m_file);
+    m_file = nullptr;
+    m_data = m_frames = m_left = 0;
+  }
+
+  // Decode up to |count| frames, mixed down to mono, into |out|. Returns how
+  // many there were, 0 at the end of the music.
+  int read(float *out, int count) {
+    int limit{static_cast<int>(m_raw.size()) / (m_align ? m_align : 1)};
+    count = count < m_left ? count : m_left;
+    count = count < limit ? count : limit;
+    if (!m_file || count <= 0)
+      return 0;
+    count = static_cast<int>(fread(&m_raw[0], m_align, count, m_file));
+    m_left -= count;
+
+    float scale{1.0f / m_channels};
+    const unsigned char *in{&m_raw[0]};
+    for (int i = 0; i < count; ++i) {
+      float sum{0};
+      for (int c = 0; c < m_channels; ++c, in += m_bits / 8) {
+        if (m_bits == 8) {
+          sum += (*in - 128) * (1.0f / 128.0f);
+        } else if (m_bits == 16) {
+          short s;
+          memcpy(&s, in, sizeof(s));
+          sum += s * (1.0f / 32768.0f);
+        } else {
+          float f;
+          memcpy(&f, in, sizeof(f));
+          sum += f;
+        }
+      }
+      out[i] = sum * scale;
+    }
+    return count;
+  }
+
+  // Back to the first sample.
+  void rewind() {
+    if (!m_file)
+      return;
+    fseek(m_file, m_data, SEEK_SET);
+    m_left = m_frames;
+  }
+
+  bool is_open() const { return m_file != nullptr; }
+  int rate() const { return m_rate; }
+  int channels() const { return m_channels; }
+  int frames() const { return m_frames; }
+  double seconds() const { return m_rate ? double(m_frames) / m_rate : 0.0; }
+
+protected:
+  bool fail(const char *file, const char *why) {
+    std::cout << "Music " << file << " " << why << "." << std::endl;
+    close();
+    return false;
+  }
+
+  FILE *m_file;
+  int m_format;
+  int m_channels;
+  int m_rate;
+  int m_bits;
+  int m_align; // Bytes per frame, every channel's sample.
+  long m_data; // File offset of the first sample.
+  int m_frames;
+  int m_left;
+  std::vector<unsigned char> m_raw;
+
+private:
+  wav_reader(const wav_reader &);
+  wav_reader &operator=(const wav_reader &);
+};
+
+// In place radix 2 FFT of |n| (a power of two, 8 or more) complex values,
+// real and imaginary parts in separate arrays. The first two passes run one
+// butterfly at a time, every later pass four at once.
+class fft {
+public:
+  fft(int n) : m_size(n), m_reverse(n), m_wr(n), m_wi(n) {
+    int bits{0};
+    while ((1 << bits) < n)
+      ++bits;
+    for (int i = 0; i < n; ++i) {
+      int r{0};
+      for (int b = 0; b < bits; ++b)
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      m_reverse[i] = r;
+    }
+    // The twiddles of the pass joining halves of h are at [h, 2h).
+    for (int h = 1; h < n; h <<= 1) {
+      for (int k = 0; k < h; ++k) {
+        double angle{3.14159265358979323846 * k / h};
+        m_wr[h + k] = static_cast<float>(cos(angle));
+        m_wi[h + k] = static_cast<float>(-sin(angle));
+      }
+    }
+  }
+
+  int size() const { return m_size; }
+
+  // Where input i has to go before transform() - bit reversed order.
+  int slot(int i) const { return m_reverse[i]; }
+
+  // Transform |re|, |im| (already in slot() order) into the spectrum.
+  void transform(float *re, float *im) const {
+    const int n{m_size};
+
+    // Halves of 1 and 2 together: a 4 point transform, the twiddles are 1
+    // and -i.
+    for (int g = 0; g < n; g += 4) {
+      float r0{re[g] + re[g + 1]}, i0{im[g] + im[g + 1]};
+      float r1{re[g] - re[g + 1]}, i1{im[g] - im[g + 1]};
+      float r2{re[g + 2] + re[g + 3]}, i2{im[g + 2] + im[g + 3]};
+      float r3{re[g + 2] - re[g + 3]}, i3{im[g + 2] - im[g + 3]};
+      re[g] = r0 + r2;
+      im[g] = i0 + i2;
+      re[g + 2] = r0 - r2;
+      im[g + 2] = i0 - i2;
+      re[g + 1] = r1 + i3;
+      im[g + 1] = i1 - r3;
+      re[g + 3] = r1 - i3;
+      im[g + 3] = i1 + r3;
+    }
+
+    for (int h = 4; h < n; h <<= 1) {
+      const float *wr{&m_wr[h]};
+      const float *wi{&m_wi[h]};
+      for (int g = 0; g < n; g += 2 * h) {
+        float *ar{re + g}, *ai{im + g}, *br{re + g + h}, *bi{im + g + h};
+        for (int k = 0; k < h; k += 4) {
+          __m128 cr{_mm_loadu_ps(wr + k)}, ci{_mm_loadu_ps(wi + k)};
+          __m128 xr{_mm_loadu_ps(br + k)}, xi{_mm_loadu_ps(bi + k)};
+          __m128 tr{_mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci))};
+          __m128 ti{_mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr))};
+          __m128 yr{_mm_loadu_ps(ar + k)}, yi{_mm_loadu_ps(ai + k)};
+          _mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+          _mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+          _mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+          _mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+        }
+      }
+    }
+  }
+
+protected:
+  int m_size;
+  std::vector<int> m_reverse;
+  std::vector<float> m_wr;
+  std::vector<float> m_wi;
+};
+
+// Spectral flux onset detection over a stream of samples, |window| samples
+// at a time every |hop|. A block is an onset when its flux is a local peak
+// and clears the mean plus 3 standard deviations of the flux before it.
+class onset_detector {
+public:
+  static const int window = 1024;
+  static const int hop = 512;
+  static const int history = 32; // Blocks the threshold looks back over.
+
+  onset_detector(int rate)
+      : m_fft(window), m_rate(rate), m_samples(window), m_hann(window),
+        m_re(window), m_im(window), m_previous(window / 2), m_flux(history),
+        m_blocks(0), m_last_beat(-1) {
+    for (int i = 0; i < window; ++i)
+      m_hann[i] = static_cast<float>(
+          0.5 - 0.5 * cos(2.0 * 3.14159265358979323846 * i / (window - 1)));
+    // Nothing faster than 300 bpm counts as a separate beat.
+    m_min_gap = static_cast<int>(0.2 * rate / hop);
+  }
+
+  // Feed the next |hop| samples. Returns true and fills in |out| when the
+  // block before them turned out to be an onset.
+  bool push(const float *samples, beat &out) {
+    memmove(&m_samples[0], &m_samples[hop], (window - hop) * sizeof(float));
+    memcpy(&m_samples[window - hop], samples, hop * sizeof(float));
+
+    for (int i = 0; i < window; ++i) {
+      int at{m_fft.slot(i)};
+      m_re[at] = m_samples[i] * m_hann[i];
+      m_im[at] = 0;
+    }
+    m_fft.transform(&m_re[0], &m_im[0]);
+    float current{flux()};
+
+    // The previous block is a peak once we know this one is lower.
+    bool found{false};
+    int block{m_blocks - 1};
+    float peak{m_blocks > 0 ? m_flux[block % history] : 0.0f};
+    float before{m_blocks > 1 ? m_flux[(block - 1) % history] : 0.0f};
+    if (m_blocks > 2 && peak > before && peak >= current &&
+        (m_last_beat < 0 || block - m_last_beat >= m_min_gap)) {
+      float threshold{this->threshold(block)};
+      if (peak > threshold) {
+        // Block b's window ends at sample (b + 1) * hop; the onset is
+        // timed at its centre.
+        out.seconds = (double(block + 1) * hop - window / 2) / m_rate;
+        out.strength = threshold > 0 ? peak / threshold : 1.0f;
+        m_last_beat = block;
+        found = true;
+      }
+    }
+    m_flux[m_blocks % history] = current;
+    ++m_blocks;
+    return found;
+  }
+
+  // Blocks pushed so far.
+  int blocks() const { return m_blocks; }
+
+protected:
+  // Sum of how much every bin got louder since the previous block. Bins are
+  // compressed to the fourth root of their power first, so a quiet hi-hat
+  // still counts next to a loud bass line.
+  float flux() {
+    __m128 sum{_mm_setzero_ps()};
+    __m128 zero{_mm_setzero_ps()};
+    for (int i = 0; i < window / 2; i += 4) {
+      __m128 r{_mm_loadu_ps(&m_re[i])}, m{_mm_loadu_ps(&m_im[i])};
+      __m128 power{_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m))};
+      __m128 level{_mm_sqrt_ps(_mm_sqrt_ps(power))};
+      __m128 rise{_mm_sub_ps(level, _mm_loadu_ps(&m_previous[i]))};
+      sum = _mm_add_ps(sum, _mm_max_ps(rise, zero));
+      _mm_storeu_ps(&m_previous[i], level);
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+
+  // Mean plus 3 standard deviations of the flux of the last blocks, with
+  // a floor so that silence and near-silence never trigger. The |candidate|
+  // block itself is left out, so a peak doesn't raise its own threshold.
+  float threshold(int candidate) const {
+    int count{m_blocks < history ? m_blocks : history};
+    int skip{candidate % history};
+    float mean{0}, spread{0};
+    for (int i = 0; i < count; ++i)
+      mean += i == skip ? 0.0f : m_flux[i];
+    mean /= count - 1;
+    for (int i = 0; i < count; ++i)
+      spread += i == skip ? 0.0f : (m_flux[i] - mean) * (m_flux[i] - mean);
+    float deviation{static_cast<float>(sqrt(spread / (count - 1)))};
+    float t{mean + 3.0f * deviation};
+    return t > 1.0f ? t : 1.0f;
+  }
+
+  fft m_fft;
+  int m_rate;
+  std::vector<float> m_samples; // The last |window| samples, oldest first.
+  std::vector<float> m_hann;
+  std::vector<float> m_re;
+  std::vector<float> m_im;
+  std::vector<float> m_previous; // Last block's compressed levels.
+  std::vector<float> m_flux;     // Ring of the last |history| fluxes.
+  int m_blocks;
+  int m_last_beat;
+  int m_min_gap; // Fewest blocks between two beats.
+};
+
+// Decodes and analyses a WAV file on its own thread, a block at a time as
+// the music plays. There's no audio output yet, so the music "plays" on the
+// wall clock from start(); it loops at the end. Everything is allocated by
+// open(), the thread only reuses it.
+class analyzer {
+public:
+  analyzer()
+      : m_detector(nullptr), m_thread(nullptr), m_start(0), m_busy(0),
+        m_position(0), m_beats(0), m_dropped(0), m_delivered(0),
+        m_latency_total(0), m_latency_worst(0) {
+    m_running.store(false);
+  }
+
+  ~analyzer() {
+    stop();
+    delete m_detector;
+  }
+
+  bool open(const char *file) {
+    stop();
+    if (!m_music.open(file, onset_detector::hop))
+      return false;
+    delete m_detector;
+    m_detector = new onset_detector(m_music.rate());
+    m_block.assign(onset_detector::hop, 0.0f);
+    m_busy = m_position = 0;
+    m_beats = m_dropped = 0;
+    return true;
+  }
+
+  // Start the music and the thread analysing it.
+  void start() {
+    if (!m_music.is_open() || m_thread)
+      return;
+    m_running.store(true);
+    m_start = profile::now();
+    m_thread = CreateThread(NULL, 0, &analyzer::run, this, 0, NULL);
+  }
+
+  void stop() {
+    if (!m_thread)
+      return;
+    m_running.store(false);
+    WaitForSingleObject(m_thread, INFINITE);
+    CloseHandle(m_thread);
+    m_thread = nullptr;
+  }
+
+  // Decode and analyse the next block right now, publishing a beat if it
+  // ends one. False once the music is over (it doesn't loop here).
+  bool analyse() {
+    profile::ticks start{profile::now()};
+    int count{m_music.read(&m_block[0], onset_detector::hop)};
+    if (!count)
+      return false;
+    for (int i = count; i < onset_detector::hop; ++i)
+      m_block[i] = 0.0f;
+    m_position += onset_detector::hop;
+
+    beat b;
+    if (m_detector->push(&m_block[0], b)) {
+      b.detected = start;
+      ++m_beats;
+      if (!m_beats_out.push(b))
+        ++m_dropped;
+    }
+    m_busy += profile::now() - start;
+    return true;
+  }
+
+  // Update thread: take the next beat, if one was found.
+  bool poll(beat &out) { return m_beats_out.pop(out); }
+
+  // Update thread: the frame acting on a beat detected at |detected| is
+  // done. Keeps track of the decode to spawn latency.
+  void delivered(profile::ticks detected) {
+    double millis{profile::to_millis(profile::now() - detected)};
+    profile::count("beat_latency_ms", millis);
+    m_latency_total += millis;
+    m_latency_worst = millis > m_latency_worst ? millis : m_latency_worst;
+    ++m_delivered;
+  }
+
+  double seconds() const {
+    return m_music.rate() ? double(m_position) / m_music.rate() : 0.0;
+  }
+  int beats() const { return m_beats; }
+  int dropped() const { return m_dropped; }
+  double busy_millis() const { return profile::to_millis(m_busy); }
+
+  // Share of one core analysis took, against the length of the music it
+  // got through.
+  double load() const {
+    return seconds() > 0 ? busy_millis() / (seconds() * 1000.0) : 0.0;
+  }
+
+  double mean_latency() const {
+    return m_delivered ? m_latency_total / m_delivered : 0.0;
+  }
+  double worst_latency() const { return m_latency_worst; }
+
+  // Once stopped: what was analysed and how long beats took to land.
+  void report(std::ostream &out) const {
+    out << "Music: " << seconds() << " s analysed, " << m_beats << " beats ("
+        << m_dropped << " dropped), " << load() * 100.0
+        << "% of a core" << std::endl;
+    out << "  Decode to spawn: avg " << mean_latency() << " ms, max "
+        << worst_latency() << " ms over " << m_delivered << " beats"
+        << std::endl;
+  }
+
+protected:
+  static DWORD WINAPI run(LPVOID parameter) {
+    static_cast<analyzer *>(parameter)->play();
+    return 0;
+  }
+
+  // Decode each block once the clock reaches its last sample.
+  void play() {
+    profile::name_thread("audio");
+    const double rate{static_cast<double>(m_music.rate())};
+    while (m_running.load()) {
+      double due{(m_position + onset_detector::hop) / rate * 1000.0};
+      double now{profile::to_millis(profile::now() - m_start)};
+      if (now < due) {
+        Sleep(static_cast<DWORD>(due - now) + 1);
+        continue;
+      }
+      PROFILE_SCOPE("analyse");
+      if (!analyse())
+        m_music.rewind();
+    }
+  }
+
+  wav_reader m_music;
+  onset_detector *m_detector;
+  std::vector<float> m_block;
+  beat_queue m_beats_out;
+  HANDLE m_thread;
+  std::atomic<bool> m_running;
+  profile::ticks m_start;
+
+  // Written by the audio thread, read once it's stopped.
+  profile::ticks m_busy; // Spent decoding and analysing.
+  long long m_position;  // Samples decoded, over every loop of the music.
+  int m_beats;
+  int m_dropped;
+
+  // Update thread only.
+  int m_delivered;
+  double m_latency_total;
+  double m_latency_worst;
+
+private:
+  analyzer(const analyzer &);
+  analyzer &operator=(const analyzer &);
+};
+
+} // namespace audio
+
+#endif // _AUDIO_HPP
@@ -0,0 +1,214 @@
+#ifndef _BATCH_HPP
+#define _BATCH_HPP
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "Session.hpp"
+#include "Tasks.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Many independent games in one process, for automated play testing. Every
+// thread hosts one session (its own pool, units and random streams) and
+// plays game after game on it, restarting it with each game's seed, so
+// threads share nothing but the counter handing out the next game. Games are
+// driven by a scripted player and a fixed timestep, so a game's result only
+// depends on its seed - not on the thread count or which thread played it.
+namespace batch {
+
+struct options {
+  int sessions;           // Games to play.
+  int frames;             // Frames per game.
+  int threads;            // Threads to play them on, 0 for one per core.
+  bool render;            // Render every frame headlessly, not just simulate.
+  int width, height;      // Output size when rendering.
+  rng::uint64 first_seed; // Game i plays with first_seed + i.
+  game::settings config;  // Settings for every session (threads is ignored).
+
+  options()
+      : sessions(64), frames(3600), threads(0), render(false), width(640),
+        height(480), first_seed(2635) {}
+};
+
+// How one game went.
+struct result {
+  rng::uint64 seed;
+  unsigned int state; // Hash of the units at the end.
+  int particles;      // Particles alive at the end.
+  double millis;      // Time it took to play.
+};
+
+// Scripted input: holds a random direction (or none) for a random number of
+// frames, then picks again. The ships fire by themselves.
+class autopilot {
+public:
+  autopilot(rng::uint64 seed)
+      : m_random(seed ^ 0x9e3779b97f4a7c15ull), m_keys(0), m_hold(0) {}
+
+  unsigned int next() {
+    if (m_hold-- <= 0) {
+      static const unsigned int moves[] = {
+          0,
+          input::KEY_LEFT,
+          input::KEY_RIGHT,
+          input::KEY_UP,
+          input::KEY_DOWN,
+          input::KEY_LEFT | input::KEY_UP,
+          input::KEY_RIGHT | input::KEY_UP,
+          input::KEY_LEFT | input::KEY_DOWN,
+          input::KEY_RIGHT | input::KEY_DOWN};
+      m_keys = moves[m_random.range(sizeof(moves) / sizeof(moves[0]))];
+      m_hold = 10 + m_random.range(50);
+    }
+    return m_keys;
+  }
+
+protected:
+  rng::stream m_random;
+  unsigned int m_keys;
+  int m_hold;
+};
+
+inline unsigned int hash_units(const std::vector<math::vec8> &units) {
+  unsigned int hash{2166136261u};
+  const unsigned char *bytes =
+      reinterpret_cast<const unsigned char *>(units.data());
+  for (size_t i = 0; i < units.size() * sizeof(math::vec8); ++i)
+    hash = (hash ^ bytes[i]) * 16777619u;
+  return hash;
+}
+
+class runner {
+public:
+  runner(const options &o)
+      : m_options(o), m_threads(0), m_start(0), m_end(0) {
+    m_options.config.threads = 0;
+    m_next.store(0);
+  }
+
+  // Play every game and return when they're all done. Results land in
+  // results(), in seed order.
+  void run() {
+    m_results.assign(m_options.sessions, result());
+    m_next.store(0);
+    if (m_options.threads == 1) {
+      m_threads = 1;
+      m_start = profile::now();
+      play();
+      m_end = profile::now();
+      return;
+    }
+
+    // The calling thread plays too, so one worker fewer than asked for.
+    task::pool workers(m_options.threads > 1 ? m_options.threads - 1 : 0);
+    m_threads = workers.threads() + 1;
+    std::atomic<int> remaining(m_threads);
+    std::vector<player> players(m_threads, player(this, &remaining));
+    m_start = profile::now();
+    for (int i = 0; i < m_threads; ++i)
+      workers.submit(&players[i]);
+    workers.help(remaining);
+    m_end = profile::now();
+  }
+
+  const std::vector<result> &results() const { return m_results; }
+  int threads() const { return m_threads; }
+  double millis() const { return profile::to_millis(m_end - m_start); }
+
+  // Simulated frames per second over all threads.
+  double frames_per_second() const {
+    double frames{static_cast<double>(m_options.sessions) * m_options.frames};
+    return millis() > 0 ? frames * 1000.0 / millis() : 0.0;
+  }
+
+  // One hash over every game's result, the same for any thread count.
+  unsigned int checksum() const {
+    unsigned int hash{2166136261u};
+    for (size_t i = 0; i < m_results.size(); ++i)
+      hash = (hash ^ m_results[i].state) * 16777619u;
+    return hash;
+  }
+
+protected:
+  // One thread's worth of games. Builds its session on the thread that plays
+  // it, so its memory is local to that thread.
+  struct player : public task::job {
+    runner *owner;
+    std::atomic<int> *remaining;
+
+    player(runner *r, std::atomic<int> *count) : owner(r), remaining(count) {}
+    player(const player &other)
+        : owner(other.owner), remaining(other.remaining) {}
+
+    virtual void execute(int) {
+      owner->play();
+      remaining->fetch_sub(1, std::memory_order_release);
+    }
+  };
+
+  void play() {
+    const options &o{m_options};
+    util::mem_pool pool(game::session::pool_bytes(o.config));
+    std::vector<detail::Uint32> buffer(o.render ? o.width * o.height : 0);
+    math::vec2 iResolution(o.width, o.height);
+    game::session world(pool, o.first_seed, o.config);
+    const double millis = 1000.0 / 60.0;
+
+    for (int i = m_next.fetch_add(1); i < o.sessions;
+         i = m_next.fetch_add(1)) {
+      PROFILE_SCOPE("game");
+      profile::ticks start{profile::now()};
+      rng::uint64 seed{o.first_seed + static_cast<rng::uint64>(i)};
+      world.restart(seed);
+      autopilot pilot(seed);
+      for (int frame = 0; frame < o.frames; ++frame) {
+        unsigned int keys{pilot.next()};
+        if (o.render)
+          world.step(&buffer[0], iResolution, millis, 60.0, keys);
+        else
+          world.simulate(millis, 60.0, keys);
+      }
+      result r = {seed, hash_units(world.units), world.effects.live(),
+                  profile::to_millis(profile::now() - start)};
+      m_results[i] = r;
+    }
+  }
+
+  options m_options;
+  std::vector<result> m_results;
+  int m_threads;
+  std::atomic<int> m_next;
+  profile::ticks m_start;
+  profile::ticks m_end;
+};
+
+// Run a batch and print what it did.
+inline void report(const options &o) {
+  runner batch(o);
+  batch.run();
+  const std::vector<result> &results{batch.results()};
+  double slowest{0}, total{0};
+  int particles{0};
+  for (size_t i = 0; i < results.size(); ++i) {
+    total += results[i].millis;
+    slowest = results[i].millis > slowest ? results[i].millis : slowest;
+    particles += results[i].particles;
+  }
+  std::cout << "Played " << o.sessions << " games of " << o.frames
+            << " frames on " << batch.threads() << " threads in "
+            << batch.millis() << " ms" << (o.render ? " (rendered)" : "")
+            << std::endl;
+  std::cout << "  " << batch.frames_per_second()
+            << " simulated frames per second, "
+            << (results.empty() ? 0.0 : total / results.size())
+            << " ms per game (slowest " << slowest << " ms), "
+            << (results.empty() ? 0 : particles / static_cast<int>(
+                                                      results.size()))
+            << " particles alive at the end" << std::endl;
+  std::cout << "  Checksum: " << std::hex << batch.checksum() << std::dec
+            << std::endl;
+}
+
+} // namespace batch
+
+#endif // _BATCH_HPP
@@ -1,15 +1,33 @@
 // BeatMaster.cpp : Contains rendering functions for application.
 // Shaheed Abdol - 2015.
 #include <crtdbg.h>
-#include "Game.hpp"
-#include <chrono>
+#include "Alloc.hpp"
+#include "Audio.hpp"
+#include "Batch.hpp"
+#include "Bench.hpp"
+#include "Governor.hpp"
+#include "Hud.hpp"
+#include "Offline.hpp"
+#include "Replay.hpp"
+#include "Share.hpp"
+#include <cstring>
+
+// Command line switches, filled in by main before the window comes up.
+static const char *g_record_file = nullptr;
+static game::settings g_settings;
+static bool g_adaptive = false;
+static double g_frame_budget = 12.0;
+static const char *g_graph_file = nullptr;
+static bool g_stats = false;
+static const char *g_music_file = nullptr;
+static const char *g_export_name = nullptr;
 
 // This is the guts of the renderer, without this it will do nothing.
 DWORD WINAPI Update(LPVOID lpParameter) {
-  // Seed random number generator.
-  srand(2635);
+  profile::name_thread("update");
 
-  auto start_time = std::chrono::high_resolution_clock::now();
+  profile::ticks start_time = profile::now();
+  profile::ticks launched = start_time;
 
   Renderer *g_renderer = static_cast<Renderer *>(lpParameter);
   game::BitmapRenderer *bmp =
@@ -21,66 +39,304 @@ DWORD WINAPI Update(LPVOID lpParameter) {
   math::vec2 iResolution(static_cast<double>(g_renderer->screen.GetWidth()),
                          static_cast<double>(g_renderer->screen.GetHeight()));
 
-  // We place a light 'somewhere' in the scene for shadow projection.
-  math::vec3 light(game::_width * 0.5, game::_height * 0.5, 240.0);
-
-  std::vector<math::vec8> units;
-  std::vector<game::texture> textures;
+  // Seed the session's random number generator. The background and bar
+  // finish loading while the first frames are already up.
+  const rng::uint64 seed = 2635;
+  game::session world(pool, seed, g_settings, true);
 
-  textures.push_back(game::texture("..//res//player.graw", pool));
-  textures.push_back(game::texture("..//res//enemy.graw", pool));
-  textures.push_back(game::texture("..//res//projectile.graw", pool));
+  replay::recorder recorder;
+  if (g_record_file)
+    recorder.open(g_record_file,
+                  replay::describe(world, seed, g_renderer->screen.GetWidth(),
+                                   g_renderer->screen.GetHeight()));
 
-  game::texture bg("..//res//bg[0].graw", pool);
-  game::texture bar("../res//bar.graw", pool);
-  game::texture img(math::vec2i(game::_width, game::_height), pool);
-  game::texture fg(math::vec2i(game::_width, game::_height), pool);
-  game::texture sg(math::vec2i(game::_width, game::_height), pool);
-
-  int offset = 0;
-  auto end_time = std::chrono::high_resolution_clock::now();
+  input::state keys;
+  quality::governor governor(g_settings, g_frame_budget);
+  hud::overlay overlay;
+  audio::analyzer music;
+  if (g_music_file && music.open(g_music_file))
+    music.start();
+  share::writer exported;
+  if (g_export_name)
+    exported.open(g_export_name, g_renderer->screen.GetWidth(),
+                  g_renderer->screen.GetHeight());
+  profile::ticks end_time = profile::now();
+  int frame{0};
 
   while (g_renderer->IsRunning()) {
-    auto ticks = std::chrono::duration_cast<std::chrono::milliseconds>(
-        end_time - start_time);
-    start_time = std::chrono::high_resolution_clock::now();
-    auto millis = std::chrono::duration<double, std::milli>(ticks).count();
-    int dir = bmp ? bmp->GetDirection() : -1;
+    PROFILE_SCOPE("frame");
+    alloc::counter heap;
+    bool loading{!world.assets_ready()}; // Installing assets allocates.
+    double millis = profile::to_millis(end_time - start_time);
+    start_time = profile::now();
+    keys.poll(bmp->GetInput());
     detail::Uint32 *buffer = g_renderer->screen.GetPixels();
 
-    // Copy the background onto the image.
-    img.copy(bg, offset++);
-
     bmp->SetTicks(millis);
     double fps{bmp->GetFPS()};
 
-    // Clear out the foreground texture.
-    fg.clear();
+    // Beats found since the last frame land on this one.
+    unsigned int active{keys.active()};
+    audio::beat beat;
+    profile::ticks beat_detected{0};
+    while (music.poll(beat)) {
+      active |= input::KEY_BEAT;
+      beat_detected = beat_detected ? beat_detected : beat.detected;
+    }
 
-    // Next render the entities onto the fg texture.
-    game::draw_units(textures, fg, units, millis, fps, dir);
+    recorder.record(active, millis, fps);
+    world.step(buffer, iResolution, millis, fps, active);
+    if (beat_detected)
+      music.delivered(beat_detected);
+    // The window owns the frame's buffer, so sharing it costs one copy.
+    if (exported.is_open()) {
+      PROFILE_SCOPE("export");
+      exported.publish(buffer, millis);
+    }
+    if (g_adaptive && governor.update(world.stage_millis)) {
+      world.set_quality(governor.current());
+      const quality::decision &d{
+          governor.history(governor.history_size() - 1)};
+      std::cout << "Quality level " << d.from << " -> " << d.to << " at "
+                << d.millis << " ms (" << game::stage_names[d.stage] << ")"
+                << std::endl;
+    }
 
-    // Clear the shadow map
-    sg.clear();
-    // Compute the shadow map from the rendered entities
-    game::compute_shadows(fg, sg, light);
-
-    // Composition everything onto the img buffer
-    game::draw_stage(buffer, iResolution, img, sg, fg, bar, millis, dir);
+    overlay.draw(buffer, g_renderer->screen.GetWidth(),
+                 g_renderer->screen.GetHeight(), fps, bmp->GetMPF(),
+                 g_stats ? &world : nullptr,
+                 g_adaptive ? governor.level() : -1);
 
     // Flip buffers, and sleep a bit.
-    g_renderer->screen.Flip(true);
+    {
+      PROFILE_SCOPE("flip");
+      g_renderer->screen.Flip(true);
+    }
     g_renderer->updateThread.Delay(1);
-    end_time = std::chrono::high_resolution_clock::now();
+    end_time = profile::now();
+
+    if (frame == 0)
+      std::cout << "First frame up after "
+                << profile::to_millis(end_time - launched) << " ms, "
+                << world.loading.pending() << " assets still loading"
+                << std::endl;
+    if (alloc::g_check && frame > 0 && !loading && heap.allocations())
+      std::cout << "Frame " << frame << " allocated " << heap.allocations()
+                << " times (" << heap.allocated_bytes() << " bytes)"
+                << std::endl;
+    ++frame;
+  }
+
+  recorder.close();
+  if (g_music_file) {
+    music.stop();
+    music.report(std::cout);
   }
+  if (!world.frame.empty()) {
+    world.frame.print(std::cout);
+    if (g_graph_file)
+      world.frame.write_dot(g_graph_file);
+  }
+  if (profile::g_trace_file)
+    profile::export_chrome_trace(profile::g_trace_file);
 
   return 0;
 }
 
+// Read a <w>x<h> size for |name| from |arg| into |width| and |height|. They
+// are left alone, and false returned, unless both parse and are above 0.
+static bool parse_size(const char *name, const char *arg, int &width,
+                       int &height) {
+  int w{0}, h{0};
+  if (sscanf_s(arg, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+    std::cout << name << " must be <width>x<height>, both more than 0."
+              << std::endl;
+    return false;
+  }
+  width = w;
+  height = h;
+  return true;
+}
+
+// Read a whole number for |name| from |arg| into |value|. It is left alone,
+// and false returned, unless it parses and is from |low| to |high|.
+static bool parse_count(const char *name, const char *arg, int low, int high,
+                        int &value) {
+  int n{0};
+  if (sscanf_s(arg, "%d", &n) != 1 || n < low || n > high) {
+    std::cout << name << " must be a whole number from " << low << " to "
+              << high << "." << std::endl;
+    return false;
+  }
+  value = n;
+  return true;
+}
+
+// Read a time in milliseconds for |name| from |arg| into |millis|. It is left
+// alone, and false returned, unless it parses and is above 0.
+static bool parse_millis(const char *name, const char *arg, double &millis) {
+  double ms{0};
+  if (sscanf_s(arg, "%lf", &ms) != 1 || !(ms > 0)) {
+    std::cout << name << " must be a number of milliseconds more than 0."
+              << std::endl;
+    return false;
+  }
+  millis = ms;
+  return true;
+}
+
 int main(int argc, char *argv[]) {
   _CrtSetDbgFlag(0);
+
+  // --trace <file> records per-stage timings and writes a Chrome trace on exit.
+  // --record <file> logs every frame's input so it can be replayed later.
+  // --replay <file> plays a log back headlessly and reports frame timings.
+  // --animate-light moves the shadow casting light every frame.
+  // --bench <name> runs one of the headless benchmarks in Bench.hpp.
+  // --resolution <w>x<h> sets the internal playfield render resolution.
+  // --output <w>x<h> sets the size of the composited frame.
+  // --window <w>x<h> sets the size of the window the frame is stretched to.
+  // --shadow-scale <n> computes shadows at 1/n resolution (1, 2 or 4).
+  // --tiled renders in 32x32 tiles instead of full screen passes.
+  // --adaptive lowers render quality when frames run over budget.
+  // --frame-budget <ms> is the render time --adaptive aims for (default 12).
+  // --threads <n> runs the frame stages as a task graph on n worker threads.
+  // --task-graph <file> writes the last frame's task graph as Graphviz dot.
+  // --stats shows stage timings, counts and pool usage over the game.
+  // --compact-textures keeps sprites palette indexed and the background RGB565.
+  // --patterns has enemies fire bullet patterns instead of single shots,
+  //   --pattern-file <file> the patterns in <file> (see Patterns.hpp).
+  // --check-alloc reports (and fails a replay on) frames that allocate.
+  // --music <file.wav> spawns and fires enemy waves on the beats of the music.
+  // --export <name> shares every finished frame in shared memory as <name>.
+  // --watch <name> follows the frames another instance shares as <name>.
+  // --batch <games> plays that many scripted games headlessly on every core
+  //   (or --threads n), --frames <n> long, --batch-render to render them too.
+  // --render <file> renders --frames <n> frames (or a whole --replay log) at
+  //   a fixed --fps <n> (default 60) into a raw or .y4m file, flat out.
+  const char *replay_file = nullptr;
+  const char *bench_name = nullptr;
+  const char *watch_name = nullptr;
+  batch::options games;
+  games.sessions = 0;
+  offline::options video;
+  int frames{0};
+  detail::RendererConfig config;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      profile::enable(argv[++i]);
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+      g_record_file = argv[++i];
+    else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+      replay_file = argv[++i];
+    else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+      bench_name = argv[++i];
+    else if (strcmp(argv[i], "--animate-light") == 0)
+      g_settings.animate_light = true;
+    else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc)
+      parse_size("Resolution", argv[++i], g_settings.width, g_settings.height);
+    else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+      parse_size("Output", argv[++i], config.width, config.height);
+    else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+      parse_size("Window", argv[++i], config.window_width,
+                 config.window_height);
+    else if (strcmp(argv[i], "--shadow-scale") == 0 && i + 1 < argc)
+      sscanf_s(argv[++i], "%d", &g_settings.shadow_scale);
+    else if (strcmp(argv[i], "--tiled") == 0)
+      g_settings.tiled = true;
+    else if (strcmp(argv[i], "--adaptive") == 0)
+      g_adaptive = true;
+    else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc)
+      parse_millis("Frame budget", argv[++i], g_frame_budget);
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      parse_count("Threads", argv[++i], 0, task::max_workers,
+                  g_settings.threads);
+    else if (strcmp(argv[i], "--task-graph") == 0 && i + 1 < argc)
+      g_graph_file = argv[++i];
+    else if (strcmp(argv[i], "--stats") == 0)
+      g_stats = true;
+    else if (strcmp(argv[i], "--compact-textures") == 0)
+      g_settings.compact_textures = true;
+    else if (strcmp(argv[i], "--patterns") == 0)
+      g_settings.bullet_patterns = true;
+    else if (strcmp(argv[i], "--pattern-file") == 0 && i + 1 < argc)
+      g_settings.pattern_file = argv[++i];
+    else if (strcmp(argv[i], "--check-alloc") == 0)
+      alloc::g_check = true;
+    else if (strcmp(argv[i], "--music") == 0 && i + 1 < argc)
+      g_music_file = argv[++i];
+    else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+      g_export_name = argv[++i];
+    else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+      watch_name = argv[++i];
+    else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+      parse_count("Games", argv[++i], 1, 1000000, games.sessions);
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+      parse_count("Frames", argv[++i], 1, 10000000, frames);
+    else if (strcmp(argv[i], "--batch-render") == 0)
+      games.render = true;
+    else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc)
+      video.file = argv[++i];
+    else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+      parse_count("Fps", argv[++i], 1, 1000, video.fps);
+  }
+  if (g_settings.shadow_scale != 1 && g_settings.shadow_scale != 2 &&
+      g_settings.shadow_scale != 4) {
+    std::cout << "Shadow scale must be 1, 2 or 4." << std::endl;
+    g_settings.shadow_scale = 1;
+  }
+  if (g_settings.tiled && g_settings.shadow_scale != 1) {
+    std::cout << "Tiled rendering always computes shadows at full "
+              << "resolution, ignoring --shadow-scale." << std::endl;
+    g_settings.shadow_scale = 1;
+  }
+  if (g_settings.pattern_file)
+    g_settings.bullet_patterns = true;
+  config.pool_bytes = game::session::pool_bytes(g_settings);
+
+  if (bench_name)
+    return bench::run(bench_name) ? 0 : 1;
+
+  if (watch_name)
+    return share::watch(watch_name) ? 0 : 1;
+
+  if (video.file) {
+    profile::name_thread("render");
+    video.inputs = replay_file;
+    video.frames = frames;
+    video.width = config.width;
+    video.height = config.height;
+    video.config = g_settings;
+    bool rendered = offline::render(video);
+    if (profile::g_trace_file)
+      profile::export_chrome_trace(profile::g_trace_file);
+    return rendered ? 0 : 1;
+  }
+
+  if (games.sessions > 0) {
+    if (frames > 0)
+      games.frames = frames;
+    games.threads = g_settings.threads;
+    games.width = config.width;
+    games.height = config.height;
+    games.config = g_settings;
+    batch::report(games);
+    if (profile::g_trace_file)
+      profile::export_chrome_trace(profile::g_trace_file);
+    return 0;
+  }
+
+  if (replay_file) {
+    profile::name_thread("replay");
+    bool played =
+        replay::play(replay_file, g_settings, g_graph_file, g_export_name);
+    if (profile::g_trace_file)
+      profile::export_chrome_trace(profile::g_trace_file);
+    return played ? 0 : 1;
+  }
+
   game::BitmapRenderer bmp;
   Renderer renderer("BeatMaster", &Update,
-                    reinterpret_cast<detail::IBitmapRenderer *>(&bmp));
+                    reinterpret_cast<detail::IBitmapRenderer *>(&bmp), config);
   return 0;
 }
\ No newline at end of file
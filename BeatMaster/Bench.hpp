@@ -0,0 +1,1186 @@
+#ifndef _BENCH_HPP
+#define _BENCH_HPP
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "Assets.hpp"
+#include "Audio.hpp"
+#include "Batch.hpp"
+#include "Governor.hpp"
+#include "Hud.hpp"
+#include "Patterns.hpp"
+#include "Session.hpp"
+#include "Share.hpp"
+#include "Snapshot.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Headless micro benchmarks, run with --bench <name>. Every benchmark uses
+// fixed seeds and a fixed timestep so numbers are comparable between builds.
+namespace bench {
+
+// Keeps a running min / max / mean of a timed section.
+struct timing {
+  double total;
+  double slowest;
+  double fastest;
+  int samples;
+
+  timing() : total(0), slowest(0), fastest(0), samples(0) {}
+
+  void add(double millis) {
+    total += millis;
+    slowest = (!samples || millis > slowest) ? millis : slowest;
+    fastest = (!samples || millis < fastest) ? millis : fastest;
+    ++samples;
+  }
+
+  double mean() const { return samples ? total / samples : 0.0; }
+
+  void print(const char *name) const {
+    std::cout << "  " << name << ": avg " << mean() << " ms, min " << fastest
+              << " ms, max " << slowest << " ms" << std::endl;
+  }
+};
+
+// A session on a pool of its own, seeded the same for every benchmark.
+struct fixture {
+  util::mem_pool pool;
+  game::session world;
+
+  fixture(const game::settings &options = game::settings())
+      : pool(game::session::pool_bytes(options)), world(pool, 2635, options) {}
+
+private:
+  fixture(const fixture &);
+  fixture &operator=(const fixture &);
+};
+
+// Keep ~50k particles alive on a playfield sized surface and time the SIMD
+// update and the additive raster separately.
+bool particles() {
+  const int target = 50000;
+  const int frames = 600;
+  const float millis = 1000.0f / 60.0f;
+
+  util::mem_pool pool(4 * 1048576);
+  fx::particles effects(pool, game::session::max_particles, rng::stream(1234));
+  rng::stream random(4321);
+  std::vector<detail::Uint32> surface(game::_width * game::_height);
+
+  timing update, draw;
+  double live{0};
+  for (int frame = 0; frame < frames; ++frame) {
+    // Top the pool up with bursts of 512, like a screen full of explosions.
+    while (effects.live() + 512 <= target)
+      effects.emit_burst(random.uniform(0.0f, game::_width),
+                         random.uniform(0.0f, game::_height), 512, 0.05f,
+                         random.uniform(500.0f, 2000.0f), 0xff402010);
+    memset(&surface[0], 0, surface.size() * sizeof(detail::Uint32));
+    live += effects.live();
+
+    profile::ticks start{profile::now()};
+    effects.update(millis);
+    profile::ticks mid{profile::now()};
+    effects.draw(&surface[0], game::_width, game::_height);
+    profile::ticks end{profile::now()};
+
+    update.add(profile::to_millis(mid - start));
+    draw.add(profile::to_millis(end - mid));
+  }
+
+  std::cout << "particles: " << frames << " frames, avg "
+            << static_cast<int>(live / frames) << " live" << std::endl;
+  update.print("update");
+  draw.print("draw");
+  std::cout << "  total: avg " << update.mean() + draw.mean() << " ms"
+            << std::endl;
+  return true;
+}
+
+// Render the same deterministic game at increasing resolutions (internal and
+// output the same size) and report each stage's cost per pixel. Stages that
+// scale linearly keep a flat ns/pixel; a rising ns/pixel shows where a stage
+// stops being compute bound and starts waiting on memory.
+bool resolution() {
+  const int sizes[][2] = {{320, 240},   {321, 241},   {640, 480},
+                          {1280, 720},  {1920, 1080}, {2560, 1440},
+                          {3840, 2160}};
+  static const int size_count = 7;
+  const int warmup = 30;
+  const int frames = 120;
+  const double millis = 1000.0 / 60.0;
+
+  for (int s = 0; s < size_count; ++s) {
+    game::settings options;
+    options.width = sizes[s][0];
+    options.height = sizes[s][1];
+    int pixels = options.width * options.height;
+
+    fixture setup(options);
+    game::session &world{setup.world};
+    std::vector<detail::Uint32> buffer(pixels);
+    math::vec2 iResolution(options.width, options.height);
+
+    double totals[game::STAGE_COUNT] = {0};
+    for (int frame = 0; frame < warmup + frames; ++frame) {
+      world.step(&buffer[0], iResolution, millis, 60.0, 0);
+      for (int i = 0; frame >= warmup && i < game::STAGE_COUNT; ++i)
+        totals[i] += world.stage_millis[i];
+    }
+
+    std::cout << "resolution " << options.width << "x" << options.height
+              << std::endl;
+    double frame_total{0};
+    for (int i = 0; i < game::STAGE_COUNT; ++i) {
+      double ms{totals[i] / frames};
+      frame_total += ms;
+      std::cout << "  " << game::stage_names[i] << ": " << ms << " ms, "
+                << ms * 1000000.0 / pixels << " ns/pixel" << std::endl;
+    }
+    std::cout << "  frame: " << frame_total << " ms, "
+              << frame_total * 1000000.0 / pixels << " ns/pixel" << std::endl;
+  }
+  return true;
+}
+
+// Run the same game with full, half and quarter resolution shadows side by
+// side and report what the shadow stages cost against how far the frames
+// drift from the full resolution ones.
+bool shadows() {
+  const int sizes[][2] = {{640, 480}, {1920, 1080}};
+  static const int size_count = 2;
+  const int scales[] = {1, 2, 4};
+  const int count = sizeof(scales) / sizeof(scales[0]);
+  const int warmup = 30;
+  const int frames = 120;
+  const double millis = 1000.0 / 60.0;
+
+  for (int s = 0; s < size_count; ++s) {
+    int pixels = sizes[s][0] * sizes[s][1];
+    math::vec2 iResolution(sizes[s][0], sizes[s][1]);
+
+    // Shadows never feed back into the simulation, so sessions with the same
+    // seed stay in lockstep and their frames can be compared pixel by pixel.
+    std::vector<fixture *> games;
+    std::vector<std::vector<detail::Uint32> > buffers(count);
+    for (int i = 0; i < count; ++i) {
+      game::settings options;
+      options.width = sizes[s][0];
+      options.height = sizes[s][1];
+      options.shadow_scale = scales[i];
+      games.push_back(new fixture(options));
+      buffers[i].resize(pixels);
+    }
+
+    timing shadow[count], composite[count];
+    double error[count] = {0};
+    int worst[count] = {0};
+    for (int frame = 0; frame < warmup + frames; ++frame) {
+      for (int i = 0; i < count; ++i) {
+        game::session &world{games[i]->world};
+        world.step(&buffers[i][0], iResolution, millis, 60.0, 0);
+        if (frame >= warmup) {
+          shadow[i].add(world.stage_millis[game::STAGE_CLEAR_SG] +
+                        world.stage_millis[game::STAGE_SHADOWS]);
+          composite[i].add(world.stage_millis[game::STAGE_COMPOSITE]);
+        }
+      }
+
+      // Mean and largest per channel difference against full resolution.
+      for (int i = 1; frame >= warmup && i < count; ++i) {
+        long long sum{0};
+        for (int p = 0; p < pixels; ++p) {
+          detail::Uint32 a{buffers[0][p]};
+          detail::Uint32 b{buffers[i][p]};
+          for (int shift = 0; shift < 24; shift += 8) {
+            int d = abs(static_cast<int>((a >> shift) & 0xff) -
+                        static_cast<int>((b >> shift) & 0xff));
+            sum += d;
+            worst[i] = d > worst[i] ? d : worst[i];
+          }
+        }
+        error[i] += static_cast<double>(sum) / (3.0 * pixels);
+      }
+    }
+
+    std::cout << "shadows " << sizes[s][0] << "x" << sizes[s][1] << std::endl;
+    for (int i = 0; i < count; ++i) {
+      std::cout << "  1/" << scales[i] << ": shadows " << shadow[i].mean()
+                << " ms, composite " << composite[i].mean() << " ms, total "
+                << shadow[i].mean() + composite[i].mean()
+                << " ms, mean error " << error[i] / frames
+                << ", max error " << worst[i] << std::endl;
+      delete games[i];
+    }
+  }
+  return true;
+}
+
+// Run a 1920x1080 game under the quality governor with a budget it can only
+// meet by giving up quality, and show the levels it settles on.
+bool governor() {
+  const int frames = 1200;
+  const double millis = 1000.0 / 60.0;
+  const double budget = 8.0;
+
+  game::settings options;
+  options.width = 1920;
+  options.height = 1080;
+  fixture setup(options);
+  game::session &world{setup.world};
+  std::vector<detail::Uint32> buffer(options.width * options.height);
+  math::vec2 iResolution(options.width, options.height);
+  quality::governor governor(options, budget);
+
+  timing first, last;
+  for (int frame = 0; frame < frames; ++frame) {
+    world.step(&buffer[0], iResolution, millis, 60.0, 0);
+    if (governor.update(world.stage_millis))
+      world.set_quality(governor.current());
+    double total{0};
+    for (int i = 0; i < game::STAGE_COUNT; ++i)
+      total += world.stage_millis[i];
+    (frame < 60 ? first : last).add(total);
+  }
+
+  std::cout << "governor: " << frames << " frames at " << options.width << "x"
+            << options.height << ", budget " << budget << " ms" << std::endl;
+  for (int i = 0; i < governor.history_size(); ++i) {
+    const quality::decision &d{governor.history(i)};
+    const game::quality_level &q{governor.at(d.to)};
+    std::cout << "  frame " << d.frame << ": level " << d.from << " -> "
+              << d.to << " at " << d.millis << " ms ("
+              << game::stage_names[d.stage] << "), now " << q.resolution
+              << "% res, 1/" << q.shadow_scale << " shadows, blur "
+              << q.blur_taps << ", " << q.particle_limit << " particles"
+              << std::endl;
+  }
+  first.print("first 60 frames");
+  last.print("after");
+  return true;
+}
+
+// The full screen passes against tile_renderer, same game and same output
+// size, at a few internal resolutions. Reports each path's stages and checks
+// the two still produce the same pixels, false if they don't.
+bool tiles() {
+  const int sizes[][2] = {{320, 240}, {321, 241}, {1280, 720}, {1920, 1080}};
+  static const int size_count = 4;
+  const int warmup = 30;
+  const int frames = 120;
+  const double millis = 1000.0 / 60.0;
+
+  bool same{true};
+  for (int s = 0; s < size_count; ++s) {
+    int pixels = 1920 * 1080;
+    math::vec2 iResolution(1920, 1080);
+    std::cout << "tiles " << sizes[s][0] << "x" << sizes[s][1]
+              << " into 1920x1080" << std::endl;
+
+    unsigned int hashes[2] = {0, 0};
+    for (int tiled = 0; tiled < 2; ++tiled) {
+      game::settings options;
+      options.width = sizes[s][0];
+      options.height = sizes[s][1];
+      options.tiled = tiled != 0;
+      fixture setup(options);
+      game::session &world{setup.world};
+      std::vector<detail::Uint32> buffer(pixels);
+
+      double totals[game::STAGE_COUNT] = {0};
+      for (int frame = 0; frame < warmup + frames; ++frame) {
+        world.step(&buffer[0], iResolution, millis, 60.0, 0);
+        for (int i = 0; frame >= warmup && i < game::STAGE_COUNT; ++i)
+          totals[i] += world.stage_millis[i];
+      }
+      for (int i = 0; i < pixels; ++i)
+        hashes[tiled] = (hashes[tiled] ^ buffer[i]) * 16777619u;
+
+      double frame_total{0};
+      std::cout << (tiled ? "  tiled:" : "  full screen:");
+      for (int i = 0; i < game::STAGE_COUNT; ++i) {
+        frame_total += totals[i] / frames;
+        if (totals[i] > 0)
+          std::cout << " " << game::stage_names[i] << " "
+                    << totals[i] / frames;
+      }
+      std::cout << ", frame " << frame_total << " ms" << std::endl;
+    }
+    std::cout << "  output " << (hashes[0] == hashes[1] ? "matches" : "DIFFERS")
+              << std::endl;
+    same = same && hashes[0] == hashes[1];
+  }
+  return same;
+}
+
+// Wall time per frame with every stage on one thread against the task graph
+// on 1, 2 and 3 workers, full screen and tiled, at 1920x1080. Prints the
+// critical path of the last graph frame and checks the pixels still match,
+// false if they don't.
+bool tasks() {
+  const int thread_counts[] = {0, 1, 2, 3};
+  const char *const labels[] = {"single thread", "1 worker", "2 workers",
+                                "3 workers"};
+  const int count = sizeof(thread_counts) / sizeof(thread_counts[0]);
+  const int warmup = 30;
+  const int frames = 120;
+  const double millis = 1000.0 / 60.0;
+
+  bool matched{true};
+  for (int tiled = 0; tiled < 2; ++tiled) {
+    std::cout << "tasks " << (tiled ? "tiled" : "full screen") << " 1920x1080"
+              << std::endl;
+    unsigned int hashes[count] = {0};
+    for (int t = 0; t < count; ++t) {
+      game::settings options;
+      options.width = 1920;
+      options.height = 1080;
+      options.tiled = tiled != 0;
+      options.threads = thread_counts[t];
+      fixture setup(options);
+      game::session &world{setup.world};
+      std::vector<detail::Uint32> buffer(options.width * options.height);
+      math::vec2 iResolution(options.width, options.height);
+
+      timing wall;
+      for (int frame = 0; frame < warmup + frames; ++frame) {
+        profile::ticks start{profile::now()};
+        world.step(&buffer[0], iResolution, millis, 60.0, 0);
+        if (frame >= warmup)
+          wall.add(profile::to_millis(profile::now() - start));
+      }
+      for (size_t i = 0; i < buffer.size(); ++i)
+        hashes[t] = (hashes[t] ^ buffer[i]) * 16777619u;
+
+      wall.print(labels[t]);
+      if (t == count - 1)
+        world.frame.print(std::cout);
+    }
+    bool same{true};
+    for (int t = 1; t < count; ++t)
+      same = same && hashes[t] == hashes[0];
+    std::cout << "  output " << (same ? "matches" : "DIFFERS") << std::endl;
+    matched = matched && same;
+  }
+  return matched;
+}
+
+// What drawing the on screen stats costs on top of a 1920x1080 frame.
+bool hud() {
+  const int frames = 1000;
+  const double millis = 1000.0 / 60.0;
+
+  fixture setup;
+  game::session &world{setup.world};
+  std::vector<detail::Uint32> buffer(1920 * 1080);
+  math::vec2 iResolution(1920, 1080);
+  world.step(&buffer[0], iResolution, millis, 60.0, 0);
+
+  hud::overlay overlay;
+  timing basic, stats;
+  for (int frame = 0; frame < frames; ++frame) {
+    profile::ticks start{profile::now()};
+    overlay.draw(&buffer[0], 1920, 1080, 60.0, millis);
+    profile::ticks mid{profile::now()};
+    overlay.draw(&buffer[0], 1920, 1080, 60.0, millis, &world, 0);
+    profile::ticks end{profile::now()};
+    basic.add(profile::to_millis(mid - start));
+    stats.add(profile::to_millis(end - mid));
+  }
+
+  std::cout << "hud: " << frames << " draws at 1920x1080" << std::endl;
+  basic.print("fps and mpf");
+  stats.print("with stats");
+  return true;
+}
+
+// Simulated frames per second of a batch of games on 1, 2, 4, ... threads up
+// to one per core. Every run must come up with the same games; false if not.
+bool batch() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int cores = static_cast<int>(info.dwNumberOfProcessors);
+
+  ::batch::options o;
+  o.sessions = 64;
+  o.frames = 1200;
+  double single{0};
+  unsigned int first{0};
+  bool same{true};
+  for (int threads = 1;; threads *= 2) {
+    o.threads = threads < cores ? threads : cores;
+    ::batch::runner games(o);
+    games.run();
+    single = single > 0 ? single : games.frames_per_second();
+    first = threads == 1 ? games.checksum() : first;
+    std::cout << "batch: " << o.threads << " threads, "
+              << games.frames_per_second() << " frames/s, "
+              << games.frames_per_second() / single << "x, "
+              << (games.checksum() == first ? "same games" : "GAMES DIFFER")
+              << std::endl;
+    same = same && games.checksum() == first;
+    if (o.threads >= cores)
+      break;
+  }
+  return same;
+}
+
+// Snapshot every frame of a scripted game into a ring, then roll back 60
+// frames, play them again and check they come out the same, pixels and all.
+// False if they don't.
+bool snapshots() {
+  const int frames = 600;
+  const int rollback = 60;
+  const double millis = 1000.0 / 60.0;
+
+  fixture setup;
+  game::session &world{setup.world};
+  std::vector<detail::Uint32> buffer(640 * 480);
+  math::vec2 iResolution(640, 480);
+  snapshot::ring history(8 * 1048576, 128);
+
+  std::vector<unsigned int> keys(frames), hashes(frames);
+  ::batch::autopilot pilot(2635);
+  timing save, restore;
+  int largest{0};
+  for (int frame = 0; frame < frames; ++frame) {
+    profile::ticks start{profile::now()};
+    history.push(world, frame);
+    save.add(profile::to_millis(profile::now() - start));
+    largest = world.state_bytes() > largest ? world.state_bytes() : largest;
+
+    keys[frame] = pilot.next();
+    world.step(&buffer[0], iResolution, millis, 60.0, keys[frame]);
+    hashes[frame] = 2166136261u;
+    for (size_t i = 0; i < buffer.size(); ++i)
+      hashes[frame] = (hashes[frame] ^ buffer[i]) * 16777619u;
+  }
+
+  // Go back and play the last frames again from the snapshot.
+  int mismatches{0};
+  int from{0};
+  for (int round = 0; round < 100; ++round) {
+    profile::ticks start{profile::now()};
+    from = history.restore(world, frames - rollback);
+    restore.add(profile::to_millis(profile::now() - start));
+  }
+  history.discard_after(from);
+  profile::ticks replay_start{profile::now()};
+  for (int frame = from; frame < frames; ++frame)
+    world.simulate(millis, 60.0, keys[frame]);
+  double resimulate{profile::to_millis(profile::now() - replay_start)};
+
+  history.restore(world, from);
+  for (int frame = from; frame < frames; ++frame) {
+    world.step(&buffer[0], iResolution, millis, 60.0, keys[frame]);
+    unsigned int hash{2166136261u};
+    for (size_t i = 0; i < buffer.size(); ++i)
+      hash = (hash ^ buffer[i]) * 16777619u;
+    mismatches += hash != hashes[frame];
+  }
+
+  std::cout << "snapshots: " << frames << " frames, state up to " << largest
+            << " bytes, ring holds frames " << history.frame(0) << " to "
+            << history.frame(history.size() - 1) << std::endl;
+  std::cout << "  save: avg " << save.mean() * 1000.0 << " us, max "
+            << save.slowest * 1000.0 << " us" << std::endl;
+  std::cout << "  restore: avg " << restore.mean() * 1000.0 << " us, max "
+            << restore.slowest * 1000.0 << " us" << std::endl;
+  std::cout << "  re-simulating " << frames - from << " frames: " << resimulate
+            << " ms" << std::endl;
+  std::cout << "  rollback " << (mismatches ? "DIFFERS" : "matches") << " ("
+            << mismatches << " of " << frames - from << " frames differ)"
+            << std::endl;
+  return !mismatches;
+}
+
+// Write |seconds| of a 16 bit mono 44.1 kHz test track to |file|: a kick drum
+// every |beat_seconds| over a chord and some noise.
+bool write_click_track(const char *file, double seconds, double beat_seconds) {
+  FILE *out;
+  if (fopen_s(&out, file, "wb") != 0)
+    return false;
+  const unsigned int rate = 44100;
+  unsigned int frames{static_cast<unsigned int>(seconds * rate)};
+  unsigned int data{frames * 2}, riff{36 + data}, fmt{16}, byte_rate{rate * 2};
+  unsigned short format{1}, channels{1}, align{2}, bits{16};
+  fwrite("RIFF", 1, 4, out);
+  fwrite(&riff, 4, 1, out);
+  fwrite("WAVEfmt ", 1, 8, out);
+  fwrite(&fmt, 4, 1, out);
+  fwrite(&format, 2, 1, out);
+  fwrite(&channels, 2, 1, out);
+  fwrite(&rate, 4, 1, out);
+  fwrite(&byte_rate, 4, 1, out);
+  fwrite(&align, 2, 1, out);
+  fwrite(&bits, 2, 1, out);
+  fwrite("data", 1, 4, out);
+  fwrite(&data, 4, 1, out);
+
+  const double pi = 3.14159265358979323846;
+  rng::stream noise(77);
+  for (unsigned int i = 0; i < frames; ++i) {
+    double t{double(i) / rate};
+    double k{fmod(t, beat_seconds)};
+    // Pitch falls from 200 to 50 Hz, with a short click on top.
+    double kick{0.6 * exp(-k / 0.15) *
+                    sin(2.0 * pi * (50.0 * k + 3.0 * (1.0 - exp(-k / 0.02)))) +
+                (k < 0.003 ? noise.uniform(-0.4f, 0.4f) : 0.0)};
+    double chord{0.1 * (sin(2.0 * pi * 220.0 * t) + sin(2.0 * pi * 277.2 * t) +
+                        sin(2.0 * pi * 329.6 * t))};
+    double v{kick + chord + noise.uniform(-0.03f, 0.03f)};
+    short sample{static_cast<short>(v * 32767.0)};
+    fwrite(&sample, 2, 1, out);
+  }
+  fclose(out);
+  return true;
+}
+
+// Check the FFT against a plain DFT, then run a generated 120 bpm track
+// through beat detection: flat out to see what analysis costs and how many
+// beats it gets right, then in real time to time decode to delivery.
+bool beats() {
+  const char *file = "bench_beats.wav";
+  const double seconds = 30.0;
+  const double beat_seconds = 0.5;
+
+  {
+    const int n = audio::onset_detector::window;
+    audio::fft transform(n);
+    std::vector<float> re(n), im(n), input(n);
+    rng::stream random(5);
+    for (int i = 0; i < n; ++i) {
+      input[i] = random.uniform(-1.0f, 1.0f);
+      re[transform.slot(i)] = input[i];
+      im[transform.slot(i)] = 0;
+    }
+    timing fft;
+    for (int round = 0; round < 1000; ++round) {
+      std::vector<float> r(re), m(im);
+      profile::ticks start{profile::now()};
+      transform.transform(&r[0], &m[0]);
+      fft.add(profile::to_millis(profile::now() - start));
+      if (round == 999)
+        re.swap(r), im.swap(m);
+    }
+    double worst{0};
+    for (int k = 0; k < n; k += 37) {
+      double sr{0}, si{0};
+      for (int i = 0; i < n; ++i) {
+        sr += input[i] * cos(2.0 * 3.14159265358979323846 * k * i / n);
+        si -= input[i] * sin(2.0 * 3.14159265358979323846 * k * i / n);
+      }
+      double e{fabs(sr - re[k]) + fabs(si - im[k])};
+      worst = e > worst ? e : worst;
+    }
+    std::cout << "fft: " << n << " points, avg " << fft.mean() * 1000.0
+              << " us, largest error against a DFT " << worst << std::endl;
+  }
+
+  if (!write_click_track(file, seconds, beat_seconds)) {
+    std::cout << "Could not write " << file << std::endl;
+    return false;
+  }
+
+  // Flat out.
+  audio::analyzer music;
+  if (!music.open(file))
+    return false;
+  timing block;
+  std::vector<double> found;
+  audio::beat b;
+  while (true) {
+    profile::ticks start{profile::now()};
+    if (!music.analyse())
+      break;
+    block.add(profile::to_millis(profile::now() - start));
+    while (music.poll(b))
+      found.push_back(b.seconds);
+  }
+
+  // A beat counts as found when detected within 10 ms of a kick, less than
+  // a hop, so beats timed a block late show up as misses.
+  int hits{0};
+  for (size_t i = 0; i < found.size(); ++i) {
+    double off{fmod(found[i] + 0.01, beat_seconds)};
+    hits += off < 0.02;
+  }
+  int expected{static_cast<int>(seconds / beat_seconds)};
+  std::cout << "beats: " << seconds << " s of 120 bpm, " << found.size()
+            << " beats found, " << hits << " of " << expected
+            << " kicks within 10 ms, " << found.size() - hits << " false"
+            << std::endl;
+  std::cout << "  analysis: avg " << block.mean() * 1000.0 << " us, max "
+            << block.slowest * 1000.0 << " us a block, "
+            << music.load() * 100.0 << "% of a core in real time"
+            << std::endl;
+
+  // In real time, with a 60 Hz update loop taking the beats.
+  const int frames = 240;
+  audio::analyzer live;
+  live.open(file);
+  live.start();
+  for (int frame = 0; frame < frames; ++frame) {
+    Sleep(16);
+    profile::ticks detected{0};
+    while (live.poll(b))
+      detected = detected ? detected : b.detected;
+    if (detected)
+      live.delivered(detected);
+  }
+  live.stop();
+  std::cout << "  real time: " << live.seconds() << " s, " << live.beats()
+            << " beats, " << live.load() * 100.0
+            << "% of a core, decode to delivery avg " << live.mean_latency()
+            << " ms, max " << live.worst_latency() << " ms" << std::endl;
+  remove(file);
+  return true;
+}
+
+// Whether |a| at the origin and |b| at (bx, by) share an opaque texel,
+// found the slow way.
+bool texels_overlap(const game::texture &a, const game::texture &b, int bx,
+                    int by) {
+  for (int y = 0; y < b.bounds.v[game::y_pos]; ++y) {
+    int ay{by + y};
+    if (ay < 0 || ay >= a.bounds.v[game::y_pos])
+      continue;
+    for (int x = 0; x < b.bounds.v[game::x_pos]; ++x) {
+      int ax{bx + x};
+      if (ax >= 0 && ax < a.bounds.v[game::x_pos] &&
+          b.tex[y * b.bounds.v[game::x_pos] + x] &&
+          a.tex[ay * a.bounds.v[game::x_pos] + ax])
+        return true;
+    }
+  }
+  return false;
+}
+
+// Throw enemy / projectile sprite pairs at random near each other and test
+// them three ways: bounding boxes, masks_overlap() and texel by texel. The
+// masks must agree with the texels; the boxes show how many hits they'd get
+// wrong on transparent corners. The bar, several mask words wide, checks
+// the general case. False if the masks and texels disagree.
+bool collisions() {
+  const int pairs = 200000;
+  util::mem_pool pool(1048576);
+  game::texture ship("..//res//enemy.graw", pool);
+  game::texture shot("..//res//projectile.graw", pool);
+  game::texture bar("../res//bar.graw", pool);
+  if (!ship.mask || !shot.mask || !bar.mask)
+    return false;
+
+  std::vector<int> xs(pairs), ys(pairs);
+  rng::stream random(99);
+  int reach_x{ship.bounds.v[game::x_pos] + shot.bounds.v[game::x_pos]};
+  int reach_y{ship.bounds.v[game::y_pos] + shot.bounds.v[game::y_pos]};
+  for (int i = 0; i < pairs; ++i) {
+    xs[i] = random.range(reach_x) - shot.bounds.v[game::x_pos];
+    ys[i] = random.range(reach_y) - shot.bounds.v[game::y_pos];
+  }
+
+  int box_hits{0}, mask_hits{0}, texel_hits{0};
+  profile::ticks start{profile::now()};
+  for (int i = 0; i < pairs; ++i)
+    box_hits += xs[i] < ship.bounds.v[game::x_pos] &&
+                xs[i] > -shot.bounds.v[game::x_pos] &&
+                ys[i] < ship.bounds.v[game::y_pos] &&
+                ys[i] > -shot.bounds.v[game::y_pos];
+  profile::ticks boxes{profile::now()};
+  for (int i = 0; i < pairs; ++i)
+    mask_hits += game::masks_overlap(ship, 0, 0, shot, xs[i], ys[i]);
+  profile::ticks masks{profile::now()};
+  for (int i = 0; i < pairs; ++i)
+    texel_hits += texels_overlap(ship, shot, xs[i], ys[i]);
+  profile::ticks texels{profile::now()};
+
+  int wrong{0};
+  for (int i = 0; i < pairs; ++i)
+    wrong += game::masks_overlap(ship, 0, 0, shot, xs[i], ys[i]) !=
+             texels_overlap(ship, shot, xs[i], ys[i]);
+  int bar_x{bar.bounds.v[game::x_pos] + shot.bounds.v[game::x_pos]};
+  int bar_y{bar.bounds.v[game::y_pos] + shot.bounds.v[game::y_pos]};
+  for (int i = 0; i < pairs / 10; ++i) {
+    int x{random.range(bar_x) - shot.bounds.v[game::x_pos]};
+    int y{random.range(bar_y) - shot.bounds.v[game::y_pos]};
+    wrong += game::masks_overlap(bar, 0, 0, shot, x, y) !=
+             texels_overlap(bar, shot, x, y);
+  }
+
+  double scale{1000000.0 / pairs};
+  std::cout << "collisions: " << pairs << " enemy / projectile pairs"
+            << std::endl;
+  std::cout << "  boxes: " << box_hits << " hits, "
+            << profile::to_millis(boxes - start) * scale << " ns a pair"
+            << std::endl;
+  std::cout << "  masks: " << mask_hits << " hits, "
+            << profile::to_millis(masks - boxes) * scale << " ns a pair"
+            << std::endl;
+  std::cout << "  texels: " << texel_hits << " hits, "
+            << profile::to_millis(texels - masks) * scale << " ns a pair"
+            << std::endl;
+  std::cout << "  masks " << (wrong ? "DIFFER from" : "match") << " texels ("
+            << wrong << " pairs differ), boxes get "
+            << box_hits - texel_hits << " hits on transparent texels"
+            << std::endl;
+  return !wrong;
+}
+
+// The HUD bar at a few output sizes: drawn from the texture every frame, the
+// way draw_stage used to, against copying the cached static layer.
+bool layers() {
+  const int frames = 2000;
+  util::mem_pool pool(1048576);
+  game::texture bar("../res//bar.graw", pool);
+  if (!bar.tex)
+    return false;
+  math::vec2i stage(game::_width, game::_height);
+  const int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+
+  std::cout << "layers: HUD bar, " << frames << " frames" << std::endl;
+  for (int s = 0; s < 3; ++s) {
+    math::vec2 iResolution(sizes[s][0], sizes[s][1]);
+    std::vector<detail::Uint32> buffer(sizes[s][0] * sizes[s][1]);
+    game::static_layer layer;
+    timing redraw, cached;
+    for (int frame = 0; frame < frames; ++frame) {
+      profile::ticks start{profile::now()};
+      layer.invalidate();
+      game::update_bar(layer, bar, stage, iResolution);
+      layer.composite(&buffer[0], 0, sizes[s][1]);
+      profile::ticks mid{profile::now()};
+      game::update_bar(layer, bar, stage, iResolution);
+      layer.composite(&buffer[0], 0, sizes[s][1]);
+      profile::ticks end{profile::now()};
+      redraw.add(profile::to_millis(mid - start));
+      cached.add(profile::to_millis(end - mid));
+    }
+    std::cout << "  " << sizes[s][0] << "x" << sizes[s][1] << ", "
+              << layer.bottom() - layer.top() << " rows: redrawn avg "
+              << redraw.mean() * 1000.0 << " us, cached avg "
+              << cached.mean() * 1000.0 << " us" << std::endl;
+  }
+  return true;
+}
+
+// Compact textures against ARGB: memory, copying the background window into
+// the stage layer (straight and scaled), drawing sprites and whole frames.
+// Also checks the SIMD RGB565 expansion against the scalar one for every
+// value, and that palette sprites draw exactly what ARGB ones do; false if
+// either doesn't.
+bool textures() {
+  const int frames = 500;
+  util::mem_pool pool(16 * 1048576);
+  game::texture bg("..//res//bg[0].graw", pool);
+  game::texture bg565("..//res//bg[0].graw", pool, game::FORMAT_RGB565);
+  game::texture ship("..//res//enemy.graw", pool);
+  game::texture ship8("..//res//enemy.graw", pool, game::FORMAT_INDEXED);
+  if (!bg.tex || !bg565.texels || !ship.tex || !ship8.texels)
+    return false;
+
+  std::vector<unsigned short> all(65536);
+  std::vector<detail::Uint32> wide(65536);
+  for (int i = 0; i < 65536; ++i)
+    all[i] = static_cast<unsigned short>(i);
+  game::expand_565(&wide[0], &all[0], 65536);
+  int differ{0};
+  for (int i = 0; i < 65536; ++i)
+    differ += wide[i] != game::from_565(all[i]);
+  int worst{0};
+  for (int y = 0; y < bg.bounds.v[game::y_pos]; ++y)
+    for (int x = 0; x < bg.bounds.v[game::x_pos]; ++x)
+      for (int shift = 0; shift < 24; shift += 8) {
+        int a = (bg.texel(x, y) >> shift) & 0xff;
+        int b = (bg565.texel(x, y) >> shift) & 0xff;
+        worst = abs(a - b) > worst ? abs(a - b) : worst;
+      }
+  std::cout << "textures: background " << bg.bytes() << " -> "
+            << bg565.bytes() << " bytes, worst channel error " << worst
+            << "; enemy " << ship.bytes() << " -> " << ship8.bytes()
+            << " bytes; SIMD expansion "
+            << (differ ? "DIFFERS from" : "matches") << " scalar" << std::endl;
+
+  bool right{!differ};
+
+  // The stage layer, at playfield size and doubled (the scaled copy).
+  const int scales[] = {1, 2};
+  for (int s = 0; s < 2; ++s) {
+    math::vec2i size(game::_width * scales[s], game::_height * scales[s]);
+    game::texture img(size, pool);
+    timing argb, compact;
+    for (int frame = 0; frame < frames; ++frame) {
+      profile::ticks start{profile::now()};
+      img.copy(bg, frame, game::_height);
+      profile::ticks mid{profile::now()};
+      img.copy(bg565, frame, game::_height);
+      profile::ticks end{profile::now()};
+      argb.add(profile::to_millis(mid - start));
+      compact.add(profile::to_millis(end - mid));
+    }
+    std::cout << "  background to " << size.v[game::x_pos] << "x"
+              << size.v[game::y_pos] << ": ARGB avg " << argb.mean() * 1000.0
+              << " us, RGB565 avg " << compact.mean() * 1000.0 << " us"
+              << std::endl;
+
+    // A stage's worth of enemies, all over the layer.
+    game::texture a(size, pool), b(size, pool);
+    timing sprites_argb, sprites_indexed;
+    rng::stream random(7);
+    int mismatched{0};
+    for (int frame = 0; frame < frames; ++frame) {
+      a.clear();
+      b.clear();
+      double xs[game::stage_units], ys[game::stage_units];
+      for (int i = 0; i < game::stage_units; ++i) {
+        xs[i] = random.uniform(0.0f, static_cast<float>(game::_width));
+        ys[i] = random.uniform(0.0f, static_cast<float>(game::_height));
+      }
+      profile::ticks start{profile::now()};
+      for (int i = 0; i < game::stage_units; ++i)
+        game::blit_sprite(ship, a, xs[i], ys[i], scales[s], scales[s]);
+      profile::ticks mid{profile::now()};
+      for (int i = 0; i < game::stage_units; ++i)
+        game::blit_sprite(ship8, b, xs[i], ys[i], scales[s], scales[s]);
+      profile::ticks end{profile::now()};
+      sprites_argb.add(profile::to_millis(mid - start));
+      sprites_indexed.add(profile::to_millis(end - mid));
+      if (frame == 0)
+        mismatched = memcmp(a.tex, b.tex, size.v[game::x_pos] *
+                                              size.v[game::y_pos] * 4) != 0;
+    }
+    std::cout << "  " << game::stage_units << " sprites: ARGB avg "
+              << sprites_argb.mean() * 1000.0 << " us, indexed avg "
+              << sprites_indexed.mean() * 1000.0 << " us, output "
+              << (mismatched ? "DIFFERS" : "identical") << std::endl;
+    right = right && !mismatched;
+  }
+
+  // Whole frames, 1080p output.
+  math::vec2 iResolution(1920, 1080);
+  std::vector<detail::Uint32> buffer(1920 * 1080);
+  for (int c = 0; c < 2; ++c) {
+    game::settings options;
+    options.compact_textures = c == 1;
+    fixture setup(options);
+    game::session &world{setup.world};
+    timing step;
+    for (int frame = 0; frame < frames; ++frame) {
+      profile::ticks start{profile::now()};
+      world.step(&buffer[0], iResolution, 16.6, 60.0, 0);
+      step.add(profile::to_millis(profile::now() - start));
+    }
+    std::cout << "  " << (c ? "compact" : "ARGB") << " frames at 1920x1080: "
+              << "avg " << step.mean() << " ms, background stage "
+              << world.stage_millis[game::STAGE_BACKGROUND] * 1000.0
+              << " us, assets " << world.pool.used() << " pool bytes"
+              << std::endl;
+  }
+  return right;
+}
+
+// Reads shared frames on its own thread for export(), until told to stop.
+struct export_reader {
+  const char *name;
+  std::atomic<bool> stop;
+  int seen, torn;
+  unsigned int missed;
+  volatile unsigned int sum; // Keeps the reads from being optimised away.
+
+  static DWORD WINAPI run(LPVOID parameter) {
+    export_reader *self{static_cast<export_reader *>(parameter)};
+    share::reader in;
+    if (!in.open(self->name))
+      return 0;
+    share::view frame;
+    while (!self->stop.load()) {
+      if (!in.next(frame)) {
+        SwitchToThread();
+        continue;
+      }
+      for (int i = 0; i < in.width() * in.height(); i += 16)
+        self->sum += frame.pixels[i];
+      if (in.still_valid(frame))
+        ++self->seen;
+      else
+        ++self->torn;
+    }
+    self->missed = in.missed();
+    return 0;
+  }
+};
+
+// Publish frames into shared memory flat out at 640x480 and 1080p: copied in
+// from a rendered buffer, and rendered in place (only the slot hand over is
+// timed), with a reader on another thread taking what it can.
+bool export_frames() {
+  const char *name = "BeatMasterBench";
+  const int sizes[][2] = {{640, 480}, {1920, 1080}};
+  const int frames = 600;
+
+  std::cout << "export: " << frames << " frames each" << std::endl;
+  for (int s = 0; s < 2; ++s) {
+    int width{sizes[s][0]}, height{sizes[s][1]};
+    std::vector<detail::Uint32> buffer(width * height, 0xff204080);
+    share::writer out;
+    if (!out.open(name, width, height))
+      return false;
+
+    export_reader reader;
+    reader.name = name;
+    reader.stop.store(false);
+    reader.seen = reader.torn = 0;
+    reader.missed = reader.sum = 0;
+    HANDLE thread{CreateThread(NULL, 0, &export_reader::run, &reader, 0, NULL)};
+    Sleep(50);
+
+    timing copied, in_place;
+    for (int frame = 0; frame < frames; ++frame) {
+      buffer[frame] = frame;
+      profile::ticks start{profile::now()};
+      out.publish(&buffer[0], 16.6);
+      profile::ticks mid{profile::now()};
+      out.begin()[frame] = frame;
+      out.publish(16.6);
+      profile::ticks end{profile::now()};
+      copied.add(profile::to_millis(mid - start));
+      in_place.add(profile::to_millis(end - mid));
+    }
+    reader.stop.store(true);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    double bytes{width * height * 4.0};
+    std::cout << "  " << width << "x" << height << ": copied in avg "
+              << copied.mean() * 1000.0 << " us ("
+              << 1000.0 / copied.mean() << " frames/s, "
+              << bytes / (copied.mean() * 1e6) << " GB/s), in place avg "
+              << in_place.mean() * 1000.0 << " us" << std::endl;
+    std::cout << "    reader took " << reader.seen << " of "
+              << out.published() << " frames, missed " << reader.missed
+              << ", " << reader.torn << " torn" << std::endl;
+  }
+  return true;
+}
+
+// Load the session's five textures one after another (read and decode, as
+// the loader does it) and then all at once on an assets::loader, and time a
+// session's first frame when it waits for every asset against when it
+// streams the background and bar in behind placeholders.
+bool load_assets() {
+  const int rounds = 20;
+  const char *names[] = {"..//res//player.graw", "..//res//enemy.graw",
+                         "..//res//projectile.graw", "..//res//bg[0].graw",
+                         "../res//bar.graw"};
+  const int count = 5;
+
+  std::cout << "assets: " << count << " textures, " << rounds << " rounds"
+            << std::endl;
+  timing sequential, parallel;
+  for (int round = 0; round < rounds; ++round) {
+    util::mem_pool pool(16 * 1048576);
+    profile::ticks start{profile::now()};
+    for (int i = 0; i < count; ++i) {
+      game::texture t(pool);
+      std::vector<detail::Uint32> argb;
+      std::string error;
+      if (!game::texture::read(names[i], t.bounds, argb, error) ||
+          !t.decode(argb, game::FORMAT_ARGB, error)) {
+        std::cout << "  " << names[i] << ": " << error << std::endl;
+        return false;
+      }
+    }
+    sequential.add(profile::to_millis(profile::now() - start));
+
+    util::mem_pool shared(16 * 1048576);
+    start = profile::now();
+    assets::loader loading(shared);
+    for (int i = 0; i < count; ++i)
+      loading.add(names[i]);
+    loading.start();
+    loading.wait_all();
+    parallel.add(profile::to_millis(profile::now() - start));
+  }
+  sequential.print("one after another");
+  parallel.print("loader");
+
+  // Only a few sessions: each one that waits reports its assets.
+  const int sessions = 3;
+  game::settings options;
+  math::vec2 iResolution(640, 480);
+  std::vector<detail::Uint32> buffer(640 * 480);
+  timing waited, streamed;
+  for (int round = 0; round < sessions; ++round) {
+    for (int stream = 0; stream < 2; ++stream) {
+      util::mem_pool pool(game::session::pool_bytes(options));
+      profile::ticks start{profile::now()};
+      game::session world(pool, 2635, options, stream != 0);
+      world.step(&buffer[0], iResolution, 16.6, 60.0, 0);
+      (stream ? streamed : waited)
+          .add(profile::to_millis(profile::now() - start));
+    }
+  }
+  waited.print("first frame, waiting for assets");
+  streamed.print("first frame, streaming assets");
+  return true;
+}
+
+// Bullet |i| of volley |volley| of |s| fired from (x, y) at (tx, ty), worked
+// out from the pattern itself every time, into |vx|, |vy|.
+inline void interpret_bullet(const pattern::spec &s, int i, int volley,
+                             float x, float y, float tx, float ty, float &vx,
+                             float &vy) {
+  const float radians = 3.14159265f / 180.0f;
+  float heading{s.aimed ? static_cast<float>(atan2(ty - y, tx - x))
+                        : -1.5707963f};
+  heading += s.spin * radians * volley;
+  float offset;
+  if (s.arc >= 360.0f)
+    offset = s.arc / s.count * i;
+  else if (s.count > 1)
+    offset = -s.arc * 0.5f + s.arc / (s.count - 1) * i;
+  else
+    offset = 0;
+  float speed{s.speed + s.accel * i};
+  vx = static_cast<float>(cos(heading + offset * radians)) * speed;
+  vy = static_cast<float>(sin(heading + offset * radians)) * speed;
+}
+
+// Fire the built in patterns round robin, 4096 bullets a frame: compiled
+// volleys against working every bullet out from its pattern one at a time
+// (the way patterns interpreted per bullet would), then moving them all and
+// testing them against the player. Also checks the compiled volleys fire
+// what the patterns describe, false if they don't.
+bool patterns() {
+  const int frames = 500;
+  const int per_frame = 4096;
+  const int capacity = 16384;
+  util::mem_pool pool(2 * 1048576 + pattern::bullets::bytes(capacity));
+  game::texture hero("..//res//player.graw", pool);
+  game::texture shot("..//res//projectile.graw", pool);
+  if (!hero.mask || !shot.mask)
+    return false;
+  std::vector<pattern::spec> specs{pattern::defaults()};
+  pattern::table table;
+  table.compile(specs);
+  pattern::bullets store(pool, capacity);
+  fx::particles sparks(pool, 4096, rng::stream(7));
+  math::vec8 player(160, 40, 0, 0, 1, 0, 0, game::PLAYER);
+  math::vec4 field{8.0, 8.0, game::_width - 8.0, game::_height - 8.0};
+
+  float worst{0};
+  for (int p = 0; p < table.size(); ++p) {
+    store.clear();
+    table.fire(p, 100, 200, 160, 40, 3, store);
+    for (int i = 0; i < store.live(); ++i) {
+      float vx, vy;
+      interpret_bullet(specs[p], i, 3, 100, 200, 160, 40, vx, vy);
+      float dx{static_cast<float>(fabs(vx - store.vx(i)))};
+      float dy{static_cast<float>(fabs(vy - store.vy(i)))};
+      worst = dx > worst ? dx : worst;
+      worst = dy > worst ? dy : worst;
+    }
+  }
+
+  std::vector<float> xs(capacity), ys(capacity), vxs(capacity),
+      vys(capacity), lives(capacity);
+  rng::stream random(31);
+  timing compiled, interpreted, moved, collided;
+  int volleys{0}, hits{0};
+  for (int frame = 0; frame < frames; ++frame) {
+    // The same volleys both ways, from enemies spread over the top half.
+    int first{volleys};
+    store.clear();
+    profile::ticks start{profile::now()};
+    while (store.live() < per_frame) {
+      int p{volleys % table.size()};
+      float x{static_cast<float>(20 + (volleys * 37) % 280)};
+      float y{static_cast<float>(130 + (volleys * 53) % 100)};
+      table.fire(p, x, y, 160, 40, volleys, store);
+      ++volleys;
+    }
+    profile::ticks fired{profile::now()};
+    int count{0};
+    for (int v = first; v < volleys; ++v) {
+      const pattern::spec &s = specs[v % table.size()];
+      float x{static_cast<float>(20 + (v * 37) % 280)};
+      float y{static_cast<float>(130 + (v * 53) % 100)};
+      for (int i = 0; i < s.count; ++i, ++count) {
+        interpret_bullet(s, i, v, x, y, 160, 40, vxs[count], vys[count]);
+        xs[count] = x;
+        ys[count] = y;
+        lives[count] = s.life;
+      }
+    }
+    profile::ticks interpreted_end{profile::now()};
+    compiled.add(profile::to_millis(fired - start));
+    interpreted.add(profile::to_millis(interpreted_end - fired));
+
+    // A second's worth of frames, so bullets spread out over the field.
+    start = profile::now();
+    for (int step = 0; step < 4; ++step)
+      store.update(250.0f, field);
+    profile::ticks updated{profile::now()};
+    player.v[game::x_pos] = random.range(280) + 20;
+    hits += store.collide(hero, player, shot, sparks);
+    profile::ticks end{profile::now()};
+    moved.add(profile::to_millis(updated - start) / 4);
+    collided.add(profile::to_millis(end - updated));
+    sparks.clear();
+  }
+
+  std::cout << "patterns: " << table.size() << " patterns, " << table.rows()
+            << " rows (" << table.rows() * 3 * sizeof(float)
+            << " bytes), " << per_frame << "+ bullets a frame, " << frames
+            << " frames" << std::endl;
+  compiled.print("compiled volleys");
+  interpreted.print("per bullet");
+  std::cout << "  " << per_frame / (compiled.mean() * 1000.0)
+            << " compiled bullets/us, "
+            << per_frame / (interpreted.mean() * 1000.0)
+            << " per bullet bullets/us" << std::endl;
+  moved.print("move");
+  collided.print("player hits");
+  // Rounding alone stays well under this.
+  bool right{worst < 1e-5f};
+  std::cout << "  " << hits << " hits, compiled velocities within " << worst
+            << " of the patterns" << (right ? "" : " - WRONG") << std::endl;
+  return right;
+}
+
+// Every benchmark, by the name --bench takes. Each returns false if it
+// couldn't run or found its output wrong.
+struct entry {
+  const char *name;
+  bool (*run)();
+};
+
+const entry benchmarks[] = {
+    {"particles", &particles},   {"resolution", &resolution},
+    {"shadows", &shadows},       {"governor", &governor},
+    {"tiles", &tiles},           {"tasks", &tasks},
+    {"hud", &hud},               {"batch", &batch},
+    {"snapshots", &snapshots},   {"beats", &beats},
+    {"collisions", &collisions}, {"layers", &layers},
+    {"textures", &textures},     {"export", &export_frames},
+    {"assets", &load_assets},    {"patterns", &patterns}};
+static const int benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+// Run the benchmark called |name|, false if there is no such benchmark or
+// it found its output wrong.
+bool run(const char *name) {
+  for (int i = 0; i < benchmark_count; ++i)
+    if (strcmp(name, benchmarks[i].name) == 0)
+      return benchmarks[i].run();
+
+  std::cout << "Unknown benchmark " << name << ", try one of:";
+  for (int i = 0; i < benchmark_count; ++i)
+    std::cout << (i ? ", " : " ") << benchmarks[i].name;
+  std::cout << std::endl;
+  return false;
+}
+
+} // namespace bench
+
+#endif // _BENCH_HPP
@@ -1,8 +1,17 @@
+#ifndef _GAME_HPP
+#define _GAME_HPP
+#pragma once
+
 #include <algorithm>
+#include <cstring>
+#include <emmintrin.h>
 #include <map>
-#include <sstream>
 #include "Renderer.hpp"
 #include "Math.hpp"
+#include "Particles.hpp"
+#include "Input.hpp"
+#include "Profiler.hpp"
+#include "Random.hpp"
 #include "util.hpp"
 
 namespace game {
@@ -21,76 +30,359 @@ enum FieldTypes {
   cooldown,
   type
 };
+
+// How a texture keeps its texels. The compact formats are for assets that
+// are only ever read; the layers a frame is rendered into are always ARGB.
+// Texel value 0 is the colour key (transparent) in every format.
+enum TextureFormats {
+  FORMAT_ARGB,   // 32 bit ARGB.
+  FORMAT_RGB565, // 16 bit colour, 5:6:5 bits, always fully opaque.
+  FORMAT_INDEXED // 8 bit index into a palette of up to 256 ARGB colours.
+};
+
+// Nearest RGB565 colour to |c|. Only 0 stays 0, so opaque black remains
+// opaque.
+inline unsigned short to_565(detail::Uint32 c) {
+  if (!c)
+    return 0;
+  unsigned int r = (((c >> 16) & 0xff) * 31 + 127) / 255;
+  unsigned int g = (((c >> 8) & 0xff) * 63 + 127) / 255;
+  unsigned int b = ((c & 0xff) * 31 + 127) / 255;
+  unsigned int packed = (r << 11) | (g << 5) | b;
+  return static_cast<unsigned short>(packed ? packed : 1);
+}
+
+// RGB565 back to ARGB, the top bits of each channel repeated into its low
+// bits so 31 and 63 come out as 255.
+inline detail::Uint32 widen_565(unsigned int c) {
+  unsigned int r = c >> 11, g = (c >> 5) & 0x3f, b = c & 0x1f;
+  unsigned int alpha = c ? 0xff000000 : 0;
+  return alpha | (((r << 3) | (r >> 2)) << 16) |
+         (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+}
+
+// widen_565() of each byte of an RGB565 texel on its own. Every output bit
+// comes from one byte or the other (alpha from either), so a texel is its two
+// halves or'ed together: two loads from 2 KB instead of a dozen operations.
+struct rgb565_tables {
+  detail::Uint32 low[256], high[256];
+
+  rgb565_tables() {
+    for (unsigned int i = 0; i < 256; ++i) {
+      low[i] = widen_565(i);
+      high[i] = widen_565(i << 8);
+    }
+  }
+};
+static const rgb565_tables g_565;
+
+inline detail::Uint32 from_565(unsigned short c) {
+  return g_565.low[c & 0xff] | g_565.high[c >> 8];
+}
+
+// from_565() over |count| texels, 8 at a time: the channels are widened in
+// 16 bit lanes, then interleaved into B, G, R, A bytes with two unpacks.
+inline void expand_565(detail::Uint32 *dst, const unsigned short *src,
+                       int count) {
+  const __m128i low5 = _mm_set1_epi16(0x1f);
+  const __m128i low6 = _mm_set1_epi16(0x3f);
+  const __m128i opaque = _mm_set1_epi16(0xff);
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i r = _mm_srli_epi16(c, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), low6);
+    __m128i b = _mm_and_si128(c, low5);
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+    // Colour key texels have no bits set, so only alpha needs masking.
+    __m128i a = _mm_andnot_si128(_mm_cmpeq_epi16(c, zero), opaque);
+    __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    __m128i ra = _mm_or_si128(r, _mm_slli_epi16(a, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 4),
+                     _mm_unpackhi_epi16(bg, ra));
+  }
+  for (; i < count; ++i)
+    dst[i] = from_565(src[i]);
+}
+
 struct texture {
-  detail::Uint32 *tex;
+  detail::Uint32 *tex; // ARGB texels, null in the compact formats.
   math::vec2i bounds;
   util::mem_pool &m_allocator;
+  unsigned long long *mask; // Opaque texels, 1 bit each, see build_mask().
+  int mask_words;           // 64 bit words per row of the mask.
+  int format;               // One of TextureFormats.
+  unsigned char *texels;    // RGB565 or palette index texels, else null.
+  detail::Uint32 *palette;  // The colours of an indexed texture...
+  int palette_size;         // ...as many as it uses, the key included.
 
   texture(const math::vec2i &size, util::mem_pool &allocator)
-      : bounds(size), tex(nullptr), m_allocator(allocator) {
+      : bounds(size), tex(nullptr), m_allocator(allocator), mask(nullptr),
+        mask_words(0), format(FORMAT_ARGB), texels(nullptr),
+        palette(nullptr), palette_size(0) {
     tex = reinterpret_cast<detail::Uint32 *>(m_allocator.alloc(
         bounds.v[x_pos] * bounds.v[y_pos] *
         sizeof(detail::Uint32))); // new detail::Uint32[bounds.v[x_pos] *
                                   // bounds.v[y_pos]];
   }
 
-  texture(const texture &other) : m_allocator(other.m_allocator) {
+  texture(const texture &other)
+      : m_allocator(other.m_allocator), mask(other.mask),
+        mask_words(other.mask_words), format(other.format),
+        texels(other.texels), palette(other.palette),
+        palette_size(other.palette_size) {
     bounds = other.bounds;
     tex = other.tex;
   }
 
-  texture(const std::string &name, util::mem_pool &allocator)
-      : m_allocator(allocator) {
-    // Load a texture resource from a file with the given name. First tries
-    // searching in whichever folder is the current working directory, if that
-    // fails it will try searching in the module folder (path to .exe file)
+  // Take over |other|'s texels, e.g. once it has finished loading. Both must
+  // come out of the same pool.
+  void assign(const texture &other) {
+    tex = other.tex;
+    bounds = other.bounds;
+    mask = other.mask;
+    mask_words = other.mask_words;
+    format = other.format;
+    texels = other.texels;
+    palette = other.palette;
+    palette_size = other.palette_size;
+  }
+
+  // Nothing yet, see load().
+  explicit texture(util::mem_pool &allocator)
+      : tex(nullptr), bounds(0, 0), m_allocator(allocator), mask(nullptr),
+        mask_words(0), format(FORMAT_ARGB), texels(nullptr), palette(nullptr),
+        palette_size(0) {}
+
+  texture(const std::string &name, util::mem_pool &allocator,
+          int want = FORMAT_ARGB)
+      : tex(nullptr), bounds(0, 0), m_allocator(allocator), mask(nullptr),
+        mask_words(0), format(FORMAT_ARGB), texels(nullptr), palette(nullptr),
+        palette_size(0) {
+    load(name, want);
+  }
 
-    // Open the file here.
-    FILE *input(0);
+  // Load the texture resource |name|, kept as |want| (a .graw file is always
+  // ARGB). Says what happened either way; false leaves the texture empty.
+  bool load(const std::string &name, int want = FORMAT_ARGB) {
+    std::vector<detail::Uint32> argb;
+    std::string error;
+    if (!read(name, bounds, argb, error) || !decode(argb, want, error)) {
+      std::cout << "Could not load texture resource [" << name << "]: "
+                << error << std::endl;
+      return false;
+    }
+    std::cout << "Loaded texture resource [" << name << "] w["
+              << bounds.v[x_pos] << "] h[" << bounds.v[y_pos] << "] "
+              << format_name() << std::endl;
+    return true;
+  }
 
-    errno_t err(fopen_s(&input, name.c_str(), "rb"));
-    if (err != 0) {
-      std::cout << "Could not load texture resource " << name << std::endl;
+  // Read the .graw file |name| into |argb|, |size| texels big. First tries
+  // searching in whichever folder is the current working directory, if that
+  // fails it will try searching in the module folder (path to .exe file).
+  // Doesn't touch the pool or print anything, so it may run on any thread;
+  // on failure |error| says why.
+  static bool read(const std::string &name, math::vec2i &size,
+                   std::vector<detail::Uint32> &argb, std::string &error) {
+    FILE *input(0);
+    if (fopen_s(&input, name.c_str(), "rb") != 0) {
+      error = "not found";
       char file_name[MAX_PATH];
       memset(file_name, 0, MAX_PATH);
-      if (GetModuleFileName(NULL, file_name, MAX_PATH) != 0) {
-        std::cout << "Module path[" << file_name << "]" << std::endl;
-
-        // Try to load the absolute path.
-        std::string fp(file_name);
-        std::string::size_type position(fp.find_last_of("\\"));
-        if (position != std::string::npos) {
-          // Append the file name to the absolute path.
-          std::string path(fp.substr(0, position + 1));
-          path.append(name);
-          std::cout << "Trying to load from [" << path << "]" << std::endl;
-          if (fopen_s(&input, path.c_str(), "rb") != 0) {
-            std::cout << "Load failed." << std::endl;
-            return; // could not open the file.
-          }
-        } else
-          return; // could not find the slashes.
-      } else
-        return; // could not get the path to the exe.
+      if (GetModuleFileName(NULL, file_name, MAX_PATH) == 0)
+        return false; // could not get the path to the exe.
+
+      // Try to load the absolute path.
+      std::string fp(file_name);
+      std::string::size_type position(fp.find_last_of("\\"));
+      if (position == std::string::npos)
+        return false; // could not find the slashes.
+      // Append the file name to the absolute path.
+      std::string path(fp.substr(0, position + 1));
+      path.append(name);
+      if (fopen_s(&input, path.c_str(), "rb") != 0) {
+        error = "not found here or in " + path;
+        return false;
+      }
     }
 
-    fread(&bounds.v[x_pos], 4, 1, input);
-    fread(&bounds.v[y_pos], 4, 1, input);
+    int width{0}, height{0};
+    bool sized = fread(&width, 4, 1, input) == 1 &&
+                 fread(&height, 4, 1, input) == 1 && width > 0 &&
+                 height > 0 && width <= 16384 && height <= 16384;
+    if (sized) {
+      argb.resize(width * height);
+      sized = fread(&argb[0], sizeof(detail::Uint32), argb.size(), input) ==
+              argb.size();
+    }
+    fclose(input);
+    if (!sized) {
+      error = "not a .graw file, or cut short";
+      return false;
+    }
+    size = math::vec2i(width, height);
+    return true;
+  }
 
-    std::cout << "Loaded texture resource [" << name << "] w["
-              << bounds.v[x_pos] << "] h[" << bounds.v[y_pos] << "]"
-              << std::endl;
+  // Keep |argb|, bounds big, as |want| in pool memory and build the mask.
+  // False (with |error| set) when the pool has no room for it. Touches
+  // nothing shared but the pool, so it may run on another thread.
+  bool decode(const std::vector<detail::Uint32> &argb, int want,
+              std::string &error) {
+    pack(&argb[0], want);
+    build_mask();
+    if (!data() || !mask) {
+      error = "out of pool memory";
+      tex = nullptr;
+      texels = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  const char *format_name() const {
+    static const char *const names[] = {"ARGB", "RGB565", "indexed"};
+    return names[format];
+  }
+
+  // Keep |argb|, a whole texture's worth, as |want|. An indexed texture
+  // needs no more than 255 colours besides the key, one with more stays ARGB.
+  void pack(const detail::Uint32 *argb, int want) {
     int len = bounds.v[x_pos] * bounds.v[y_pos];
+    if (want == FORMAT_INDEXED) {
+      std::map<detail::Uint32, int> colours;
+      colours[0] = 0;
+      for (int i = 0; i < len && colours.size() <= 256; ++i)
+        if (colours.find(argb[i]) == colours.end()) {
+          int index = static_cast<int>(colours.size());
+          colours[argb[i]] = index;
+        }
+      if (colours.size() <= 256) {
+        palette_size = static_cast<int>(colours.size());
+        palette = reinterpret_cast<detail::Uint32 *>(
+            aligned(palette_size * sizeof(detail::Uint32)));
+        texels = aligned(len);
+        if (!palette || !texels)
+          return;
+        for (std::map<detail::Uint32, int>::const_iterator i =
+                 colours.begin();
+             i != colours.end(); ++i)
+          palette[i->second] = i->first;
+        for (int i = 0; i < len; ++i)
+          texels[i] = static_cast<unsigned char>(colours[argb[i]]);
+        format = FORMAT_INDEXED;
+        return;
+      }
+    } else if (want == FORMAT_RGB565) {
+      texels = aligned(len * sizeof(unsigned short));
+      if (!texels)
+        return;
+      unsigned short *out = reinterpret_cast<unsigned short *>(texels);
+      for (int i = 0; i < len; ++i)
+        out[i] = to_565(argb[i]);
+      format = FORMAT_RGB565;
+      return;
+    }
     tex = reinterpret_cast<detail::Uint32 *>(
         m_allocator.alloc(len * sizeof(detail::Uint32)));
+    if (tex)
+      ::memcpy(tex, argb, len * sizeof(detail::Uint32));
+  }
 
-    // Now that we have width and height, we can start reading pixels.
-    fread(tex, sizeof(detail::Uint32), len, input);
+  // |bytes| from the pool, 16 byte aligned for the SIMD loads.
+  unsigned char *aligned(int bytes) {
+    unsigned char *raw = m_allocator.alloc(bytes + 16);
+    if (!raw)
+      return nullptr;
+    size_t addr =
+        (reinterpret_cast<size_t>(raw) + 15) & ~static_cast<size_t>(15);
+    return reinterpret_cast<unsigned char *>(addr);
+  }
 
-    fclose(input);
+  int texel_bytes() const {
+    return format == FORMAT_INDEXED ? 1 : (format == FORMAT_RGB565 ? 2 : 4);
+  }
+
+  // The texels in whatever format they are kept, null if nothing loaded.
+  const unsigned char *data() const {
+    return format == FORMAT_ARGB ? reinterpret_cast<const unsigned char *>(tex)
+                                 : texels;
+  }
+
+  // Memory the texels (and palette) take up.
+  int bytes() const {
+    return bounds.v[x_pos] * bounds.v[y_pos] * texel_bytes() +
+           palette_size * static_cast<int>(sizeof(detail::Uint32));
+  }
+
+  // Texel (x, y) as ARGB, whatever the format. For the odd lookup, anything
+  // that walks a lot of texels should work on the format directly.
+  detail::Uint32 texel(int x, int y) const {
+    int i = y * bounds.v[x_pos] + x;
+    if (format == FORMAT_INDEXED)
+      return palette[texels[i]];
+    if (format == FORMAT_RGB565)
+      return from_565(reinterpret_cast<const unsigned short *>(texels)[i]);
+    return tex[i];
   }
 
-  void copy(const texture &other, int rowOffset = 0) {
+  // |count| texels from texel |from| on (counting along the rows), as ARGB.
+  void unpack(detail::Uint32 *dst, int from, int count) const {
+    if (format == FORMAT_RGB565) {
+      expand_565(dst, reinterpret_cast<const unsigned short *>(texels) + from,
+                 count);
+    } else if (format == FORMAT_INDEXED) {
+      const unsigned char *src = texels + from;
+      for (int i = 0; i < count; ++i)
+        dst[i] = palette[src[i]];
+    } else {
+      ::memcpy(dst, tex + from, count * sizeof(detail::Uint32));
+    }
+  }
+
+  // Pack which texels are opaque (non zero, the ones blit_sprite() draws)
+  // into |mask_words| 64 bit words a row, bit i of word w for column
+  // 64 * w + i. Collision tests work on these instead of the texels.
+  void build_mask() {
+    int width = bounds.v[x_pos];
+    int height = bounds.v[y_pos];
+    mask_words = (width + 63) / 64;
+    int words = mask_words * height;
+    unsigned char *raw =
+        m_allocator.alloc(words * sizeof(unsigned long long) + 8);
+    if (!data() || !raw) {
+      mask = nullptr;
+      return;
+    }
+    size_t addr = (reinterpret_cast<size_t>(raw) + 7) & ~static_cast<size_t>(7);
+    mask = reinterpret_cast<unsigned long long *>(addr);
+    for (int i = 0; i < words; ++i)
+      mask[i] = 0;
+    for (int y = 0; y < height; ++y) {
+      unsigned long long *row = mask + y * mask_words;
+      for (int x = 0; x < width; ++x)
+        if (texel(x, y))
+          row[x >> 6] |= 1ull << (x & 63);
+    }
+  }
+
+  // Copy |rows| rows of |other| (wrapping around its bottom edge), starting
+  // |rowOffset| rows down, stretched over the whole of this texture. By
+  // default that is one row per row, which is a straight copy.
+  void copy(const texture &other, int rowOffset = 0, int rows = 0) {
+    if (rows > 0 && (rows != bounds.v[y_pos] ||
+                     bounds.v[x_pos] != other.bounds.v[x_pos] ||
+                     rows > other.bounds.v[y_pos])) {
+      copy_scaled(other, rowOffset, rows);
+      return;
+    }
+
     if (!bounds.equals(other.bounds)) {
       if (bounds.v[x_pos] > other.bounds.v[x_pos] ||
           bounds.v[y_pos] > other.bounds.v[y_pos]) {
@@ -109,103 +401,265 @@ struct texture {
     int wrapRows = (rowsFromOther == numRows ? 0 : numRows - rowsFromOther);
 
     int len(bounds.v[x_pos] * rowsFromOther);
+    // Compact textures are expanded to ARGB on the way.
+    if (other.format != FORMAT_ARGB) {
+      other.unpack(tex, finalOffset * other.bounds.v[x_pos], len);
+      if (wrapRows)
+        other.unpack(tex + len, 0, wrapRows * other.bounds.v[x_pos]);
+      return;
+    }
     util::memcpy(tex, other.tex + (finalOffset * other.bounds.v[x_pos]), len);
 
     if (wrapRows)
       util::memcpy(tex + len, other.tex, (wrapRows * other.bounds.v[x_pos]));
   }
 
+  // Nearest neighbour version of copy() for when the sizes differ.
+  void copy_scaled(const texture &other, int rowOffset, int rows) {
+    int width = bounds.v[x_pos];
+    int height = bounds.v[y_pos];
+    int otherRows = other.bounds.v[y_pos];
+    int step = (other.bounds.v[x_pos] << 16) / width; // 16.16 fixed point.
+
+    int last = -1;
+    for (int y = 0; y < height; ++y) {
+      int row = (rowOffset + (y * rows) / height) % otherRows;
+      detail::Uint32 *dst = tex + y * width;
+      // Stretched taller, rows repeat: copy the row already sampled.
+      if (row == last) {
+        ::memcpy(dst, dst - width, width * sizeof(detail::Uint32));
+        continue;
+      }
+      last = row;
+      int u = 0;
+      if (other.format == FORMAT_RGB565) {
+        const unsigned short *src =
+            reinterpret_cast<const unsigned short *>(other.texels) +
+            row * other.bounds.v[x_pos];
+        for (int x = 0; x < width; ++x, u += step)
+          dst[x] = from_565(src[u >> 16]);
+      } else if (other.format == FORMAT_INDEXED) {
+        for (int x = 0; x < width; ++x, u += step)
+          dst[x] = other.texel(u >> 16, row);
+      } else {
+        const detail::Uint32 *src = other.tex + row * other.bounds.v[x_pos];
+        for (int x = 0; x < width; ++x, u += step)
+          dst[x] = src[u >> 16];
+      }
+    }
+  }
+
   void clear() {
     int len(bounds.v[x_pos] * bounds.v[y_pos]);
     util::memset(tex, 0, len);
   }
 
+  // Change the size in place, e.g. to render fewer pixels for a while. The
+  // new size must not hold more pixels than the texture was allocated with.
+  void resize(const math::vec2i &size) { bounds = size; }
+
   ~texture() {
     // Never delete tex - we don't own the memory.
     tex = nullptr;
   }
 };
 
+// Single channel 8 bit layer, e.g. how much of each pixel lies in shadow (0 is
+// none, 255 is full). A quarter of the memory of a texture, and a blur over it
+// is plain byte arithmetic. The mask may stand in for a layer |scale| (1, 2 or
+// 4) times its size; row() then filters it up one layer row at a time.
+struct coverage {
+  unsigned char *mask;
+  unsigned char *scratch;  // One mask row, padded by one byte on the left.
+  unsigned char *filtered; // One layer row, when scale > 1.
+  math::vec2i bounds;
+  int scale;
+
+  // Storage is sized for a full resolution mask of |layer|, so resize() can
+  // switch scales (or shrink the layer) without allocating.
+  coverage(const math::vec2i &layer, util::mem_pool &allocator, int s = 1)
+      : mask(nullptr), scratch(nullptr), filtered(nullptr), scale(1) {
+    mask = allocator.alloc(bytes(layer));
+    if (mask) {
+      scratch = mask + layer.v[x_pos] * layer.v[y_pos] + 16;
+      filtered = scratch + layer.v[x_pos] + 32;
+    }
+    resize(layer, s);
+  }
+
+  // Pool memory for a |layer| sized mask: the mask, plus the rows row()
+  // filters through (and the slack its 8 wide loads and stores run into).
+  static int bytes(const math::vec2i &layer) {
+    int width = layer.v[x_pos];
+    return width * layer.v[y_pos] + 16 + (width + 32) + (width + 64);
+  }
+
+  // Cover a |layer| sized layer at 1/|s| of its resolution. The layer must
+  // not be bigger than the one we were built for.
+  void resize(const math::vec2i &layer, int s) {
+    scale = s;
+    bounds = math::vec2i(layer.v[x_pos] / s, layer.v[y_pos] / s);
+  }
+
+  void clear() { ::memset(mask, 0, bounds.v[x_pos] * bounds.v[y_pos]); }
+
+  // Coverage of layer row |y|, bilinearly filtered from the mask. Each call
+  // overwrites the previous result when scale > 1.
+  const unsigned char *row(int y) {
+    int width = bounds.v[x_pos];
+    if (scale == 1)
+      return mask + y * width;
+
+    // Blend the two mask rows around the layer row's centre, in 1/256ths of a
+    // mask row, into the scratch row. Then repeat its edge pixels so the
+    // horizontal taps never need a bounds check.
+    int v = ((2 * y + 1) * 128) / scale - 128;
+    int vmax = (bounds.v[y_pos] - 1) << 8;
+    v = v < 0 ? 0 : (v > vmax ? vmax : v);
+    const unsigned char *r0 = mask + (v >> 8) * width;
+    const unsigned char *r1 = v < vmax ? r0 + width : r0;
+    __m128i zero = _mm_setzero_si128();
+    for (int x = 0; x < width; x += 8)
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(scratch + x),
+                       _mm_packus_epi16(lerp(load(r0 + x), load(r1 + x),
+                                             v & 0xff),
+                                        zero));
+    scratch[-1] = scratch[0];
+    ::memset(scratch + width, scratch[width - 1], 16);
+
+    // Now across: layer pixel k of each group of |scale| sits (2k + 1 -
+    // scale) / (2 * scale) mask pixels from the centre of its mask pixel. One
+    // pixel past the end covers layers that are not a whole multiple wide.
+    for (int x = 0; x <= width; x += 8) {
+      __m128i l = load(scratch + x - 1);
+      __m128i c = load(scratch + x);
+      __m128i r = load(scratch + x + 1);
+      __m128i *out = reinterpret_cast<__m128i *>(filtered + x * scale);
+      if (scale == 2) {
+        __m128i even = _mm_packus_epi16(lerp(c, l, 64), zero);
+        __m128i odd = _mm_packus_epi16(lerp(c, r, 64), zero);
+        _mm_storeu_si128(out, _mm_unpacklo_epi8(even, odd));
+      } else {
+        __m128i k0 = _mm_packus_epi16(lerp(c, l, 96), zero);
+        __m128i k1 = _mm_packus_epi16(lerp(c, l, 32), zero);
+        __m128i k2 = _mm_packus_epi16(lerp(c, r, 32), zero);
+        __m128i k3 = _mm_packus_epi16(lerp(c, r, 96), zero);
+        __m128i k01 = _mm_unpacklo_epi8(k0, k1);
+        __m128i k23 = _mm_unpacklo_epi8(k2, k3);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(k01, k23));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(k01, k23));
+      }
+    }
+    return filtered;
+  }
+
+protected:
+  // Eight bytes widened to 16 bit lanes.
+  static __m128i load(const unsigned char *p) {
+    return _mm_unpacklo_epi8(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)),
+        _mm_setzero_si128());
+  }
+
+  // (a * (256 - weight) + b * weight) / 256 per lane, weight in [0, 256).
+  static __m128i lerp(__m128i a, __m128i b, int weight) {
+    return _mm_srli_epi16(
+        _mm_add_epi16(
+            _mm_mullo_epi16(a, _mm_set1_epi16(static_cast<short>(256 - weight))),
+            _mm_mullo_epi16(b, _mm_set1_epi16(static_cast<short>(weight)))),
+        8);
+  }
+};
+
 class BitmapRenderer : public detail::IBitmapRenderer {
 public:
   BitmapRenderer()
-      : m_direction(-1), m_elapsedFrames(0), m_framesPerSecond(0),
-        m_startTime(GetTickCount()), m_fps("FPS: 0") {}
+      : m_elapsedFrames(0), m_framesPerSecond(0), m_currentMillis(0),
+        m_millisPerFrame(0), m_startTime(GetTickCount()) {}
   virtual ~BitmapRenderer() {}
 
-  // Useful for printing stats (like fps/score)
+  // Counts presented frames. The stats themselves are drawn into the frame
+  // by hud::overlay before it's flipped.
   virtual void RenderToBitmap(HDC screenDC, int w, int h) {
-    // Will deal with getting the fps data here later.
     ++m_elapsedFrames;
     if (GetTickCount() - m_startTime > 1000) {
-      // Fill our string with the elapsed frames.
-      std::stringstream ss;
-      ss << "FPS: " << m_elapsedFrames;
-      m_fps = ss.str();
-      ss.str("");
-      ss << "MPF: " << m_currentMillis;
-      m_ticks = ss.str();
+      m_millisPerFrame = m_currentMillis;
       m_framesPerSecond = m_elapsedFrames;
       m_elapsedFrames = 0;
       m_startTime = GetTickCount();
     }
-
-    TextOut(screenDC, 0, h - 32, m_fps.c_str(), m_fps.length());
-    TextOut(screenDC, 0, h - 16, m_ticks.c_str(), m_ticks.length());
   }
 
   virtual void HandleOutput(VOID *output) {}
-  virtual void HandleDirection(int direction) { m_direction = direction; }
+  // Called on the window thread - queue the event for the update thread.
+  virtual void HandleKey(unsigned int key, bool pressed) {
+    input::event e = {profile::now(), key, pressed};
+    if (!m_events.push(e))
+      std::cout << "Input queue full, dropped key event." << std::endl;
+  }
   void SetTicks(double millis) { m_currentMillis = millis; }
-  int GetDirection() const { return m_direction; }
+  input::event_queue &GetInput() { return m_events; }
   double GetFPS() const { return m_framesPerSecond; }
+  // Frame time sampled once a second, alongside GetFPS().
+  double GetMPF() const { return m_millisPerFrame; }
 
 protected:
-  volatile int m_direction;
+  input::event_queue m_events;
   double m_elapsedFrames;
   double m_framesPerSecond;
   double m_currentMillis;
+  double m_millisPerFrame;
   DWORD m_startTime;
-  std::string m_fps;
-  std::string m_ticks;
 };
 
-void handle_player_movement(math::vec8 &player, int dir, double millis,
-                            double fps) {
+void handle_player_movement(math::vec8 &player, unsigned int keys,
+                            double millis, double fps) {
   double xpf = math::compute_units(_width * 2.0, millis, fps);
   double ypf = math::compute_units(_height * 2.0, millis, fps);
   player.v[firing_rate] -= math::compute_units(25.0, millis, fps);
-  if (dir == 0)
-    player.v[delta_x] = -xpf;
-  if (dir == 2)
-    player.v[delta_x] = xpf;
-  if (dir == 1)
-    player.v[delta_y] = ypf;
-  if (dir == 3)
-    player.v[delta_y] = -ypf;
-
-  if (dir == -1) {
-    dir = -1;
-    player.v[delta_x] = 0;
-    player.v[delta_y] = 0;
-  }
+
+  // Opposite keys cancel out, perpendicular ones combine into a diagonal.
+  player.v[delta_x] = 0;
+  player.v[delta_y] = 0;
+  if (keys & input::KEY_LEFT)
+    player.v[delta_x] -= xpf;
+  if (keys & input::KEY_RIGHT)
+    player.v[delta_x] += xpf;
+  if (keys & input::KEY_UP)
+    player.v[delta_y] += ypf;
+  if (keys & input::KEY_DOWN)
+    player.v[delta_y] -= ypf;
   if (player.v[y_pos] < 32)
     player.v[delta_y] = 1;
 }
 
+// On a |beat| every enemy fires at once, and the ones on their way out (in
+// the half of the playfield they leave through) come back in as a new wave.
 void handle_enemy_movement(math::vec8 &enemy, const math::vec4 &clip,
-                           double millis, double fps) {
+                           rng::stream &random, double millis, double fps,
+                           bool beat = false) {
   enemy.v[firing_rate] -= math::compute_units(200.0, millis, fps);
+  if (beat) {
+    enemy.v[firing_rate] = 0;
+    if (enemy.v[y_pos] < _height / 2) {
+      enemy.v[x_pos] =
+          random.range(static_cast<int>(clip.v[delta_x])) + clip.v[x_pos];
+      enemy.v[y_pos] =
+          random.range(static_cast<int>(clip.v[delta_y])) + (clip.v[delta_y]);
+    }
+  }
   double ypf = math::compute_units(600.0, millis, fps);
   if (enemy.v[life] != 0 && enemy.v[delta_y] == 0)
     enemy.v[delta_y] = -ypf;
-  else if (enemy.v[life] == 0) {
+  else if (enemy.v[life] == 0) { // Shot down, comes back in from the top.
     enemy.v[x_pos] =
-        (rand() % static_cast<int>(clip.v[delta_x])) + clip.v[x_pos];
+        random.range(static_cast<int>(clip.v[delta_x])) + clip.v[x_pos];
+    enemy.v[y_pos] =
+        random.range(static_cast<int>(clip.v[delta_y])) + (clip.v[delta_y]);
     enemy.v[life] = 1;
   } else if (enemy.v[life] != 0 && enemy.v[y_pos] < 16) {
     enemy.v[y_pos] =
-        (rand() % static_cast<int>(clip.v[delta_y])) + (clip.v[delta_y]);
+        random.range(static_cast<int>(clip.v[delta_y])) + (clip.v[delta_y]);
   }
 }
 
@@ -232,8 +686,10 @@ void handle_projectile_movement(math::vec8 &projectile, const math::vec4 &clip,
     projectile.v[delta_y] = -math::compute_units(_height, millis, fps);
 }
 
+// Fire free projectiles from the player and the enemies that are due. With
+// |enemies| false only the player fires here (see pattern::fire_patterns()).
 void fire_projectiles(std::vector<math::vec8> &units, double millis,
-                      double fps) {
+                      double fps, bool enemies = true) {
 
   double player_x = units[units.size() - 1].v[x_pos];
   // Get list of all references to 'free' projectiles which can be fired. This
@@ -245,7 +701,7 @@ void fire_projectiles(std::vector<math::vec8> &units, double millis,
         for (int j = 0; j < units.size(); ++j) {
           // Find an enemy ship that can fire this projectile
           if (units[j].v[type] == ENEMY) {
-            if (units[j].v[firing_rate] <= 0) {
+            if (enemies && units[j].v[firing_rate] <= 0) {
               math::vec8 &bullet{units[i]};
               math::vec8 &enemy{units[j]};
               bullet.v[x_pos] = enemy.v[x_pos]; // set x
@@ -284,70 +740,338 @@ void fire_projectiles(std::vector<math::vec8> &units, double millis,
   // deltas) and remove it from the 'free' list.
 }
 
-void draw_units(const std::vector<texture> &tex, texture &fg,
-                std::vector<math::vec8> &units, double millis, double fps,
-                int dir) {
-  math::vec4 clip{8.0, 8.0, fg.bounds.v[x_pos] - 8.0, fg.bounds.v[y_pos] - 8.0};
-
-  if (units.empty()) {
-    srand(2635);
-    // Define what we need in each unit.
-    // 0 = x pos, 1 = y pos, 2 = delta x, 3 = delta y, 4 = alive, 5 = firing
-    // rate, 6 = cooldown, 7 = type
-    for (int i = 0; i < 100; ++i)
-      units.push_back(math::vec8(
-          (rand() % static_cast<int>(clip.v[delta_x])) + clip.v[x_pos],
-          (rand() % static_cast<int>(clip.v[delta_y])) + clip.v[y_pos], 0, 0, 1,
-          0, 60, 2));
-
-    for (int i = 0; i < 10; ++i)
-      units.push_back(math::vec8(
-          (rand() % static_cast<int>(clip.v[delta_x])) + clip.v[x_pos],
-          (rand() % static_cast<int>(clip.v[delta_y])) + clip.v[y_pos], 0, 0, 1,
-          1, 0, 1));
-
-    units.push_back(math::vec8(fg.bounds.v[x_pos] / 2, fg.bounds.v[y_pos] / 2,
-                               0, 0, 1, 3, 1, 0));
+// Where a sprite centred on playfield point (cx, cy) lands on a layer
+// |width| x |height| pixels big: its corner, the visible part of it and how
+// to step through its texels.
+struct sprite_rect {
+  const texture *item;
+  int x0, y0;         // Top left corner, may be off the layer.
+  int xs, xe, ys, ye; // Visible part, [xs, xe) x [ys, ye).
+  int step_x, step_y; // 16.16 texels per pixel, exactly one at scale 1.
+  int bytes;          // Per texel, in the sprite's format.
+
+  sprite_rect(const texture &sprite, double cx, double cy, double sx,
+              double sy, int width, int height)
+      : item(&sprite), bytes(sprite.texel_bytes()) {
+    int half_w = sprite.bounds.v[x_pos] / 2;
+    int half_h = sprite.bounds.v[y_pos] / 2;
+    x0 = static_cast<int>((cx - half_w) * sx);
+    int x1 = static_cast<int>((cx + half_w) * sx);
+    y0 = static_cast<int>((cy - half_h) * sy);
+    int y1 = static_cast<int>((cy + half_h) * sy);
+
+    // Only walk the part that is visible on the screen.
+    xs = x0 < 0 ? 0 : x0;
+    xe = x1 > width ? width : x1;
+    ys = y0 < 0 ? 0 : y0;
+    ye = y1 > height ? height : y1;
+
+    step_x = static_cast<int>(65536.0 / sx);
+    step_y = static_cast<int>(65536.0 / sy);
+  }
+
+  bool empty() const { return xs >= xe || ys >= ye; }
+
+  // The texel row over layer row |y|, null once we've stepped off the sprite.
+  // It's in the sprite's own format, see opaque().
+  const unsigned char *row(int y) const {
+    int _y = ((y - y0) * step_y) >> 16;
+    if (_y >= item->bounds.v[y_pos])
+      return nullptr;
+    return item->data() + _y * item->bounds.v[x_pos] * bytes;
+  }
+
+  // Whether texel |u| of a row() isn't the colour key.
+  bool opaque(const unsigned char *row, int u) const {
+    if (bytes == 1)
+      return row[u] != 0;
+    if (bytes == 2)
+      return reinterpret_cast<const unsigned short *>(row)[u] != 0;
+    return reinterpret_cast<const detail::Uint32 *>(row)[u] != 0;
+  }
+
+  // Texel column over layer column |x|, -1 once we've stepped off the sprite.
+  int column(int x) const {
+    int u = ((x - x0) * step_x) >> 16;
+    return u < item->bounds.v[x_pos] ? u : -1;
+  }
+};
+
+// blit_sprite() for one texel format, |colour|(row, u) giving texel u of a
+// row as ARGB.
+template <typename Colour>
+int blit_texels(const sprite_rect &s, Colour colour, detail::Uint32 *dst,
+                int stride, int left, int top, int right, int bottom) {
+  int xs = s.xs > left ? s.xs : left;
+  int xe = s.xe < right ? s.xe : right;
+  int ys = s.ys > top ? s.ys : top;
+  int ye = s.ye < bottom ? s.ye : bottom;
+  int written = 0;
+  for (int y = ys; y < ye; ++y) {
+    const unsigned char *src = s.row(y);
+    if (!src)
+      break;
+    detail::Uint32 *out = dst + (y - top) * stride - left;
+    int u = (xs - s.x0) * s.step_x;
+    for (int x = xs; x < xe; ++x, u += s.step_x) {
+      if ((u >> 16) >= s.item->bounds.v[x_pos])
+        break;
+      detail::Uint32 col = colour(src, u >> 16);
+      if (col) {
+        out[x] = col;
+        ++written;
+      }
+    }
+  }
+  return written;
+}
+
+// Copy the opaque texels of |s| inside the layer rectangle [left, right) x
+// [top, bottom) into |dst|, which holds that rectangle |stride| pixels a row.
+// Compact sprites are expanded texel by texel as they are drawn.
+int blit_sprite(const sprite_rect &s, detail::Uint32 *dst, int stride,
+                int left, int top, int right, int bottom) {
+  if (s.item->format == FORMAT_INDEXED) {
+    const detail::Uint32 *palette = s.item->palette;
+    return blit_texels(s,
+                       [palette](const unsigned char *row, int u) {
+                         return palette[row[u]];
+                       },
+                       dst, stride, left, top, right, bottom);
   }
+  if (s.item->format == FORMAT_RGB565)
+    return blit_texels(s,
+                       [](const unsigned char *row, int u) {
+                         return from_565(
+                             reinterpret_cast<const unsigned short *>(row)[u]);
+                       },
+                       dst, stride, left, top, right, bottom);
+  return blit_texels(s,
+                     [](const unsigned char *row, int u) {
+                       return reinterpret_cast<const detail::Uint32 *>(row)[u];
+                     },
+                     dst, stride, left, top, right, bottom);
+}
+
+// Draw |item| centred on (cx, cy) in playfield units, onto |fg| which is
+// |sx| x |sy| pixels per playfield unit. Returns the number of pixels written.
+int blit_sprite(const texture &item, texture &fg, double cx, double cy,
+                double sx, double sy) {
+  sprite_rect s(item, cx, cy, sx, sy, fg.bounds.v[x_pos], fg.bounds.v[y_pos]);
+  return blit_sprite(s, fg.tex, fg.bounds.v[x_pos], 0, 0, fg.bounds.v[x_pos],
+                     fg.bounds.v[y_pos]);
+}
+
+// Units a stage starts with: every projectile there will ever be, the enemies
+// that fire them and the player, last.
+static const int stage_projectiles = 100;
+static const int stage_enemies = 10;
+static const int stage_units = stage_projectiles + stage_enemies + 1;
+
+// Place a stage's units at random inside the playfield. Nothing is added or
+// removed after this, so |units| never grows once a game is running.
+void spawn_units(std::vector<math::vec8> &units, rng::stream &random) {
+  math::vec4 clip{8.0, 8.0, _width - 8.0, _height - 8.0};
+
+  // Define what we need in each unit.
+  // 0 = x pos, 1 = y pos, 2 = delta x, 3 = delta y, 4 = alive, 5 = firing
+  // rate, 6 = cooldown, 7 = type
+  const int projectiles = stage_projectiles;
+  const int enemies = stage_enemies;
+
+  // Roll every starting position in one vectorized batch.
+  int xs[projectiles + enemies];
+  int ys[projectiles + enemies];
+  rng::batch_stream batch(random);
+  batch.fill(xs, projectiles + enemies, static_cast<int>(clip.v[delta_x]));
+  batch.fill(ys, projectiles + enemies, static_cast<int>(clip.v[delta_y]));
+
+  units.reserve(stage_units);
+  for (int i = 0; i < projectiles; ++i)
+    units.push_back(math::vec8(xs[i] + clip.v[x_pos], ys[i] + clip.v[y_pos],
+                               0, 0, 1, 0, 60, 2));
+
+  for (int i = projectiles; i < projectiles + enemies; ++i)
+    units.push_back(math::vec8(xs[i] + clip.v[x_pos], ys[i] + clip.v[y_pos],
+                               0, 0, 1, 1, 0, 1));
+
+  units.push_back(math::vec8(_width / 2, _height / 2, 0, 0, 1, 3, 1, 0));
+}
+
+// Move every unit one frame along (spawning them first if nobody has yet),
+// without drawing anything. Units move around the fixed _width x _height
+// playfield.
+void update_units(std::vector<math::vec8> &units, fx::particles &effects,
+                  rng::stream &random, double millis, double fps,
+                  unsigned int keys) {
+  math::vec4 clip{8.0, 8.0, _width - 8.0, _height - 8.0};
+
+  if (units.empty())
+    spawn_units(units, random);
 
   math::vec8 &player = units[units.size() - 1];
-  handle_player_movement(player, dir, millis, fps);
+  handle_player_movement(player, keys, millis, fps);
+  bool beat{(keys & input::KEY_BEAT) != 0};
 
-  for (auto &i : units) {
-    i.v[x_pos] += i.v[delta_x];
-    i.v[y_pos] += i.v[delta_y];
+  // Move everything along its velocity in one pass, x and y as one packet.
+  math::batch::integrate(&units[0], static_cast<int>(units.size()), x_pos,
+                         delta_x, 2);
 
+  for (auto &i : units) {
     if (i.v[type] == ENEMY)
-      handle_enemy_movement(i, clip, millis, fps);
-    else if (i.v[type] == PROJECTILE)
+      handle_enemy_movement(i, clip, random, millis, fps, beat);
+    else if (i.v[type] == PROJECTILE) {
+      bool was_alive{i.v[life] > 0};
       handle_projectile_movement(i, clip, millis, fps);
+      // Throw some sparks where a projectile runs out.
+      if (was_alive && i.v[life] <= 0)
+        effects.emit_burst(static_cast<float>(i.v[x_pos]),
+                           static_cast<float>(i.v[y_pos]), 48, 0.08f, 350.0f,
+                           0xffffa040);
+    }
 
     // For all items, we perform clipping.
     if (i.v[x_pos] < clip.v[x_pos])
       i.v[x_pos] = clip.v[x_pos];
     if (i.v[x_pos] > clip.v[delta_x])
       i.v[x_pos] = clip.v[delta_x];
+  }
 
-    const texture &item = tex[static_cast<int>(i.v[type])];
-    int _y = 0;
-    for (int y = static_cast<int>(i.v[y_pos] - (item.bounds.v[y_pos] / 2));
-         y < static_cast<int>(i.v[y_pos] + (item.bounds.v[y_pos] / 2)); ++y) {
-      int _x = 0;
-      for (int x = static_cast<int>(i.v[x_pos] - (item.bounds.v[x_pos] / 2));
-           x < static_cast<int>(i.v[x_pos] + (item.bounds.v[x_pos] / 2)); ++x) {
-        // Check if the pixel is visible on the screen.
-        if (y >= 0 && x >= 0 && x < fg.bounds.v[x_pos] &&
-            y < fg.bounds.v[y_pos]) {
-          detail::Uint32 col = item.tex[_y * item.bounds.v[x_pos] + _x];
-          if (col)
-            fg.tex[y * fg.bounds.v[x_pos] + x] = col;
-        }
-        ++_x;
+  profile::count("units_updated", static_cast<double>(units.size()));
+}
+
+// 64 columns of mask row |row| (|words| words long) starting at column
+// |from|, which may be off either end; columns past the ends are clear.
+inline unsigned long long mask_bits(const unsigned long long *row, int words,
+                                    int from) {
+  int word = from >= 0 ? from / 64 : -((63 - from) / 64);
+  int shift = from - word * 64;
+  unsigned long long lo = word >= 0 && word < words ? row[word] : 0;
+  unsigned long long hi = word + 1 >= 0 && word + 1 < words ? row[word + 1] : 0;
+  return shift ? (lo >> shift) | (hi << (64 - shift)) : lo;
+}
+
+// Whether |a| with its top left texel at (ax, ay) and |b| with its top left
+// texel at (bx, by) have an opaque texel in the same place. Rows of |b| are
+// shifted under |a|'s mask words, so a row costs one AND per 64 columns.
+bool masks_overlap(const texture &a, int ax, int ay, const texture &b, int bx,
+                   int by) {
+  int dx = bx - ax;
+  int dy = by - ay;
+  if (!a.mask || !b.mask || dx >= a.bounds.v[x_pos] ||
+      dx <= -b.bounds.v[x_pos] || dy >= a.bounds.v[y_pos] ||
+      dy <= -b.bounds.v[y_pos])
+    return false;
+
+  int ys = dy > 0 ? dy : 0;
+  int ye = dy + b.bounds.v[y_pos];
+  ye = ye < a.bounds.v[y_pos] ? ye : a.bounds.v[y_pos];
+
+  // Sprites up to 64 texels wide (all of ours) are one word a row, and the
+  // boxes overlapping keeps the shift under 64.
+  if (a.mask_words == 1 && b.mask_words == 1) {
+    const unsigned long long *row_a = a.mask + ys;
+    const unsigned long long *row_b = b.mask + (ys - dy);
+    unsigned long long any = 0;
+    if (dx >= 0)
+      for (int y = 0; y < ye - ys; ++y)
+        any |= row_a[y] & (row_b[y] << dx);
+    else
+      for (int y = 0; y < ye - ys; ++y)
+        any |= row_a[y] & (row_b[y] >> -dx);
+    return any != 0;
+  }
+
+  for (int y = ys; y < ye; ++y) {
+    const unsigned long long *row_a = a.mask + y * a.mask_words;
+    const unsigned long long *row_b = b.mask + (y - dy) * b.mask_words;
+    for (int w = 0; w < a.mask_words; ++w)
+      if (row_a[w] & mask_bits(row_b, b.mask_words, w * 64 - dx))
+        return true;
+  }
+  return false;
+}
+
+// Top left texel of |sprite| drawn centred on |unit|, like blit_sprite().
+inline int sprite_left(const texture &sprite, const math::vec8 &unit) {
+  return static_cast<int>(unit.v[x_pos] - sprite.bounds.v[x_pos] / 2);
+}
+inline int sprite_top(const texture &sprite, const math::vec8 &unit) {
+  return static_cast<int>(unit.v[y_pos] - sprite.bounds.v[y_pos] / 2);
+}
+
+// Settle what the live projectiles hit this frame, to the pixel: a shot the
+// player fired takes out the first enemy it touches, an enemy's shot stops
+// on the player. Both go up in sparks. The sprites' boxes are checked first
+// (inside masks_overlap), so most pairs cost a couple of compares.
+void collide_units(const std::vector<texture> &tex,
+                   std::vector<math::vec8> &units, fx::particles &effects) {
+  const texture &shot = tex[PROJECTILE];
+  const texture &ship = tex[ENEMY];
+  const texture &hero = tex[PLAYER];
+  math::vec8 &player = units[units.size() - 1];
+  int px = sprite_left(hero, player);
+  int py = sprite_top(hero, player);
+  int pairs{0}, hits{0};
+
+  for (auto &p : units) {
+    if (p.v[type] != PROJECTILE || p.v[life] <= 0)
+      continue;
+    int sx = sprite_left(shot, p);
+    int sy = sprite_top(shot, p);
+
+    if (p.v[delta_y] <= 0) { // Enemy projectile.
+      ++pairs;
+      if (masks_overlap(hero, px, py, shot, sx, sy)) {
+        p.v[life] = 0;
+        effects.emit_burst(static_cast<float>(p.v[x_pos]),
+                           static_cast<float>(p.v[y_pos]), 64, 0.1f, 400.0f,
+                           0xffff4020);
+        ++hits;
+      }
+      continue;
+    }
+
+    for (auto &e : units) {
+      if (e.v[type] != ENEMY || e.v[life] == 0)
+        continue;
+      ++pairs;
+      if (masks_overlap(ship, sprite_left(ship, e), sprite_top(ship, e), shot,
+                        sx, sy)) {
+        p.v[life] = 0;
+        e.v[life] = 0;
+        effects.emit_burst(static_cast<float>(e.v[x_pos]),
+                           static_cast<float>(e.v[y_pos]), 256, 0.12f, 700.0f,
+                           0xffffc040);
+        ++hits;
+        break;
       }
-      ++_y;
     }
   }
-  fire_projectiles(units, millis, fps);
+
+  profile::count("collision_pairs", pairs);
+  profile::count("collisions", hits);
+}
+
+void draw_units(const std::vector<texture> &tex, texture &fg,
+                std::vector<math::vec8> &units, fx::particles &effects,
+                rng::stream &random, double millis, double fps,
+                unsigned int keys, bool enemies_fire = true) {
+  // fg may be rendered at a different resolution than the playfield.
+  double sx = fg.bounds.v[x_pos] / static_cast<double>(_width);
+  double sy = fg.bounds.v[y_pos] / static_cast<double>(_height);
+
+  update_units(units, effects, random, millis, fps, keys);
+  collide_units(tex, units, effects);
+
+  int pixels_written{0};
+  for (auto &i : units) {
+    const texture &item = tex[static_cast<int>(i.v[type])];
+    pixels_written += blit_sprite(item, fg, i.v[x_pos], i.v[y_pos], sx, sy);
+  }
+  fire_projectiles(units, millis, fps, enemies_fire);
+
+  profile::count("sprite_pixels_written", pixels_written);
 }
 
 inline detail::Uint32 blend_color(detail::Uint32 a, detail::Uint32 b) {
@@ -377,69 +1101,277 @@ inline detail::Uint32 blend_color(detail::Uint32 a, detail::Uint32 b) {
       static_cast<detail::Uint32>(static_cast<unsigned char>(fb)));
 }
 
-void blur_texture(texture &t) {
-  // Blend horizontally
-  for (int y = 0; y < t.bounds.v[y_pos]; ++y) {
-    for (int x = 0; x < t.bounds.v[x_pos] - 4; ++x) {
-      t.tex[y * t.bounds.v[x_pos] + x] =
-          blend_color(blend_color(t.tex[y * t.bounds.v[x_pos] + x + 0],
-                                  t.tex[y * t.bounds.v[x_pos] + x + 1]),
-                      blend_color(t.tex[y * t.bounds.v[x_pos] + x + 2],
-                                  t.tex[y * t.bounds.v[x_pos] + x + 3]));
+// Averages of two and four bytes, rounded the way _mm_avg_epu8 rounds.
+inline unsigned char average2(unsigned char a, unsigned char b) {
+  return static_cast<unsigned char>((a + b + 1) >> 1);
+}
+
+inline unsigned char average4(unsigned char a, unsigned char b, unsigned char c,
+                              unsigned char d) {
+  return static_cast<unsigned char>((((a + b + 1) >> 1) + ((c + d + 1) >> 1) +
+                                     1) >> 1);
+}
+
+// Box blur |taps| (4 or 2, anything less is no blur) pixels wide, first along
+// the rows and then down the columns. Each output only reads itself and the
+// pixels after it, so both passes can run in place; the last taps - 1
+// rows/columns are left as they are.
+void blur_coverage(coverage &c, int taps = 4) {
+  if (taps < 2)
+    return;
+  bool wide = taps >= 4;
+  int reach = wide ? 3 : 1; // How far past itself each output reads.
+  int width = c.bounds.v[x_pos];
+  int height = c.bounds.v[y_pos];
+
+  // Blend horizontally, 16 pixels at a time. All loads happen before the
+  // store, so we only ever read unblurred values.
+  for (int y = 0; y < height; ++y) {
+    unsigned char *row = c.mask + y * width;
+    int x = 0;
+    for (; x + 16 + reach <= width; x += 16) {
+      __m128i a{_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x))};
+      __m128i b{_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + 1))};
+      __m128i out{_mm_avg_epu8(a, b)};
+      if (wide) {
+        __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + 2))};
+        __m128i e{_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + 3))};
+        out = _mm_avg_epu8(out, _mm_avg_epu8(d, e));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), out);
     }
+    for (; x < width - reach; ++x)
+      row[x] = wide ? average4(row[x], row[x + 1], row[x + 2], row[x + 3])
+                    : average2(row[x], row[x + 1]);
   }
 
-  // Blend vertically
-  for (int x = 0; x < t.bounds.v[x_pos]; ++x) {
-    for (int y = 0; y < t.bounds.v[y_pos] - 4; ++y) {
-      t.tex[y * t.bounds.v[x_pos] + x] =
-          blend_color(blend_color(t.tex[(y + 0) * t.bounds.v[x_pos] + x],
-                                  t.tex[(y + 1) * t.bounds.v[x_pos] + x]),
-                      blend_color(t.tex[(y + 2) * t.bounds.v[x_pos] + x],
-                                  t.tex[(y + 3) * t.bounds.v[x_pos] + x]));
+  // Blend vertically a row at a time, which keeps the reads sequential.
+  for (int y = 0; y < height - reach; ++y) {
+    unsigned char *r0 = c.mask + y * width;
+    const unsigned char *r1 = r0 + width;
+    const unsigned char *r2 = wide ? r1 + width : r1;
+    const unsigned char *r3 = wide ? r2 + width : r1;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i a{_mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + x))};
+      __m128i b{_mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + x))};
+      __m128i out{_mm_avg_epu8(a, b)};
+      if (wide) {
+        __m128i d{_mm_loadu_si128(reinterpret_cast<const __m128i *>(r2 + x))};
+        __m128i e{_mm_loadu_si128(reinterpret_cast<const __m128i *>(r3 + x))};
+        out = _mm_avg_epu8(out, _mm_avg_epu8(d, e));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(r0 + x), out);
     }
+    for (; x < width; ++x)
+      r0[x] = wide ? average4(r0[x], r1[x], r2[x], r3[x])
+                   : average2(r0[x], r1[x]);
   }
 }
 
-void compute_shadows(texture &fg, texture &sg, const math::vec3 &light) {
-  // place the fg somewhere between the 'origin' and the light source.
-  double fg_z = 40.0;
-  double start_x = light.v[x_pos];
-  double start_y = light.v[y_pos];
-  double delta_z = light.v[delta_x] - fg_z;
+// Darken |color| towards the shadow colour (0xff222222) by |amount| of 255.
+// Full coverage lands half way, which is what blending the old 32 bit shadow
+// map over the background gave us.
+inline detail::Uint32 shade(detail::Uint32 color, unsigned int amount) {
+  detail::Uint32 w = amount >> 1; // 0..127 out of 256.
+  detail::Uint32 rb =
+      (((color & 0x00ff00ff) * (256 - w) + 0x00220022 * w) >> 8) & 0x00ff00ff;
+  detail::Uint32 ag =
+      (((color >> 8) & 0x00ff00ff) * (256 - w) + 0x00ff0022 * w) & 0xff00ff00;
+  return ag | rb;
+}
+
+// The shadow of a foreground pixel is its projection away from the light onto
+// the ground plane. That projection is affine and separable - the shadow
+// column only depends on the pixel's column and the row only on its row - so
+// we keep one integer lookup per column and per row and only redo them when
+// the light (or the map size) changes.
+struct shadow_table {
+  std::vector<int> columns; // Shadow x for each fg column, -1 if off the map.
+  std::vector<int> rows;    // Shadow row offset for each fg row, -1 if off.
+  math::vec3 light;
+  math::vec2i bounds;
+
+  shadow_table() : light(-1.0) {}
+
+  // Make room for tables of up to |size|, so update() never allocates.
+  void reserve(const math::vec2i &size) {
+    columns.reserve(size.v[x_pos]);
+    rows.reserve(size.v[y_pos]);
+  }
+
+  // Rebuild the tables if |light| or |size| differ from the last call. This is
+  // O(width + height), cheap enough to do every frame for a moving light.
+  void update(const math::vec3 &l, const math::vec2i &size) {
+    if (light.equals(l) && bounds.equals(size))
+      return;
+    light = l;
+    bounds = size;
+    columns.resize(size.v[x_pos]);
+    rows.resize(size.v[y_pos]);
+
+    // place the fg somewhere between the 'origin' and the light source.
+    double fg_z = 40.0;
+    double delta_z = light.v[delta_x] - fg_z;
+
+    // Same arithmetic as the per-pixel projection used to do, so the shadows
+    // land on exactly the same pixels.
+    for (int x = 0; x < size.v[x_pos]; ++x) {
+      double x_step = (static_cast<double>(x) - light.v[x_pos]) / delta_z;
+      int x_idx = static_cast<int>(light.v[x_pos] + (x_step * (delta_z + fg_z)));
+      columns[x] = (x_idx >= 0 && x_idx < size.v[x_pos]) ? x_idx : -1;
+    }
 
-  for (int y = 0; y < fg.bounds.v[y_pos]; ++y) {
-    for (int x = 0; x < fg.bounds.v[x_pos]; ++x) {
-      // compute the gradients here.
+    for (int y = 0; y < size.v[y_pos]; ++y) {
+      double y_step = (static_cast<double>(y) - light.v[y_pos]) / delta_z;
+      int y_idx = static_cast<int>(light.v[y_pos] + (y_step * (delta_z + fg_z)));
+      rows[y] = (y_idx >= 0 && y_idx < size.v[y_pos]) ? y_idx * size.v[x_pos]
+                                                       : -1;
+    }
+  }
+};
+
+void compute_shadows(texture &fg, coverage &sg, shadow_table &table,
+                     const math::vec3 &light, int blur_taps = 4) {
+  // The mask may be a whole fraction of the fg size (a cheaper, lower quality
+  // shadow pass). Then only every step'th fg pixel is projected, with the
+  // light moved into mask space.
+  int step = sg.scale;
+  math::vec3 l(light.v[x_pos] / step, light.v[y_pos] / step, light.v[delta_x]);
+  table.update(l, sg.bounds);
+
+  const int *columns{&table.columns[0]};
+  for (int y = 0; y < sg.bounds.v[y_pos]; ++y) {
+    int row{table.rows[y]};
+    if (row < 0)
+      continue; // This whole row casts its shadow off the map.
+
+    const detail::Uint32 *src{fg.tex + y * step * fg.bounds.v[x_pos]};
+    unsigned char *dst{sg.mask + row};
+    for (int x = 0; x < sg.bounds.v[x_pos]; ++x) {
       // First check if we are going to hit something on the image buffer.
-      if (fg.tex[(y * fg.bounds.v[x_pos]) + x]) {
-        double delta_x = static_cast<double>(x) - light.v[x_pos];
-        double delta_y = static_cast<double>(y) - light.v[y_pos];
-
-        // Now get number of steps
-        double x_step = delta_x / delta_z;
-        double y_step = delta_y / delta_z;
-
-        double end_x = start_x + (x_step * (delta_z + fg_z));
-        double end_y = start_y + (y_step * (delta_z + fg_z));
-
-        int x_idx = static_cast<int>(end_x);
-        int y_idx = static_cast<int>(end_y);
-        if (x_idx >= 0 && x_idx < fg.bounds.v[x_pos] && y_idx >= 0 &&
-            y_idx < fg.bounds.v[y_pos]) {
-          sg.tex[y_idx * fg.bounds.v[x_pos] + x_idx] = 0xff222222;
-        }
-      }
+      if (src[x * step] && columns[x] >= 0)
+        dst[columns[x]] = 255;
     }
   }
 
-  // Naively blur the shadow map to remove artifacts
-  blur_texture(sg);
+  // Soften the hard edges of the projected sprites.
+  blur_coverage(sg, blur_taps);
+}
+
+// Swing the light around the middle of the playfield. The position only
+// depends on the accumulated frame time, so replays stay deterministic.
+void animate_light(math::vec3 &light, double &phase, double millis) {
+  phase += millis * 0.0005;
+  light.v[x_pos] = _width * (0.5 + 0.25 * cos(phase));
+  light.v[y_pos] = _height * (0.5 + 0.25 * sin(phase));
 }
 
+// Something drawn over every frame that looks the same from one frame to the
+// next, like the HUD bar, kept ready at output resolution: a band of whole
+// output rows, copied straight over whatever is underneath. It is only drawn
+// again when what it's drawn from or the output it's drawn for changes.
+// Frames, score panels and borders can be more of these.
+class static_layer {
+public:
+  static_layer()
+      : m_source(nullptr), m_width(0), m_height(0), m_scale(0), m_top(0),
+        m_rows(0), m_redraws(0) {}
+
+  // Whether the pixels aren't |source| drawn for a |width| x |height|
+  // output; |scale| is whatever else the drawing depends on.
+  bool stale(const texture &source, int width, int height,
+             double scale) const {
+    return source.tex != m_source || !source.bounds.equals(m_bounds) ||
+           width != m_width || height != m_height || scale != m_scale;
+  }
+
+  // Start drawing the layer again, as output rows [top, top + rows), for
+  // what stale() was asked about. Fill it in through row().
+  void reset(const texture &source, int width, int height, double scale,
+             int top, int rows) {
+    m_source = source.tex;
+    m_bounds = source.bounds;
+    m_width = width;
+    m_height = height;
+    m_scale = scale;
+    m_top = top;
+    m_rows = rows;
+    m_pixels.resize(static_cast<size_t>(width) * rows);
+    ++m_redraws;
+  }
+
+  // Draw it again on the next update, e.g. after changing the source's
+  // texels in place.
+  void invalidate() { m_source = nullptr; }
+
+  // Output row |y|, which the layer has to cover.
+  detail::Uint32 *row(int y) { return &m_pixels[(y - m_top) * m_width]; }
+  const detail::Uint32 *row(int y) const {
+    return &m_pixels[(y - m_top) * m_width];
+  }
+
+  bool covers(int y) const { return y >= m_top && y < m_top + m_rows; }
+  int top() const { return m_top; }
+  int bottom() const { return m_top + m_rows; }
+  int redraws() const { return m_redraws; }
+
+  // Copy the layer's rows among output rows [first, last) over |buffer|.
+  void composite(detail::Uint32 *buffer, int first, int last) const {
+    int ys = first > m_top ? first : m_top;
+    int ye = last < m_top + m_rows ? last : m_top + m_rows;
+    for (int y = ys; y < ye; ++y)
+      memcpy(buffer + y * m_width, row(y), m_width * sizeof(detail::Uint32));
+  }
+
+protected:
+  const detail::Uint32 *m_source;
+  math::vec2i m_bounds;
+  int m_width, m_height;
+  double m_scale;
+  int m_top, m_rows;
+  int m_redraws;
+  std::vector<detail::Uint32> m_pixels;
+};
+
+// Keep |layer| showing the HUD |bar| across the top of an |iResolution|
+// output. It is stretched across the output and down by as much as the
+// stage layers (|stage| big) are, like the stage it used to be drawn with.
+void update_bar(static_layer &layer, const texture &bar,
+                const math::vec2i &stage, const math::vec2 &iResolution) {
+  int width = static_cast<int>(iResolution.v[x_pos]);
+  int height = static_cast<int>(iResolution.v[y_pos]);
+  double ratio_y = static_cast<double>(stage.v[y_pos]) / iResolution.v[y_pos];
+  if (!layer.stale(bar, width, height, ratio_y))
+    return;
+
+  int rows = 0;
+  while (rows < height && rows < bar.bounds.v[y_pos] / ratio_y)
+    ++rows;
+  layer.reset(bar, width, height, ratio_y, 0, rows);
+
+  double ratio_x = static_cast<double>(bar.bounds.v[x_pos]) / width;
+  double current_y = 0;
+  for (int y = 0; y < rows; ++y) {
+    const detail::Uint32 *src =
+        bar.tex + static_cast<int>(current_y) * bar.bounds.v[x_pos];
+    detail::Uint32 *out = layer.row(y);
+    double current_x = 0;
+    for (int x = 0; x < width; ++x) {
+      out[x] = src[static_cast<int>(current_x)];
+      current_x += ratio_x;
+    }
+    current_y += ratio_y;
+  }
+  profile::count("static_layer_redraws", layer.redraws());
+}
+
+// Composite the stage layers into |buffer|, then copy the |overlays| over
+// them. Rows an overlay covers aren't composited at all.
 void draw_stage(detail::Uint32 *buffer, const math::vec2 &iResolution,
-                texture &bg, texture &sg, texture &fg, texture &bar,
-                double millis, int dir) {
+                texture &bg, coverage &sg, texture &fg,
+                const static_layer *overlays, int overlay_count,
+                double millis, unsigned int keys) {
   double ratio_x =
       static_cast<double>(bg.bounds.v[x_pos]) / iResolution.v[x_pos];
   double ratio_y =
@@ -451,39 +1383,39 @@ void draw_stage(detail::Uint32 *buffer, const math::vec2 &iResolution,
   int width = static_cast<int>(iResolution.v[x_pos]);
   int height = static_cast<int>(iResolution.v[y_pos]);
 
-  for (int y = 0; y < height; ++y) {
+  // A smaller shadow mask is filtered up a layer row at a time.
+  int shadow_y = -1;
+  const unsigned char *shadow_row = nullptr;
+
+  for (int y = 0; y < height; ++y, current_y += ratio_y) {
+    bool covered = false;
+    for (int i = 0; i < overlay_count && !covered; ++i)
+      covered = overlays[i].covers(y);
+    if (covered)
+      continue;
+
+    if (static_cast<int>(current_y) != shadow_y) {
+      shadow_y = static_cast<int>(current_y);
+      shadow_row = sg.row(shadow_y);
+    }
+    current_x = 0;
     for (int x = 0; x < width; ++x) {
       int idx = static_cast<int>(current_y) * bg.bounds.v[x_pos] +
                 static_cast<int>(current_x);
       detail::Uint32 bgi = bg.tex[idx]; // background (stage)
-      detail::Uint32 sgi = sg.tex[idx]; // shadow map (fg)
+      unsigned int sgi = shadow_row[static_cast<int>(current_x)]; // shadow
       detail::Uint32 fgi = fg.tex[idx];
       detail::Uint32 result = bgi;
-      result = blend_color(sgi, result);
+      if (sgi)
+        result = shade(result, sgi);
       result = (fgi ? fgi : result);
       buffer[y * width + x] = result;
       current_x += ratio_x;
     }
-    current_y += ratio_y;
-    current_x = 0;
   }
 
-  {
-    ratio_x = static_cast<double>(bar.bounds.v[x_pos]) / iResolution.v[x_pos];
-    current_x = 0;
-    current_y = 0;
-    // Simply overwrite whatever has been drawn already and draw our HUD on it.
-    for (int y = 0; y < ((bar.bounds.v[y_pos] / ratio_y)); ++y) {
-      for (int x = 0; x < width; ++x) {
-        int idx = static_cast<int>(current_y) * bar.bounds.v[x_pos] +
-                  static_cast<int>(current_x);
-        buffer[y * width + x] = bar.tex[idx];
-        current_x += ratio_x;
-      }
-      current_y += ratio_y;
-      current_x = 0;
-    }
-  }
+  for (int i = 0; i < overlay_count; ++i)
+    overlays[i].composite(buffer, 0, height);
 }
 
 #if 0
@@ -491,4 +1423,6 @@ TODO(shaheed.abdol) - Treat projectiles as 'dead' until we need to fire them.
                       Treat projectiles as alive until they hit an obstacle.
 					  Some nice 'explosion' animations would be awesome.
 #endif // 0
-} // namespace game
\ No newline at end of file
+} // namespace game
+
+#endif // _GAME_HPP
@@ -0,0 +1,159 @@
+#ifndef _GOVERNOR_HPP
+#define _GOVERNOR_HPP
+#pragma once
+
+#include "Session.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Adaptive render quality. The governor watches how long a session's stages
+// take and walks a fixed ladder of quality levels - cheaper shadows first,
+// then fewer particles, then fewer pixels - to keep the frame inside a time
+// budget. It steps down quickly when over budget and only climbs back after
+// a long stretch of headroom, so it doesn't flip back and forth. Decisions
+// depend on wall clock time, so a governed session isn't reproducible; replays
+// and benchmarks run without one.
+namespace quality {
+
+// The ladder, best first. Shadow scales are a floor, and levels that end up
+// no different from the one before are skipped, see governor().
+// resolution, shadow_scale, blur_taps, particle_limit
+static const game::quality_level ladder[] = {
+    {100, 1, 4, game::session::max_particles},
+    {100, 2, 4, game::session::max_particles},
+    {100, 2, 2, 16384},
+    {100, 4, 2, 8192},
+    {75, 4, 2, 4096},
+    {50, 4, 0, 2048}};
+static const int level_count = sizeof(ladder) / sizeof(ladder[0]);
+
+// One change of level and what prompted it.
+struct decision {
+  int frame;     // Frames seen by the governor when it happened.
+  int from;      // Level before.
+  int to;        // Level after.
+  double millis; // Smoothed stage time at the time.
+  int stage;     // Most expensive stage (game::Stages) last frame.
+};
+
+class governor {
+public:
+  static const int history_capacity = 64;
+
+  // Hold the sum of the session's stages under |budget_ms|. The session's own
+  // shadow scale is kept as the best the ladder will ever ask for. The tile
+  // renderer always works out shadows at full resolution, so for a tiled
+  // session levels that would only shrink the shadows are left out.
+  governor(const game::settings &options, double budget_ms = 12.0)
+      : m_budget(budget_ms), m_average(0), m_level(0), m_count(0),
+        m_frame(0), m_over(0), m_under(0), m_cooldown(0),
+        m_restore_frames(120), m_last_restore(-1), m_decisions(0) {
+    for (int i = 0; i < level_count; ++i) {
+      game::quality_level l = ladder[i];
+      if (options.tiled)
+        l.shadow_scale = 1;
+      else if (l.shadow_scale < options.shadow_scale)
+        l.shadow_scale = options.shadow_scale;
+      if (m_count > 0 && same(l, m_levels[m_count - 1]))
+        continue;
+      m_levels[m_count++] = l;
+    }
+  }
+
+  // Feed one frame's stage timings (game::session::stage_millis). Returns
+  // true when the level changed; apply current() to the session then.
+  bool update(const double *stage_millis) {
+    double total{0};
+    int heaviest{0};
+    for (int i = 0; i < game::STAGE_COUNT; ++i) {
+      total += stage_millis[i];
+      if (stage_millis[i] > stage_millis[heaviest])
+        heaviest = i;
+    }
+    m_average = m_frame ? m_average + (total - m_average) * 0.1 : total;
+    ++m_frame;
+
+    // Let the average settle on the new level before judging it.
+    if (m_cooldown > 0) {
+      --m_cooldown;
+      return false;
+    }
+
+    // Over budget drops a level within a quarter second. Climbing back
+    // needs the frame to fit with 40% to spare for m_restore_frames.
+    m_over = m_average > m_budget ? m_over + 1 : 0;
+    m_under = m_average < m_budget * 0.6 ? m_under + 1 : 0;
+    if (m_over >= 15 && m_level + 1 < m_count) {
+      // Pushed straight back down after climbing - wait longer next time.
+      if (m_last_restore >= 0 && m_frame - m_last_restore < 600)
+        m_restore_frames = m_restore_frames < 3840 ? m_restore_frames * 2
+                                                   : m_restore_frames;
+      change(m_level + 1, heaviest);
+      return true;
+    }
+    if (m_under >= m_restore_frames && m_level > 0) {
+      m_last_restore = m_frame;
+      change(m_level - 1, heaviest);
+      return true;
+    }
+    return false;
+  }
+
+  // Jump to |level| directly, e.g. from a settings menu.
+  void force(int level) {
+    level = level < 0 ? 0 : (level >= m_count ? m_count - 1 : level);
+    if (level != m_level)
+      change(level, game::STAGE_COUNT);
+  }
+
+  int level() const { return m_level; }
+  const game::quality_level &current() const { return m_levels[m_level]; }
+  const game::quality_level &at(int level) const { return m_levels[level]; }
+  double budget() const { return m_budget; }
+  void set_budget(double millis) { m_budget = millis; }
+  double average() const { return m_average; }
+
+  // The most recent decisions, oldest first. Only the last
+  // history_capacity are kept.
+  int history_size() const {
+    return m_decisions < history_capacity ? m_decisions : history_capacity;
+  }
+  const decision &history(int i) const {
+    int first{m_decisions - history_size()};
+    return m_history[(first + i) % history_capacity];
+  }
+
+protected:
+  static bool same(const game::quality_level &a,
+                   const game::quality_level &b) {
+    return a.resolution == b.resolution && a.shadow_scale == b.shadow_scale &&
+           a.blur_taps == b.blur_taps && a.particle_limit == b.particle_limit;
+  }
+
+  void change(int level, int stage) {
+    decision d = {m_frame, m_level, level, m_average, stage};
+    m_history[m_decisions % history_capacity] = d;
+    ++m_decisions;
+    m_level = level;
+    m_over = m_under = 0;
+    m_cooldown = 30;
+    profile::count("quality_level", m_level);
+  }
+
+  game::quality_level m_levels[level_count];
+  double m_budget;
+  double m_average;
+  int m_level;
+  int m_count; // Levels in m_levels.
+  int m_frame;
+  int m_over;
+  int m_under;
+  int m_cooldown;
+  int m_restore_frames;
+  int m_last_restore;
+  decision m_history[history_capacity];
+  int m_decisions;
+};
+
+} // namespace quality
+
+#endif // _GOVERNOR_HPP
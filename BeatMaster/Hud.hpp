@@ -0,0 +1,278 @@
+#ifndef _HUD_HPP
+#define _HUD_HPP
+#pragma once
+
+#include "Session.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// On screen text, drawn straight into the frame buffer with a built in bitmap
+// font instead of through GDI, and formatted without allocating so it can be
+// redrawn every frame for next to nothing.
+namespace hud {
+
+static const int glyph_width = 5;
+static const int glyph_height = 7;
+static const int advance = glyph_width + 1;     // Pixels between characters.
+static const int line_height = glyph_height + 2; // Pixels between lines.
+
+// 5x7 glyphs for ' ' to '_', one byte per row, bit 4 the leftmost pixel.
+// Lower case letters are drawn as upper case, anything else as '?'.
+static const unsigned char glyphs[64][glyph_height] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // space
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // !
+    {0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00}, // "
+    {0x0a, 0x1f, 0x0a, 0x0a, 0x0a, 0x1f, 0x0a}, // #
+    {0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04}, // $
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+    {0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d}, // &
+    {0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}, // '
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // (
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // )
+    {0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00}, // *
+    {0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00}, // +
+    {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}, // ,
+    {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}, // -
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, // .
+    {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // /
+    {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+    {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+    {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+    {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+    {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+    {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+    {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+    {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, // :
+    {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08}, // ;
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // <
+    {0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00}, // =
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // >
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // ?
+    {0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e}, // @
+    {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // A
+    {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, // B
+    {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e}, // C
+    {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, // D
+    {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, // E
+    {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, // F
+    {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f}, // G
+    {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // H
+    {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, // I
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, // J
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, // L
+    {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+    {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // O
+    {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, // P
+    {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, // Q
+    {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, // R
+    {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e}, // S
+    {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // U
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, // V
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a}, // W
+    {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, // X
+    {0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04}, // Y
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, // Z
+    {0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e}, // [
+    {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // backslash
+    {0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e}, // ]
+    {0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00}, // ^
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f}, // _
+};
+
+inline const unsigned char *glyph(char c) {
+  if (c >= 'a' && c <= 'z')
+    c = c - 'a' + 'A';
+  if (c < ' ' || c > '_')
+    c = '?';
+  return glyphs[c - ' '];
+}
+
+// A line of text with a fixed capacity, built up with << like a stream.
+// Anything past the capacity is dropped.
+class text {
+public:
+  static const int capacity = 95;
+
+  text() { clear(); }
+
+  text &clear() {
+    m_length = 0;
+    m_text[0] = 0;
+    return *this;
+  }
+
+  text &operator<<(const char *s) {
+    while (*s && m_length < capacity)
+      m_text[m_length++] = *s++;
+    m_text[m_length] = 0;
+    return *this;
+  }
+
+  text &operator<<(char c) {
+    if (m_length < capacity)
+      m_text[m_length++] = c;
+    m_text[m_length] = 0;
+    return *this;
+  }
+
+  text &operator<<(int value) { return *this << static_cast<long long>(value); }
+
+  text &operator<<(long long value) {
+    char digits[24];
+    int count{0};
+    unsigned long long v{value < 0 ? 0ull - static_cast<unsigned long long>(value)
+                                   : static_cast<unsigned long long>(value)};
+    do {
+      digits[count++] = static_cast<char>('0' + v % 10);
+      v /= 10;
+    } while (v);
+    if (value < 0)
+      *this << '-';
+    while (count)
+      *this << digits[--count];
+    return *this;
+  }
+
+  // |value| rounded to |decimals| places (at most 6).
+  text &fixed(double value, int decimals) {
+    static const long long scales[] = {1, 10, 100, 1000, 10000, 100000,
+                                       1000000};
+    decimals = decimals < 0 ? 0 : (decimals > 6 ? 6 : decimals);
+    long long scale{scales[decimals]};
+    bool negative{value < 0};
+    long long v{static_cast<long long>((negative ? -value : value) * scale +
+                                       0.5)};
+    if (negative && v)
+      *this << '-';
+    *this << v / scale;
+    if (decimals) {
+      *this << '.';
+      long long fraction{v % scale};
+      for (long long s = scale / 10; s; s /= 10)
+        *this << static_cast<char>('0' + (fraction / s) % 10);
+    }
+    return *this;
+  }
+
+  const char *c_str() const { return m_text; }
+  int length() const { return m_length; }
+
+protected:
+  char m_text[capacity + 1];
+  int m_length;
+};
+
+// Draw |s| with its top left corner at (x, y), each font pixel |scale|
+// pixels square, over a one pixel drop shadow. Clipped to the buffer.
+inline void draw_text(detail::Uint32 *buffer, int width, int height, int x,
+                      int y, const char *s, detail::Uint32 color,
+                      int scale = 1) {
+  const detail::Uint32 shade = 0xff000000;
+  for (int pass = 0; pass < 2; ++pass) {
+    detail::Uint32 ink{pass ? color : shade};
+    int ox{x + (pass ? 0 : scale)};
+    int oy{y + (pass ? 0 : scale)};
+    for (const char *c = s; *c; ++c, ox += advance * scale) {
+      if (*c == ' ')
+        continue;
+      const unsigned char *rows{glyph(*c)};
+      for (int row = 0; row < glyph_height; ++row) {
+        for (int col = 0; col < glyph_width; ++col) {
+          if (!(rows[row] & (0x10 >> col)))
+            continue;
+          int left{ox + col * scale};
+          int top{oy + row * scale};
+          for (int py = top; py < top + scale; ++py) {
+            if (py < 0 || py >= height)
+              continue;
+            detail::Uint32 *out{buffer + py * width};
+            for (int px = left; px < left + scale; ++px)
+              if (px >= 0 && px < width)
+                out[px] = ink;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Frame rate and frame time in the bottom left corner, plus (when |world| is
+// given) a panel of per-stage timings and counts in the top left, below the
+// bar. |quality| is the governor's level, or -1 when there isn't one. Stage
+// times are smoothed so they can be read.
+class overlay {
+public:
+  overlay() : m_frames(0) {
+    for (int i = 0; i < game::STAGE_COUNT; ++i)
+      m_stages[i] = 0;
+  }
+
+  void draw(detail::Uint32 *buffer, int width, int height, double fps,
+            double millis, const game::session *world = nullptr,
+            int quality = -1) {
+    PROFILE_SCOPE("hud");
+    int scale{height >= 720 ? 2 : 1};
+    int step{line_height * scale};
+    const detail::Uint32 white = 0xffffffff;
+    const detail::Uint32 amber = 0xffffc040;
+
+    m_line.clear() << "FPS: " << static_cast<int>(fps);
+    draw_text(buffer, width, height, 2, height - 2 * step, m_line.c_str(),
+              white, scale);
+    m_line.clear() << "MPF: ";
+    m_line.fixed(millis, 2);
+    draw_text(buffer, width, height, 2, height - step, m_line.c_str(), white,
+              scale);
+    if (!world)
+      return;
+
+    // Start below the HUD bar.
+    int y{world->overlays[game::OVERLAY_BAR].bottom() + 2 * scale};
+    double total{0};
+    for (int i = 0; i < game::STAGE_COUNT; ++i) {
+      double ms{world->stage_millis[i]};
+      m_stages[i] = m_frames ? m_stages[i] + (ms - m_stages[i]) * 0.1 : ms;
+      total += m_stages[i];
+      if (m_stages[i] <= 0)
+        continue;
+      m_line.clear() << game::stage_names[i] << ' ';
+      m_line.fixed(m_stages[i], 2);
+      draw_text(buffer, width, height, 2, y, m_line.c_str(), amber, scale);
+      y += step;
+    }
+    m_line.clear() << "stages ";
+    m_line.fixed(total, 2);
+    if (!world->frame.empty()) {
+      m_line << " wall ";
+      m_line.fixed(world->frame.last_millis(), 2);
+    }
+    draw_text(buffer, width, height, 2, y, m_line.c_str(), white, scale);
+    y += step;
+
+    m_line.clear() << "units " << static_cast<int>(world->units.size())
+                   << " particles " << world->effects.live();
+    draw_text(buffer, width, height, 2, y, m_line.c_str(), white, scale);
+    y += step;
+
+    m_line.clear() << "pool " << world->pool.used() / 1024 << '/'
+                   << world->pool.size() / 1024 << " KB";
+    if (quality >= 0)
+      m_line << " quality " << quality;
+    draw_text(buffer, width, height, 2, y, m_line.c_str(), white, scale);
+    ++m_frames;
+  }
+
+protected:
+  text m_line;
+  double m_stages[game::STAGE_COUNT];
+  int m_frames;
+};
+
+} // namespace hud
+
+#endif // _HUD_HPP
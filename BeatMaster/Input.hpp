@@ -0,0 +1,72 @@
+#ifndef _INPUT_HPP
+#define _INPUT_HPP
+#pragma once
+
+#include "Profiler.hpp"
+#include "util.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Keyboard input travels from the window thread to the update thread as
+// timestamped key events through a lock-free queue. The update thread folds
+// them into a bitmask of held keys once per frame, so presses shorter than a
+// frame still register and several keys can be held at once.
+namespace input {
+
+// Bit i is the old direction value i (0 = left, 1 = up, 2 = right, 3 = down).
+// KEY_BEAT isn't a key: it marks a frame that a beat in the music landed on
+// (see Audio.hpp). It travels with the keys so replays play the beats back.
+enum Keys {
+  KEY_LEFT = 1 << 0,
+  KEY_UP = 1 << 1,
+  KEY_RIGHT = 1 << 2,
+  KEY_DOWN = 1 << 3,
+  KEY_BEAT = 1 << 4
+};
+
+struct event {
+  profile::ticks timestamp;
+  unsigned int key;
+  bool down;
+};
+
+typedef util::spsc_queue<event, 256> event_queue;
+
+// Update thread's view of the keyboard.
+struct state {
+  unsigned int held;     // Keys down right now.
+  unsigned int pressed;  // Keys that went down since the previous poll.
+  unsigned int released; // Keys that went up since the previous poll.
+
+  state() : held(0), pressed(0), released(0) {}
+
+  // Consume every queued event. Call once per frame from the update thread.
+  void poll(event_queue &queue) {
+    pressed = 0;
+    released = 0;
+
+    event e;
+    profile::ticks oldest{0};
+    while (queue.pop(e)) {
+      if (!oldest)
+        oldest = e.timestamp;
+      if (e.down) {
+        held |= e.key;
+        pressed |= e.key;
+      } else {
+        held &= ~e.key;
+        released |= e.key;
+      }
+    }
+
+    if (oldest)
+      profile::count("input_latency_us",
+                     profile::to_micros(profile::now() - oldest));
+  }
+
+  // Keys that act this frame: held now, or tapped and let go between frames.
+  unsigned int active() const { return held | pressed; }
+};
+
+} // namespace input
+
+#endif // _INPUT_HPP
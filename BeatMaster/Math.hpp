@@ -4,96 +4,164 @@
 
 #include <cmath>
 #include <chrono>
+#include <emmintrin.h>
 // Copyright (c) - 2015, Shaheed Abdol.
 
 namespace math {
 
-template <typename T, int C> class Vector {
-public:
-  static const int length = C;
-  T v[C];
+// SIMD packet traits. The generic version is a one lane "packet" that is just
+// the scalar itself, so every element type goes through the same code paths
+// and float/double simply get wider packets.
+template <typename T> struct packet {
+  typedef T type;
+  static const int width = 1;
+  static type load(const T *p) { return *p; }
+  static void store(T *p, type x) { *p = x; }
+  static type set1(T s) { return s; }
+};
 
-  bool equals(const Vector<T, C> &other) {
-    for (int i = 0; i < length; ++i)
-      if (v[i] != other.v[i])
-        return false;
-    return true;
-  }
+template <> struct packet<float> {
+  typedef __m128 type;
+  static const int width = 4;
+  static type load(const float *p) { return _mm_loadu_ps(p); }
+  static void store(float *p, type x) { _mm_storeu_ps(p, x); }
+  static type set1(float s) { return _mm_set1_ps(s); }
+};
 
-  Vector<T, C> operator*(const Vector<T, C> &right) const {
-    vector<T, C> out;
+template <> struct packet<double> {
+  typedef __m128d type;
+  static const int width = 2;
+  static type load(const double *p) { return _mm_loadu_pd(p); }
+  static void store(double *p, type x) { _mm_storeu_pd(p, x); }
+  static type set1(double s) { return _mm_set1_pd(s); }
+};
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] * right.v[i];
+// Element-wise operations, usable on scalars and on packets.
+struct op_add {
+  template <typename T> static T apply(T a, T b) { return a + b; }
+  static __m128 apply(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+  static __m128d apply(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+};
 
-    return out;
-  }
+struct op_sub {
+  template <typename T> static T apply(T a, T b) { return a - b; }
+  static __m128 apply(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+  static __m128d apply(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+};
 
-  Vector<T, C> operator*(const T right) const {
-    Vector<T, C> out;
+struct op_mul {
+  template <typename T> static T apply(T a, T b) { return a * b; }
+  static __m128 apply(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+  static __m128d apply(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+};
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] * right;
+struct op_div {
+  template <typename T> static T apply(T a, T b) { return a / b; }
+  static __m128 apply(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+  static __m128d apply(__m128d a, __m128d b) { return _mm_div_pd(a, b); }
+};
 
-    return out;
-  }
+// Expression templates. Arithmetic on vectors builds a tree of these nodes
+// instead of a temporary per operator; the tree is only evaluated when it is
+// assigned to a vector, in a single pass over the elements. So `a + b * s`
+// costs one loop and no intermediate vectors.
+template <typename E> struct expr {
+  const E &self() const { return *static_cast<const E *>(this); }
+};
 
-  Vector<T, C> operator-(const T right) const {
-    Vector<T, C> out;
+// Nodes keep nested nodes and scalars by value (they are tiny and may be
+// temporaries), vectors by reference - see the specialization below.
+template <typename E> struct stored { typedef E type; };
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] - right;
+template <typename T> struct scalar : public expr<scalar<T> > {
+  typedef T value_type;
+  static const int size = 0;
+  T s;
 
-    return out;
-  }
+  explicit scalar(T value) : s(value) {}
+  T operator[](int) const { return s; }
+  typename packet<T>::type load(int) const { return packet<T>::set1(s); }
+};
 
-  Vector<T, C> operator-(const Vector<T, C> &right) const {
-    Vector<T, C> out;
+template <typename L, typename R, typename Op>
+struct binary : public expr<binary<L, R, Op> > {
+  typedef typename L::value_type value_type;
+  static const int size = L::size > R::size ? L::size : R::size;
+  static_assert(L::size == 0 || R::size == 0 || L::size == R::size,
+                "Vector dimensions differ");
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] - right.v[i];
+  typename stored<L>::type l;
+  typename stored<R>::type r;
 
-    return out;
-  }
-
-  Vector<T, C> operator+(const T right) const {
-    Vector<T, C> out;
+  binary(const L &left, const R &right) : l(left), r(right) {}
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] + right;
+  value_type operator[](int i) const { return Op::apply(l[i], r[i]); }
+  typename packet<value_type>::type load(int i) const {
+    return Op::apply(l.load(i), r.load(i));
+  }
+};
 
-    return out;
+// Evaluate an expression into |out|, a packet at a time. C and the packet
+// width are compile time constants, so both loops unroll completely.
+template <typename T, int C> struct evaluate {
+  template <typename E> static void run(T *out, const E &e) {
+    const int width = packet<T>::width;
+    int i = 0;
+    for (; i + width <= C; i += width)
+      packet<T>::store(out + i, e.load(i));
+    for (; i < C; ++i)
+      out[i] = e[i];
   }
+};
 
-  Vector<T, C> operator+(const Vector<T, C> &right) const {
-    Vector<T, C> out;
+template <typename T, int C> class Vector : public expr<Vector<T, C> > {
+public:
+  typedef T value_type;
+  static const int length = C;
+  static const int size = C;
+  T v[C];
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] + right.v[i];
+  T operator[](int i) const { return v[i]; }
+  typename packet<T>::type load(int i) const { return packet<T>::load(v + i); }
 
-    return out;
+  template <typename E> void assign(const expr<E> &e) {
+    evaluate<T, C>::run(v, e.self());
   }
 
-  Vector<T, C> operator/(const T right) const {
-    Vector<T, C> out;
+  template <typename E> Vector<T, C> &operator=(const expr<E> &e) {
+    assign(e);
+    return *this;
+  }
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] / right;
+  template <typename E> Vector<T, C> &operator+=(const expr<E> &e) {
+    assign(binary<Vector<T, C>, E, op_add>(*this, e.self()));
+    return *this;
+  }
 
-    return out;
+  template <typename E> Vector<T, C> &operator-=(const expr<E> &e) {
+    assign(binary<Vector<T, C>, E, op_sub>(*this, e.self()));
+    return *this;
   }
 
-  Vector<T, C> operator/(const Vector<T, C> &right) const {
-    Vector<T, C> out;
+  Vector<T, C> &operator*=(const T right) {
+    assign(binary<Vector<T, C>, scalar<T>, op_mul>(*this, scalar<T>(right)));
+    return *this;
+  }
 
-    for (int i = 0; i < length; ++i)
-      out.v[i] = v[i] / right.v[i];
+  Vector<T, C> &operator/=(const T right) {
+    assign(binary<Vector<T, C>, scalar<T>, op_div>(*this, scalar<T>(right)));
+    return *this;
+  }
 
-    return out;
+  bool equals(const Vector<T, C> &other) const {
+    for (int i = 0; i < C; ++i)
+      if (v[i] != other.v[i])
+        return false;
+    return true;
   }
 
-  bool operator==(const T right) {
-    for (int i = 0; i < length; ++i)
+  bool operator==(const T right) const {
+    for (int i = 0; i < C; ++i)
       if (v[i] != right)
         return false;
 
@@ -102,137 +170,230 @@ public:
 
   T len_squared() const {
     T out = 0;
-    for (int i = 0; i < length; ++i) {
+    for (int i = 0; i < C; ++i)
       out += v[i] * v[i];
-    }
 
     return out;
   }
 };
 
+template <typename T, int C> struct stored<Vector<T, C> > {
+  typedef const Vector<T, C> &type;
+};
+
+// Vector (op) vector.
+template <typename L, typename R>
+binary<L, R, op_add> operator+(const expr<L> &l, const expr<R> &r) {
+  return binary<L, R, op_add>(l.self(), r.self());
+}
+
+template <typename L, typename R>
+binary<L, R, op_sub> operator-(const expr<L> &l, const expr<R> &r) {
+  return binary<L, R, op_sub>(l.self(), r.self());
+}
+
+template <typename L, typename R>
+binary<L, R, op_mul> operator*(const expr<L> &l, const expr<R> &r) {
+  return binary<L, R, op_mul>(l.self(), r.self());
+}
+
+template <typename L, typename R>
+binary<L, R, op_div> operator/(const expr<L> &l, const expr<R> &r) {
+  return binary<L, R, op_div>(l.self(), r.self());
+}
+
+// Vector (op) scalar, applied to every element.
+template <typename L>
+binary<L, scalar<typename L::value_type>, op_add>
+operator+(const expr<L> &l, typename L::value_type r) {
+  typedef scalar<typename L::value_type> S;
+  return binary<L, S, op_add>(l.self(), S(r));
+}
+
+template <typename L>
+binary<L, scalar<typename L::value_type>, op_sub>
+operator-(const expr<L> &l, typename L::value_type r) {
+  typedef scalar<typename L::value_type> S;
+  return binary<L, S, op_sub>(l.self(), S(r));
+}
+
+template <typename L>
+binary<L, scalar<typename L::value_type>, op_mul>
+operator*(const expr<L> &l, typename L::value_type r) {
+  typedef scalar<typename L::value_type> S;
+  return binary<L, S, op_mul>(l.self(), S(r));
+}
+
+template <typename L>
+binary<L, scalar<typename L::value_type>, op_div>
+operator/(const expr<L> &l, typename L::value_type r) {
+  typedef scalar<typename L::value_type> S;
+  return binary<L, S, op_div>(l.self(), S(r));
+}
+
+template <typename R>
+binary<scalar<typename R::value_type>, R, op_mul>
+operator*(typename R::value_type l, const expr<R> &r) {
+  typedef scalar<typename R::value_type> S;
+  return binary<S, R, op_mul>(S(l), r.self());
+}
+
+// Reductions work straight off an expression, no temporary needed.
+template <typename L, typename R>
+typename L::value_type dot(const expr<L> &l, const expr<R> &r) {
+  typename L::value_type out = 0;
+  for (int i = 0; i < L::size; ++i)
+    out += l.self()[i] * r.self()[i];
+  return out;
+}
+
+template <typename E> typename E::value_type len_squared(const expr<E> &e) {
+  return dot(e, e);
+}
+
 template <typename T> class vector2 : public Vector<T, 2> {
 public:
+  using Vector<T, 2>::operator=;
+
   vector2() {
-    v[0] = 0;
-    v[1] = 0;
+    this->v[0] = 0;
+    this->v[1] = 0;
   }
 
   vector2(T a, T b) {
-    v[0] = a;
-    v[1] = b;
+    this->v[0] = a;
+    this->v[1] = b;
   }
+
+  template <typename E> vector2(const expr<E> &e) { this->assign(e); }
 };
 
 template <typename T> class vector3 : public Vector<T, 3> {
 public:
+  using Vector<T, 3>::operator=;
+
   vector3() {
     for (int i = 0; i < 3; ++i)
-      v[i] = 0;
+      this->v[i] = 0;
   }
 
   vector3(T p) {
     for (int i = 0; i < 3; ++i)
-      v[i] = p;
+      this->v[i] = p;
   }
 
   vector3(T x, T y, T z) {
-    v[0] = x;
-    v[1] = y;
-    v[2] = z;
+    this->v[0] = x;
+    this->v[1] = y;
+    this->v[2] = z;
   }
 
-  T length() const { return sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]); }
+  template <typename E> vector3(const expr<E> &e) { this->assign(e); }
+
+  T length() const { return sqrt(this->len_squared()); }
 };
 
 template <typename T> class vector4 : public Vector<T, 4> {
 public:
+  using Vector<T, 4>::operator=;
+
   vector4() {
     for (int i = 0; i < 4; ++i)
-      v[i] = 0;
+      this->v[i] = 0;
   }
 
   vector4(T p) {
     for (int i = 0; i < 4; ++i)
-      v[i] = p;
+      this->v[i] = p;
   }
 
   vector4(T x, T y, T z, T w) {
-    v[0] = x;
-    v[1] = y;
-    v[2] = z;
-    v[3] = w;
+    this->v[0] = x;
+    this->v[1] = y;
+    this->v[2] = z;
+    this->v[3] = w;
   }
 
   vector4(vector3<T> &in, T w) {
-    v[0] = in.v[0];
-    v[1] = in.v[1];
-    v[2] = in.v[2];
-    v[3] = w;
+    this->v[0] = in.v[0];
+    this->v[1] = in.v[1];
+    this->v[2] = in.v[2];
+    this->v[3] = w;
   }
+
+  template <typename E> vector4(const expr<E> &e) { this->assign(e); }
 };
 
 template <typename T> class vector5 : public Vector<T, 5> {
 public:
+  using Vector<T, 5>::operator=;
+
   vector5() {
     for (int i = 0; i < 5; ++i)
-      v[i] = 0;
+      this->v[i] = 0;
   }
 
   vector5(T p) {
     for (int i = 0; i < 5; ++i)
-      v[i] = p;
+      this->v[i] = p;
   }
 
   vector5(T x, T y, T z, T w, T u) {
-    v[0] = x;
-    v[1] = y;
-    v[2] = z;
-    v[3] = w;
-    v[4] = u;
+    this->v[0] = x;
+    this->v[1] = y;
+    this->v[2] = z;
+    this->v[3] = w;
+    this->v[4] = u;
   }
 
   vector5(vector4<T> &in, T w) {
-    v[0] = in.v[0];
-    v[1] = in.v[1];
-    v[2] = in.v[2];
-    v[3] = in.v[3];
-    v[4] = w;
+    this->v[0] = in.v[0];
+    this->v[1] = in.v[1];
+    this->v[2] = in.v[2];
+    this->v[3] = in.v[3];
+    this->v[4] = w;
   }
+
+  template <typename E> vector5(const expr<E> &e) { this->assign(e); }
 };
 
 template <typename T> class vector8 : public Vector<T, 8> {
 public:
+  using Vector<T, 8>::operator=;
+
   vector8() {
     for (int i = 0; i < 8; ++i)
-      v[i] = 0;
+      this->v[i] = 0;
   }
 
   vector8(T p) {
     for (int i = 0; i < 8; ++i)
-      v[i] = p;
+      this->v[i] = p;
   }
 
   vector8(T x, T y, T z, T w, T u, T a, T b, T c) {
-    v[0] = x;
-    v[1] = y;
-    v[2] = z;
-    v[3] = w;
-    v[4] = u;
-    v[5] = a;
-    v[6] = b;
-    v[7] = c;
+    this->v[0] = x;
+    this->v[1] = y;
+    this->v[2] = z;
+    this->v[3] = w;
+    this->v[4] = u;
+    this->v[5] = a;
+    this->v[6] = b;
+    this->v[7] = c;
   }
 
   vector8(vector4<T> &in, T w) {
-    v[0] = in.v[0];
-    v[1] = in.v[1];
-    v[2] = in.v[2];
-    v[3] = in.v[3];
-    v[4] = w;
-    v[5] = w;
-    v[6] = w;
-    v[7] = w;
+    this->v[0] = in.v[0];
+    this->v[1] = in.v[1];
+    this->v[2] = in.v[2];
+    this->v[3] = in.v[3];
+    this->v[4] = w;
+    this->v[5] = w;
+    this->v[6] = w;
+    this->v[7] = w;
   }
+
+  template <typename E> vector8(const expr<E> &e) { this->assign(e); }
 };
 
 typedef vector2<double> vec2;
@@ -240,12 +401,83 @@ typedef vector2<int> vec2i;
 typedef vector3<double> vec3;
 typedef vector3<int> vec3i;
 typedef vector4<double> vec4;
+typedef vector4<float> vec4f;
 typedef vector4<int> vec4i;
 typedef vector5<double> vec5;
 typedef vector5<int> vec5i;
 typedef vector8<double> vec8;
+typedef vector8<float> vec8f;
 typedef vector8<int> vec8i;
 
+// Operations over whole arrays of vectors. Vectors are plain arrays of their
+// elements, so an array of them is one flat run of T and can be streamed
+// through packets regardless of the vector length.
+namespace batch {
+
+template <typename V> typename V::value_type *flat(V *items) {
+  return reinterpret_cast<typename V::value_type *>(items);
+}
+
+template <typename V>
+const typename V::value_type *flat(const V *items) {
+  return reinterpret_cast<const typename V::value_type *>(items);
+}
+
+// out[i] = a[i] + b[i] * s
+template <typename V>
+void madd(V *out, const V *a, const V *b, typename V::value_type s,
+          int count) {
+  typedef typename V::value_type T;
+  typedef packet<T> P;
+  T *o{flat(out)};
+  const T *pa{flat(a)};
+  const T *pb{flat(b)};
+  int len{count * V::size};
+  typename P::type ps{P::set1(s)};
+  int i = 0;
+  for (; i + P::width <= len; i += P::width)
+    P::store(o + i, op_add::apply(P::load(pa + i),
+                                  op_mul::apply(P::load(pb + i), ps)));
+  for (; i < len; ++i)
+    o[i] = pa[i] + pb[i] * s;
+}
+
+// out[i] = a[i] * s
+template <typename V>
+void scale(V *out, const V *a, typename V::value_type s, int count) {
+  typedef typename V::value_type T;
+  typedef packet<T> P;
+  T *o{flat(out)};
+  const T *pa{flat(a)};
+  int len{count * V::size};
+  typename P::type ps{P::set1(s)};
+  int i = 0;
+  for (; i + P::width <= len; i += P::width)
+    P::store(o + i, op_mul::apply(P::load(pa + i), ps));
+  for (; i < len; ++i)
+    o[i] = pa[i] * s;
+}
+
+// For records that keep a position and its velocity side by side (like the
+// game's units), add |lanes| components starting at |src| onto the ones
+// starting at |dst|, for every record.
+template <typename V>
+void integrate(V *items, int count, int dst, int src, int lanes) {
+  typedef typename V::value_type T;
+  typedef packet<T> P;
+  for (int n = 0; n < count; ++n) {
+    T *v{items[n].v};
+    int i = 0;
+    for (; i + P::width <= lanes; i += P::width)
+      P::store(v + dst + i,
+               op_add::apply(P::load(v + dst + i), P::load(v + src + i)));
+    for (; i < lanes; ++i)
+      v[dst + i] += v[src + i];
+  }
+}
+
+} // namespace batch
+
 // Compute distance to move based on fps.
 double compute_units(double ups, double millis, double fps) {
   if (millis == 0 || fps == 0) // avoid armageddon.
@@ -257,4 +489,4 @@ double compute_units(double ups, double millis, double fps) {
 
 } // namespace math
 
-#endif // _MATH_HPP
\ No newline at end of file
+#endif // _MATH_HPP
@@ -0,0 +1,288 @@
+#ifndef _OFFLINE_HPP
+#define _OFFLINE_HPP
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "Batch.hpp"
+#include "Replay.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Offline rendering to a video file, for trailers and visual regression.
+// The game steps at a fixed timestep instead of the wall clock, so the same
+// inputs always render the same frames, and every frame is rendered as fast
+// as the CPU allows - nothing waits on the display or sleeps.
+//
+// Rendering and writing overlap: the game renders into one of two frame
+// buffers while a writer thread converts and writes the other, so the disk
+// (and the Y4M colour conversion) only costs the game time when the writer
+// falls a whole frame behind.
+//
+// Files ending in .y4m get YUV4MPEG2 with 4:2:0 full range (JPEG) chroma,
+// which most players and encoders take directly. Anything else gets raw
+// 32 bit frames back to back, in memory order (B, G, R, A bytes).
+namespace offline {
+
+struct options {
+  const char *file;   // Where the frames go.
+  const char *inputs; // Replay log to take seed, size and keys from, or null.
+  int frames;         // Frames to render; 0 renders the whole replay log.
+  int fps;            // Frames per second of game time (the timestep).
+  int width, height;  // Output size without a replay log.
+  rng::uint64 seed;   // Seed without a replay log (keys from batch::autopilot)
+  game::settings config;
+
+  options()
+      : file(nullptr), inputs(nullptr), frames(0), fps(60), width(640),
+        height(480), seed(2635) {}
+};
+
+// Convert one ARGB frame to I420 planes: full resolution luma, then blue and
+// red difference at half resolution each way, averaged over 2x2 pixels.
+// BT.601 full range, in 8 bit fixed point. Odd sizes repeat the last
+// row/column.
+inline void to_i420(const detail::Uint32 *pixels, int width, int height,
+                    unsigned char *y, unsigned char *u, unsigned char *v) {
+  for (int i = 0; i < width * height; ++i) {
+    detail::Uint32 c{pixels[i]};
+    int r{static_cast<int>((c >> 16) & 0xff)};
+    int g{static_cast<int>((c >> 8) & 0xff)};
+    int b{static_cast<int>(c & 0xff)};
+    y[i] = static_cast<unsigned char>((77 * r + 150 * g + 29 * b + 128) >> 8);
+  }
+
+  int chroma_width{(width + 1) / 2};
+  for (int row = 0; row < height; row += 2) {
+    const detail::Uint32 *top{pixels + row * width};
+    const detail::Uint32 *bottom{row + 1 < height ? top + width : top};
+    unsigned char *u_row{u + (row / 2) * chroma_width};
+    unsigned char *v_row{v + (row / 2) * chroma_width};
+    for (int x = 0; x < width; x += 2) {
+      int right{x + 1 < width ? x + 1 : x};
+      detail::Uint32 quad[] = {top[x], top[right], bottom[x], bottom[right]};
+      int r{2}, g{2}, b{2};
+      for (int i = 0; i < 4; ++i) {
+        r += (quad[i] >> 16) & 0xff;
+        g += (quad[i] >> 8) & 0xff;
+        b += quad[i] & 0xff;
+      }
+      r >>= 2;
+      g >>= 2;
+      b >>= 2;
+      // Offset by 128.5 << 8 first, so the shifts never see a negative.
+      u_row[x / 2] =
+          static_cast<unsigned char>((-43 * r - 85 * g + 128 * b + 32895) >> 8);
+      v_row[x / 2] =
+          static_cast<unsigned char>((128 * r - 107 * g - 21 * b + 32895) >> 8);
+    }
+  }
+}
+
+// The writer thread and the two frame buffers it shares with the game.
+class writer {
+public:
+  writer()
+      : m_file(nullptr), m_y4m(false), m_width(0), m_height(0),
+        m_thread(nullptr), m_free(nullptr), m_full(nullptr), m_rendered(0),
+        m_written(0), m_bytes(0), m_waited(0) {}
+  ~writer() { close(); }
+
+  bool open(const char *file, int width, int height, int fps) {
+    close();
+    if (fopen_s(&m_file, file, "wb") != 0) {
+      std::cout << "Could not open " << file << " to render into" << std::endl;
+      m_file = nullptr;
+      return false;
+    }
+    size_t length{strlen(file)};
+    m_y4m = length > 4 && _stricmp(file + length - 4, ".y4m") == 0;
+    m_width = width;
+    m_height = height;
+    m_rendered = m_written = 0;
+    m_bytes = 0;
+    m_waited = 0;
+    m_stop.store(false);
+    for (int i = 0; i < 2; ++i)
+      m_frames[i].assign(width * height, 0);
+    int chroma{((width + 1) / 2) * ((height + 1) / 2)};
+    m_planes.assign(m_y4m ? width * height + 2 * chroma : 0, 0);
+
+    if (m_y4m) {
+      char header[128];
+      int n{sprintf_s(header, sizeof(header),
+                      "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width,
+                      height, fps)};
+      m_bytes += fwrite(header, 1, n, m_file);
+    }
+
+    m_free = CreateSemaphore(NULL, 2, 2, NULL);
+    m_full = CreateSemaphore(NULL, 0, 3, NULL); // Two frames and a stop.
+    m_thread = CreateThread(NULL, 0, &writer::run, this, 0, NULL);
+    return true;
+  }
+
+  // The buffer to render the next frame into. Waits while the writer still
+  // has both.
+  detail::Uint32 *begin() {
+    profile::ticks start{profile::now()};
+    WaitForSingleObject(m_free, INFINITE);
+    m_waited += profile::to_millis(profile::now() - start);
+    return &m_frames[m_rendered.load() % 2][0];
+  }
+
+  // Hand the frame begin() gave out to the writer thread.
+  void submit() {
+    ++m_rendered;
+    ReleaseSemaphore(m_full, 1, NULL);
+  }
+
+  // Write out whatever is still queued and close the file.
+  void close() {
+    if (m_thread) {
+      m_stop.store(true);
+      ReleaseSemaphore(m_full, 1, NULL);
+      WaitForSingleObject(m_thread, INFINITE);
+      CloseHandle(m_thread);
+      CloseHandle(m_free);
+      CloseHandle(m_full);
+      m_thread = m_free = m_full = nullptr;
+    }
+    if (m_file) {
+      fclose(m_file);
+      m_file = nullptr;
+    }
+  }
+
+  bool y4m() const { return m_y4m; }
+  int written() const { return m_written; }
+  unsigned long long bytes() const { return m_bytes; }
+  // Milliseconds the game spent waiting for a free buffer.
+  double waited() const { return m_waited; }
+
+protected:
+  static DWORD WINAPI run(LPVOID parameter) {
+    writer *self{static_cast<writer *>(parameter)};
+    profile::name_thread("writer");
+    for (;;) {
+      WaitForSingleObject(self->m_full, INFINITE);
+      // close() wakes us once more than there are frames; anything submitted
+      // before that is still written.
+      if (self->m_stop.load() && self->m_written == self->m_rendered.load())
+        break;
+      self->write(&self->m_frames[self->m_written % 2][0]);
+      ++self->m_written;
+      ReleaseSemaphore(self->m_free, 1, NULL);
+    }
+    return 0;
+  }
+
+  void write(const detail::Uint32 *pixels) {
+    PROFILE_SCOPE("write");
+    if (!m_y4m) {
+      m_bytes += fwrite(pixels, sizeof(detail::Uint32), m_width * m_height,
+                        m_file) *
+                 sizeof(detail::Uint32);
+      return;
+    }
+    int luma{m_width * m_height};
+    int chroma{((m_width + 1) / 2) * ((m_height + 1) / 2)};
+    unsigned char *y{&m_planes[0]};
+    to_i420(pixels, m_width, m_height, y, y + luma, y + luma + chroma);
+    m_bytes += fwrite("FRAME\n", 1, 6, m_file);
+    m_bytes += fwrite(y, 1, m_planes.size(), m_file);
+  }
+
+  FILE *m_file;
+  bool m_y4m;
+  int m_width, m_height;
+  std::vector<detail::Uint32> m_frames[2];
+  std::vector<unsigned char> m_planes; // Y, U then V, for Y4M.
+  HANDLE m_thread;
+  HANDLE m_free; // Buffers the game may render into.
+  HANDLE m_full; // Frames waiting for the writer.
+  std::atomic<bool> m_stop;
+  std::atomic<int> m_rendered; // Changed by the game's thread only, but the
+                               // writer reads it to know when to stop.
+  int m_written; // Changed by the writer's thread only, read after close().
+  unsigned long long m_bytes;
+  double m_waited;
+
+private:
+  writer(const writer &);
+  writer &operator=(const writer &);
+};
+
+// Render |o|.frames frames into |o|.file and report how much faster than
+// real time that went, plus a checksum of every frame (as replay::play
+// computes it) to compare renders between builds.
+inline bool render(const options &o) {
+  replay::header recorded = {o.seed, o.width, o.height, 0, 0, 0, 0};
+  std::vector<replay::frame> log;
+  if (o.inputs && !replay::load(o.inputs, recorded, log))
+    return false;
+  rng::uint64 seed{recorded.seed};
+  int width{recorded.width}, height{recorded.height};
+  int frames{o.frames > 0 ? o.frames : static_cast<int>(log.size())};
+  if (frames <= 0) {
+    std::cout << "Nothing to render - give --frames or a replay log."
+              << std::endl;
+    return false;
+  }
+
+  util::mem_pool pool(game::session::pool_bytes(o.config));
+  game::session world(pool, seed, o.config);
+  if (o.inputs &&
+      !replay::compatible(recorded,
+                          replay::describe(world, seed, width, height)))
+    return false;
+  batch::autopilot pilot(seed);
+  math::vec2 iResolution(static_cast<double>(width),
+                         static_cast<double>(height));
+  double millis{1000.0 / o.fps};
+  double fps{static_cast<double>(o.fps)};
+
+  writer out;
+  if (!out.open(o.file, width, height, o.fps))
+    return false;
+  std::cout << "Rendering " << frames << " " << width << "x" << height
+            << " frames at " << o.fps << " fps to " << o.file
+            << (out.y4m() ? " (Y4M)" : " (raw BGRA)") << std::endl;
+
+  unsigned int hash{2166136261u};
+  double stepping{0};
+  profile::ticks start{profile::now()};
+  for (int i = 0; i < frames; ++i) {
+    // Past the end of the log the scripted player takes over.
+    unsigned int keys{i < static_cast<int>(log.size()) ? log[i].keys
+                                                       : pilot.next()};
+    detail::Uint32 *pixels{out.begin()};
+    profile::ticks frame_start{profile::now()};
+    {
+      PROFILE_SCOPE("frame");
+      world.step(pixels, iResolution, millis, fps, keys);
+    }
+    stepping += profile::to_millis(profile::now() - frame_start);
+    hash = replay::checksum(pixels, width * height, hash);
+    out.submit();
+  }
+  out.close();
+  double total{profile::to_millis(profile::now() - start)};
+
+  double game_millis{frames * millis};
+  std::cout << "Rendered " << out.written() << " frames ("
+            << game_millis / 1000.0 << " s of game) in " << total / 1000.0
+            << " s: " << frames * 1000.0 / total << " frames/s, "
+            << game_millis / total << "x real time" << std::endl;
+  std::cout << "  Rendering took " << stepping << " ms, waiting for the "
+            << "writer " << out.waited() << " ms; wrote "
+            << out.bytes() / 1048576.0 << " MB" << std::endl;
+  std::cout << "Checksum: " << std::hex << hash << std::dec << std::endl;
+  return out.written() == frames;
+}
+
+} // namespace offline
+
+#endif // _OFFLINE_HPP
@@ -0,0 +1,270 @@
+#ifndef _PARTICLES_HPP
+#define _PARTICLES_HPP
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <iostream>
+#include "Random.hpp"
+#include "util.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Particle effects (explosions, hit sparks). Particles are kept out of the
+// game's unit list on purpose: they live in their own fixed-capacity pool,
+// one array per field, so integration and fading run four particles per SSE
+// instruction and dead particles are compacted away without any allocation.
+namespace fx {
+
+typedef unsigned int Uint32;
+
+class particles {
+public:
+  // All storage comes out of |pool| up front, |capacity| is a hard limit.
+  particles(util::mem_pool &pool, int capacity, rng::stream random)
+      : m_count(0), m_capacity(capacity & ~3), m_limit(capacity & ~3),
+        m_random(random) {
+    m_x = floats(pool);
+    m_y = floats(pool);
+    m_vx = floats(pool);
+    m_vy = floats(pool);
+    m_life = floats(pool);
+    m_fade = floats(pool);
+    m_color = reinterpret_cast<Uint32 *>(floats(pool));
+    if (!m_x || !m_y || !m_vx || !m_vy || !m_life || !m_fade || !m_color) {
+      std::cout << "Not enough pool memory for " << capacity << " particles."
+                << std::endl;
+      m_capacity = m_limit = 0;
+    }
+  }
+
+  // Throw |count| particles out of (x, y) in random directions. Speed is in
+  // pixels per millisecond, particles fade out over |life_ms|. Whatever does
+  // not fit under the current limit is dropped.
+  void emit_burst(float x, float y, int count, float speed, float life_ms,
+                  Uint32 color) {
+    float fade{1.0f / life_ms};
+    for (int i = 0; i < count && m_count < m_limit; ++i, ++m_count) {
+      float angle{m_random.uniform(0.0f, 6.2831853f)};
+      float s{speed * m_random.uniform(0.3f, 1.0f)};
+      m_x[m_count] = x;
+      m_y[m_count] = y;
+      m_vx[m_count] = cos(angle) * s;
+      m_vy[m_count] = sin(angle) * s;
+      m_life[m_count] = 1.0f;
+      m_fade[m_count] = fade * m_random.uniform(0.75f, 1.25f);
+      m_color[m_count] = color;
+    }
+  }
+
+  // Move and fade everything by |millis|, then drop the particles that died.
+  void update(float millis) {
+    __m128 dt{_mm_set1_ps(millis)};
+    __m128 zero{_mm_setzero_ps()};
+    int write = 0;
+
+    // The last block may run into the padding, those lanes are masked off.
+    for (int i = 0; i < m_count; i += 4) {
+      __m128 x{_mm_add_ps(_mm_loadu_ps(m_x + i),
+                          _mm_mul_ps(_mm_loadu_ps(m_vx + i), dt))};
+      __m128 y{_mm_add_ps(_mm_loadu_ps(m_y + i),
+                          _mm_mul_ps(_mm_loadu_ps(m_vy + i), dt))};
+      __m128 l{_mm_sub_ps(_mm_loadu_ps(m_life + i),
+                          _mm_mul_ps(_mm_loadu_ps(m_fade + i), dt))};
+      _mm_storeu_ps(m_x + i, x);
+      _mm_storeu_ps(m_y + i, y);
+      _mm_storeu_ps(m_life + i, l);
+
+      int alive{_mm_movemask_ps(_mm_cmpgt_ps(l, zero))};
+      if (i + 4 > m_count)
+        alive &= (1 << (m_count - i)) - 1;
+
+      // Fast path - nothing has moved yet and this block is all alive.
+      if (alive == 0xf && write == i) {
+        write += 4;
+        continue;
+      }
+      for (int lane = 0; lane < 4; ++lane) {
+        if (alive & (1 << lane))
+          move(i + lane, write++);
+      }
+    }
+    m_count = write;
+  }
+
+  // Add every particle onto a 32 bit ARGB surface, brightness scaled by the
+  // life it has left. Additive with saturation, so overlapping sparks glow.
+  // Positions are multiplied by |scale_x|, |scale_y| to get surface pixels.
+  void draw(Uint32 *pixels, int width, int height, float scale_x = 1.0f,
+            float scale_y = 1.0f) const {
+    visit(width, height, scale_x, scale_y, [pixels](int at, Uint32 color) {
+      Uint32 &dst{pixels[at]};
+      __m128i sum{_mm_adds_epu8(_mm_cvtsi32_si128(dst),
+                                _mm_cvtsi32_si128(color))};
+      dst = static_cast<Uint32>(_mm_cvtsi128_si32(sum));
+    });
+  }
+
+  // Like draw(), but instead of adding the particles to a surface write out
+  // the pixel index and colour draw() would add, for callers that sort them
+  // first. |at| and |colors| need room for live() entries; returns how many
+  // were written.
+  int splat(int *at, Uint32 *colors, int width, int height,
+            float scale_x = 1.0f, float scale_y = 1.0f) const {
+    int count{0};
+    visit(width, height, scale_x, scale_y,
+          [at, colors, &count](int pixel, Uint32 color) {
+            at[count] = pixel;
+            colors[count++] = color;
+          });
+    return count;
+  }
+
+  void clear() { m_count = 0; }
+
+  // Drop every particle and continue with |random|, as if just constructed.
+  void reset(rng::stream random) {
+    m_count = 0;
+    m_random = random;
+  }
+
+  int live() const { return m_count; }
+
+  // Bytes save() writes: the stream and count, then every array up to the
+  // live particles rounded up to whole packets.
+  int state_bytes() const {
+    return static_cast<int>(sizeof(state) + 7 * packets() * sizeof(float));
+  }
+
+  // Write the live particles and random stream to |out|, returning the end
+  // of what was written. The limit is a quality setting and isn't saved.
+  unsigned char *save(unsigned char *out) const {
+    state header = {m_count, m_random};
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    const float *arrays[] = {m_x,    m_y,    m_vx,
+                             m_vy,   m_life, m_fade,
+                             reinterpret_cast<const float *>(m_color)};
+    size_t bytes{packets() * sizeof(float)};
+    for (int i = 0; i < 7; ++i, out += bytes)
+      memcpy(out, arrays[i], bytes);
+    return out;
+  }
+
+  // Put back what save() wrote, returning the end of it.
+  const unsigned char *load(const unsigned char *in) {
+    state header;
+    memcpy(&header, in, sizeof(header));
+    in += sizeof(header);
+    m_count = header.count < m_capacity ? header.count : m_capacity;
+    m_random = header.random;
+    float *arrays[] = {m_x,    m_y,    m_vx,
+                       m_vy,   m_life, m_fade,
+                       reinterpret_cast<float *>(m_color)};
+    size_t saved{static_cast<size_t>((header.count + 3) & ~3) * sizeof(float)};
+    size_t bytes{packets() * sizeof(float)};
+    for (int i = 0; i < 7; ++i, in += saved)
+      memcpy(arrays[i], in, bytes);
+    return in;
+  }
+  int capacity() const { return m_capacity; }
+
+  // Lower the number of live particles allowed (e.g. to save time under
+  // load). Never more than the capacity.
+  void set_limit(int limit) {
+    m_limit = limit < m_capacity ? (limit & ~3) : m_capacity;
+  }
+  int limit() const { return m_limit; }
+
+protected:
+  struct state {
+    int count;
+    rng::stream random;
+  };
+
+  // Live particles rounded up to the 4 wide packets update() works in.
+  int packets() const { return (m_count + 3) & ~3; }
+
+  // Call |out|(pixel index, colour) for every visible particle.
+  template <typename F>
+  void visit(int width, int height, float scale_x, float scale_y,
+             F out) const {
+    __m128 sx{_mm_set1_ps(scale_x)};
+    __m128 sy{_mm_set1_ps(scale_y)};
+    __m128 w{_mm_set1_ps(static_cast<float>(width))};
+    __m128 h{_mm_set1_ps(static_cast<float>(height))};
+    __m128 zero{_mm_setzero_ps()};
+    __m128 scale{_mm_set1_ps(256.0f)};
+    int xs[4], ys[4], ls[4];
+
+    for (int i = 0; i < m_count; i += 4) {
+      __m128 x{_mm_mul_ps(_mm_loadu_ps(m_x + i), sx)};
+      __m128 y{_mm_mul_ps(_mm_loadu_ps(m_y + i), sy)};
+      __m128 l{_mm_loadu_ps(m_life + i)};
+      int visible{_mm_movemask_ps(
+          _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmplt_ps(x, w)),
+                     _mm_and_ps(_mm_cmpge_ps(y, zero), _mm_cmplt_ps(y, h))))};
+      if (!visible)
+        continue;
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(xs), _mm_cvttps_epi32(x));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(ys), _mm_cvttps_epi32(y));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(ls),
+                       _mm_cvttps_epi32(_mm_mul_ps(l, scale)));
+
+      for (int lane = 0; lane < 4 && i + lane < m_count; ++lane) {
+        if (!(visible & (1 << lane)) || ls[lane] <= 0)
+          continue;
+        Uint32 c{m_color[i + lane]};
+        Uint32 k{static_cast<Uint32>(ls[lane])};
+        Uint32 rb{(((c & 0x00ff00ff) * k) >> 8) & 0x00ff00ff};
+        Uint32 g{(((c & 0x0000ff00) * k) >> 8) & 0x0000ff00};
+        out(ys[lane] * width + xs[lane], rb | g | 0xff000000);
+      }
+    }
+  }
+
+  // One field array, 16 byte aligned and padded to a multiple of 4 entries.
+  float *floats(util::mem_pool &pool) {
+    unsigned char *raw{pool.alloc((m_capacity + 4) * sizeof(float) + 16)};
+    if (!raw)
+      return nullptr;
+    size_t addr{(reinterpret_cast<size_t>(raw) + 15) & ~static_cast<size_t>(15)};
+    float *out{reinterpret_cast<float *>(addr)};
+    for (int i = 0; i < m_capacity + 4; ++i)
+      out[i] = 0.0f;
+    return out;
+  }
+
+  void move(int from, int to) {
+    if (from == to)
+      return;
+    m_x[to] = m_x[from];
+    m_y[to] = m_y[from];
+    m_vx[to] = m_vx[from];
+    m_vy[to] = m_vy[from];
+    m_life[to] = m_life[from];
+    m_fade[to] = m_fade[from];
+    m_color[to] = m_color[from];
+  }
+
+  float *m_x;
+  float *m_y;
+  float *m_vx;
+  float *m_vy;
+  float *m_life;
+  float *m_fade;
+  Uint32 *m_color;
+  int m_count;
+  int m_capacity;
+  int m_limit;
+  rng::stream m_random;
+
+private:
+  particles(const particles &);
+  particles &operator=(const particles &);
+};
+
+} // namespace fx
+
+#endif // _PARTICLES_HPP
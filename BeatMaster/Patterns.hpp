@@ -0,0 +1,523 @@
+#ifndef _PATTERNS_HPP
+#define _PATTERNS_HPP
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <emmintrin.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Game.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Enemy bullet patterns, described as data. A pattern is one line of text,
+// a name followed by key=value fields:
+//
+//   spiral count=6 arc=360 speed=0.06 spin=13 life=5000 reload=250
+//
+// Patterns are compiled into one table holding the direction and speed of
+// every bullet of every pattern. A volley is then the same loop over that
+// pattern's rows whatever it looks like, four bullets per SSE instruction:
+// spreads, rings, spirals and aimed bursts only differ in the numbers, and
+// the heading (at the player, turned by the spin) is worked out once per
+// volley. The bullets go into a fixed-capacity pool of their own, one array
+// per field like fx::particles, and move in one pass that never asks what
+// fired them.
+namespace pattern {
+
+// One pattern as written down, before compiling.
+struct spec {
+  std::string name;
+  int count;    // Bullets per volley.
+  float arc;    // Degrees the volley fans out over, centred on its heading.
+  float speed;  // Playfield units per millisecond.
+  float accel;  // Speed added bullet by bullet, stringing a volley out.
+  float spin;   // Degrees the heading turns between volleys.
+  float life;   // Milliseconds a bullet lasts, unless it leaves the field.
+  float reload; // Milliseconds between an enemy's volleys.
+  bool aimed;   // Headed at the player, otherwise straight down the field.
+
+  spec()
+      : count(1), arc(0), speed(0.1f), accel(0), spin(0), life(4000),
+        reload(1000), aimed(false) {}
+};
+
+// What a session fires without a pattern file.
+static const char *const builtin[] = {
+    "spread count=5 arc=50 speed=0.09 life=4000 reload=700 aimed=1",
+    "spiral count=6 arc=360 speed=0.06 spin=13 life=5000 reload=250",
+    "burst count=4 speed=0.08 accel=0.02 life=3000 reload=900 aimed=1",
+    "ring count=24 arc=360 speed=0.05 life=6000 reload=1600"};
+static const int builtin_count = sizeof(builtin) / sizeof(builtin[0]);
+
+static const int max_count = 1024; // Most bullets one volley may fire.
+
+// Read one pattern from |line| into |out|. Fields left out keep spec's
+// defaults. On a bad line returns false with |error| saying why.
+inline bool parse(const std::string &line, spec &out, std::string &error) {
+  std::istringstream in(line);
+  spec s;
+  if (!(in >> s.name)) {
+    error = "no pattern name";
+    return false;
+  }
+  std::string field;
+  while (in >> field) {
+    size_t equals{field.find('=')};
+    if (equals == std::string::npos) {
+      error = "expected key=value, got " + field;
+      return false;
+    }
+    std::string key{field.substr(0, equals)};
+    double value{atof(field.c_str() + equals + 1)};
+    if (key == "count")
+      s.count = static_cast<int>(value);
+    else if (key == "arc")
+      s.arc = static_cast<float>(value);
+    else if (key == "speed")
+      s.speed = static_cast<float>(value);
+    else if (key == "accel")
+      s.accel = static_cast<float>(value);
+    else if (key == "spin")
+      s.spin = static_cast<float>(value);
+    else if (key == "life")
+      s.life = static_cast<float>(value);
+    else if (key == "reload")
+      s.reload = static_cast<float>(value);
+    else if (key == "aimed")
+      s.aimed = value != 0;
+    else {
+      error = "unknown field " + key;
+      return false;
+    }
+  }
+  if (s.count < 1 || s.count > max_count) {
+    error = "count must be 1 to 1024";
+    return false;
+  }
+  if (s.speed <= 0 || s.life <= 0 || s.reload <= 0) {
+    error = "speed, life and reload must be more than 0";
+    return false;
+  }
+  out = s;
+  return true;
+}
+
+// The built in patterns.
+inline std::vector<spec> defaults() {
+  std::vector<spec> out(builtin_count);
+  std::string error;
+  for (int i = 0; i < builtin_count; ++i)
+    parse(builtin[i], out[i], error);
+  return out;
+}
+
+// Read the patterns in |file|, one a line. Blank lines and lines starting
+// with # are skipped. False (and nothing in |out|) if the file can't be read
+// or any line is bad.
+inline bool load(const char *file, std::vector<spec> &out) {
+  std::ifstream in(file);
+  if (!in) {
+    std::cout << "Could not open pattern file " << file << std::endl;
+    return false;
+  }
+  std::vector<spec> read;
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    size_t first{line.find_first_not_of(" \t\r")};
+    if (first == std::string::npos || line[first] == '#')
+      continue;
+    spec s;
+    std::string error;
+    if (!parse(line, s, error)) {
+      std::cout << file << ":" << number << ": " << error << std::endl;
+      return false;
+    }
+    read.push_back(s);
+  }
+  if (read.empty()) {
+    std::cout << "No patterns in " << file << std::endl;
+    return false;
+  }
+  out.swap(read);
+  return true;
+}
+
+// Enemy bullets in flight. Positions are playfield units.
+class bullets {
+public:
+  // All storage comes out of |pool| up front, |capacity| is a hard limit.
+  bullets(util::mem_pool &pool, int capacity)
+      : m_count(0), m_capacity(capacity & ~3) {
+    m_x = floats(pool);
+    m_y = floats(pool);
+    m_vx = floats(pool);
+    m_vy = floats(pool);
+    m_life = floats(pool);
+    if (!m_x || !m_y || !m_vx || !m_vy || !m_life) {
+      std::cout << "Not enough pool memory for " << capacity << " bullets."
+                << std::endl;
+      m_capacity = 0;
+    }
+  }
+
+  // Pool memory bullets with |capacity| takes.
+  static int bytes(int capacity) {
+    return 5 * (((capacity & ~3) + 4) * sizeof(float) + 32);
+  }
+
+  // Add up to |count| bullets at (x, y), bullet i heading along row i of
+  // |dx|, |dy| turned by the angle whose cosine and sine are |c| and |s|, at
+  // |speed|[i]. Whatever doesn't fit is dropped; returns how many fit.
+  int emit(float x, float y, float c, float s, const float *dx,
+           const float *dy, const float *speed, int count, float life) {
+    int room{m_capacity - m_count};
+    count = count < room ? count : room;
+    __m128 cos4{_mm_set1_ps(c)}, sin4{_mm_set1_ps(s)};
+    __m128 x4{_mm_set1_ps(x)}, y4{_mm_set1_ps(y)}, life4{_mm_set1_ps(life)};
+    // The last block may write past |count| into the padding, those bullets
+    // aren't counted.
+    for (int i = 0; i < count; i += 4) {
+      __m128 u{_mm_loadu_ps(dx + i)}, v{_mm_loadu_ps(dy + i)};
+      __m128 k{_mm_loadu_ps(speed + i)};
+      int at{m_count + i};
+      _mm_storeu_ps(m_x + at, x4);
+      _mm_storeu_ps(m_y + at, y4);
+      _mm_storeu_ps(m_vx + at,
+                    _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(u, cos4),
+                                          _mm_mul_ps(v, sin4)),
+                               k));
+      _mm_storeu_ps(m_vy + at,
+                    _mm_mul_ps(_mm_add_ps(_mm_mul_ps(u, sin4),
+                                          _mm_mul_ps(v, cos4)),
+                               k));
+      _mm_storeu_ps(m_life + at, life4);
+    }
+    m_count += count;
+    return count;
+  }
+
+  // Move everything by |millis|, then drop the bullets that ran out of life
+  // or left |field| (left, top, right, bottom).
+  void update(float millis, const math::vec4 &field) {
+    __m128 dt{_mm_set1_ps(millis)};
+    __m128 zero{_mm_setzero_ps()};
+    __m128 left{_mm_set1_ps(static_cast<float>(field.v[0]))};
+    __m128 top{_mm_set1_ps(static_cast<float>(field.v[1]))};
+    __m128 right{_mm_set1_ps(static_cast<float>(field.v[2]))};
+    __m128 bottom{_mm_set1_ps(static_cast<float>(field.v[3]))};
+    int write = 0;
+
+    for (int i = 0; i < m_count; i += 4) {
+      __m128 x{_mm_add_ps(_mm_loadu_ps(m_x + i),
+                          _mm_mul_ps(_mm_loadu_ps(m_vx + i), dt))};
+      __m128 y{_mm_add_ps(_mm_loadu_ps(m_y + i),
+                          _mm_mul_ps(_mm_loadu_ps(m_vy + i), dt))};
+      __m128 l{_mm_sub_ps(_mm_loadu_ps(m_life + i), dt)};
+      _mm_storeu_ps(m_x + i, x);
+      _mm_storeu_ps(m_y + i, y);
+      _mm_storeu_ps(m_life + i, l);
+
+      __m128 inside{_mm_and_ps(
+          _mm_and_ps(_mm_cmpge_ps(x, left), _mm_cmplt_ps(x, right)),
+          _mm_and_ps(_mm_cmpge_ps(y, top), _mm_cmplt_ps(y, bottom)))};
+      int alive{_mm_movemask_ps(_mm_and_ps(inside, _mm_cmpgt_ps(l, zero)))};
+      if (i + 4 > m_count)
+        alive &= (1 << (m_count - i)) - 1;
+
+      // Fast path - nothing has moved yet and this block is all alive.
+      if (alive == 0xf && write == i) {
+        write += 4;
+        continue;
+      }
+      for (int lane = 0; lane < 4; ++lane) {
+        if (alive & (1 << lane))
+          move(i + lane, write++);
+      }
+    }
+    m_count = write;
+  }
+
+  // Take out the bullets drawn as |shot| that touch |hero| drawn at |player|,
+  // to the pixel, each going up in sparks. Bullets whose boxes miss the
+  // player's, four at a time, never get to the masks. Returns the hits.
+  int collide(const game::texture &hero, const math::vec8 &player,
+              const game::texture &shot, fx::particles &effects) {
+    int px{game::sprite_left(hero, player)};
+    int py{game::sprite_top(hero, player)};
+    int half_w{shot.bounds.v[game::x_pos] / 2};
+    int half_h{shot.bounds.v[game::y_pos] / 2};
+    // A bullet centred on (x, y) overlaps the player's box when x is within
+    // these (a texel either way, the masks settle it).
+    __m128 left{_mm_set1_ps(static_cast<float>(px - half_w - 1))};
+    __m128 right{_mm_set1_ps(
+        static_cast<float>(px + hero.bounds.v[game::x_pos] + half_w + 1))};
+    __m128 top{_mm_set1_ps(static_cast<float>(py - half_h - 1))};
+    __m128 bottom{_mm_set1_ps(
+        static_cast<float>(py + hero.bounds.v[game::y_pos] + half_h + 1))};
+    int tested{0}, hits{0};
+
+    for (int i = 0; i < m_count; i += 4) {
+      __m128 x{_mm_loadu_ps(m_x + i)}, y{_mm_loadu_ps(m_y + i)};
+      int near{_mm_movemask_ps(_mm_and_ps(
+          _mm_and_ps(_mm_cmpgt_ps(x, left), _mm_cmplt_ps(x, right)),
+          _mm_and_ps(_mm_cmpgt_ps(y, top), _mm_cmplt_ps(y, bottom))))};
+      if (i + 4 > m_count)
+        near &= (1 << (m_count - i)) - 1;
+      for (int lane = 0; near && lane < 4; ++lane) {
+        if (!(near & (1 << lane)))
+          continue;
+        ++tested;
+        int at{i + lane};
+        int sx{static_cast<int>(m_x[at] - half_w)};
+        int sy{static_cast<int>(m_y[at] - half_h)};
+        if (!game::masks_overlap(hero, px, py, shot, sx, sy))
+          continue;
+        effects.emit_burst(m_x[at], m_y[at], 64, 0.1f, 400.0f, 0xffff4020);
+        m_life[at] = 0;
+        ++hits;
+      }
+    }
+    // Hit bullets are dropped by the next update(), until then they're
+    // still drawn like a unit projectile that hit something.
+    profile::count("bullet_pairs", tested);
+    profile::count("bullet_hits", hits);
+    return hits;
+  }
+
+  // Draw every bullet as |shot| onto |fg|, which is |sx| x |sy| pixels per
+  // playfield unit. Returns the number of pixels written.
+  int draw(const game::texture &shot, game::texture &fg, double sx,
+           double sy) const {
+    int written{0};
+    for (int i = 0; i < m_count; ++i)
+      written += game::blit_sprite(shot, fg, m_x[i], m_y[i], sx, sy);
+    return written;
+  }
+
+  void clear() { m_count = 0; }
+
+  int live() const { return m_count; }
+  int capacity() const { return m_capacity; }
+  float x(int i) const { return m_x[i]; }
+  float y(int i) const { return m_y[i]; }
+  float vx(int i) const { return m_vx[i]; }
+  float vy(int i) const { return m_vy[i]; }
+
+  // Bytes save() writes: the count, then every array up to the live
+  // bullets rounded up to whole packets.
+  int state_bytes() const {
+    return static_cast<int>(sizeof(int) + 5 * packets() * sizeof(float));
+  }
+
+  // Write the live bullets to |out|, returning the end of what was written.
+  unsigned char *save(unsigned char *out) const {
+    memcpy(out, &m_count, sizeof(int));
+    out += sizeof(int);
+    const float *arrays[] = {m_x, m_y, m_vx, m_vy, m_life};
+    size_t bytes{packets() * sizeof(float)};
+    for (int i = 0; i < 5; ++i, out += bytes)
+      memcpy(out, arrays[i], bytes);
+    return out;
+  }
+
+  // Put back what save() wrote, returning the end of it.
+  const unsigned char *load(const unsigned char *in) {
+    int count;
+    memcpy(&count, in, sizeof(int));
+    in += sizeof(int);
+    m_count = count < m_capacity ? count : m_capacity;
+    float *arrays[] = {m_x, m_y, m_vx, m_vy, m_life};
+    size_t saved{static_cast<size_t>((count + 3) & ~3) * sizeof(float)};
+    size_t bytes{packets() * sizeof(float)};
+    for (int i = 0; i < 5; ++i, in += saved)
+      memcpy(arrays[i], in, bytes);
+    return in;
+  }
+
+protected:
+  // Live bullets rounded up to the 4 wide packets update() works in.
+  int packets() const { return (m_count + 3) & ~3; }
+
+  // One field array, 16 byte aligned and padded by a packet.
+  float *floats(util::mem_pool &pool) {
+    unsigned char *raw{pool.alloc((m_capacity + 4) * sizeof(float) + 16)};
+    if (!raw)
+      return nullptr;
+    size_t addr{(reinterpret_cast<size_t>(raw) + 15) & ~static_cast<size_t>(15)};
+    float *out{reinterpret_cast<float *>(addr)};
+    for (int i = 0; i < m_capacity + 4; ++i)
+      out[i] = 0.0f;
+    return out;
+  }
+
+  void move(int from, int to) {
+    if (from == to)
+      return;
+    m_x[to] = m_x[from];
+    m_y[to] = m_y[from];
+    m_vx[to] = m_vx[from];
+    m_vy[to] = m_vy[from];
+    m_life[to] = m_life[from];
+  }
+
+  float *m_x;
+  float *m_y;
+  float *m_vx;
+  float *m_vy;
+  float *m_life;
+  int m_count;
+  int m_capacity;
+
+private:
+  bullets(const bullets &);
+  bullets &operator=(const bullets &);
+};
+
+// Patterns compiled for firing: per pattern a slice of the bullet rows,
+// plus what's needed once per volley.
+class table {
+public:
+  table() {}
+
+  // Compile |patterns|, replacing whatever was compiled before. Each gets
+  // its bullets' directions (relative to the heading) and speeds, in rows
+  // padded to a whole packet so volleys never read another pattern's rows.
+  void compile(const std::vector<spec> &patterns) {
+    m_patterns.clear();
+    m_dx.clear();
+    m_dy.clear();
+    m_speed.clear();
+    m_names.clear();
+    const float radians = 3.14159265f / 180.0f;
+    for (size_t p = 0; p < patterns.size(); ++p) {
+      const spec &s = patterns[p];
+      entry e;
+      e.first = static_cast<int>(m_dx.size());
+      e.count = s.count;
+      e.spin = s.spin * radians;
+      e.life = s.life;
+      e.reload = s.reload;
+      e.aimed = s.aimed;
+      m_patterns.push_back(e);
+      m_names.push_back(s.name);
+
+      // A full circle spaces the bullets round it, anything less runs from
+      // one edge of the arc to the other.
+      bool ring{s.arc >= 360.0f};
+      float step{ring ? s.arc / s.count
+                      : (s.count > 1 ? s.arc / (s.count - 1) : 0.0f)};
+      float from{ring ? 0.0f : -s.arc * 0.5f};
+      int padded{(s.count + 3) & ~3};
+      for (int i = 0; i < padded; ++i) {
+        float angle{(from + step * i) * radians};
+        bool used{i < s.count};
+        m_dx.push_back(used ? cos(angle) : 0.0f);
+        m_dy.push_back(used ? sin(angle) : 0.0f);
+        m_speed.push_back(used ? s.speed + s.accel * i : 0.0f);
+      }
+    }
+  }
+
+  int size() const { return static_cast<int>(m_patterns.size()); }
+  const char *name(int p) const { return m_names[p].c_str(); }
+  int count(int p) const { return m_patterns[p].count; }
+  float reload(int p) const { return m_patterns[p].reload; }
+  // Bullets in every pattern's rows, padding included.
+  int rows() const { return static_cast<int>(m_dx.size()); }
+
+  // FNV-1a over everything compiled, 0 with nothing compiled. Two tables
+  // with the same fingerprint fire the same volleys.
+  unsigned int fingerprint() const {
+    if (m_patterns.empty())
+      return 0;
+    unsigned int hash{2166136261u};
+    for (size_t p = 0; p < m_patterns.size(); ++p) {
+      const entry &e = m_patterns[p];
+      const float values[] = {e.spin, e.life, e.reload};
+      hash = fnv(&e.count, sizeof(e.count), hash);
+      hash = fnv(values, sizeof(values), hash);
+      hash = fnv(&e.aimed, sizeof(e.aimed), hash);
+    }
+    hash = fnv(&m_dx[0], m_dx.size() * sizeof(float), hash);
+    hash = fnv(&m_dy[0], m_dy.size() * sizeof(float), hash);
+    return fnv(&m_speed[0], m_speed.size() * sizeof(float), hash);
+  }
+
+  // Fire volley number |volley| of pattern |p| from (x, y), at (tx, ty) if
+  // it's aimed, into |out|. Returns the bullets that fit.
+  int fire(int p, float x, float y, float tx, float ty, int volley,
+           bullets &out) const {
+    const entry &e = m_patterns[p];
+    // Down the field is towards lower y.
+    float heading{e.aimed ? static_cast<float>(atan2(ty - y, tx - x))
+                          : -1.5707963f};
+    heading += e.spin * volley;
+    return out.emit(x, y, cos(heading), sin(heading), &m_dx[e.first],
+                    &m_dy[e.first], &m_speed[e.first], e.count, e.life);
+  }
+
+protected:
+  static unsigned int fnv(const void *data, size_t bytes, unsigned int hash) {
+    const unsigned char *in = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < bytes; ++i) {
+      hash ^= in[i];
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  struct entry {
+    int first; // Row of the first bullet.
+    int count;
+    float spin; // Radians a volley.
+    float life;
+    float reload;
+    bool aimed;
+  };
+
+  std::vector<entry> m_patterns;
+  std::vector<std::string> m_names;
+  std::vector<float> m_dx, m_dy, m_speed; // Rows, every pattern's in turn.
+
+private:
+  table(const table &);
+  table &operator=(const table &);
+};
+
+// Let every enemy that is due fire a volley of its pattern at the player,
+// the n-th enemy firing pattern n (round the table). The enemy's cooldown
+// field counts its volleys, which is what turns a spiral.
+inline int fire_patterns(std::vector<math::vec8> &units, const table &patterns,
+                         bullets &out, double fps) {
+  if (!patterns.size())
+    return 0;
+  const math::vec8 &player = units[units.size() - 1];
+  float tx{static_cast<float>(player.v[game::x_pos])};
+  float ty{static_cast<float>(player.v[game::y_pos])};
+  int enemy{0}, fired{0};
+  for (auto &u : units) {
+    if (u.v[game::type] != game::ENEMY)
+      continue;
+    int p{enemy++ % patterns.size()};
+    if (u.v[game::firing_rate] > 0 || u.v[game::life] == 0)
+      continue;
+    fired += patterns.fire(p, static_cast<float>(u.v[game::x_pos]),
+                           static_cast<float>(u.v[game::y_pos]), tx, ty,
+                           static_cast<int>(u.v[game::cooldown]), out);
+    u.v[game::cooldown] += 1;
+    // Counts down at the rate handle_enemy_movement() takes it down.
+    u.v[game::firing_rate] =
+        math::compute_units(200.0, patterns.reload(p), fps);
+  }
+  profile::count("bullets_fired", fired);
+  return fired;
+}
+
+} // namespace pattern
+
+#endif // _PATTERNS_HPP
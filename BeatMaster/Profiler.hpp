@@ -0,0 +1,260 @@
+#ifndef _PROFILER_HPP
+#define _PROFILER_HPP
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdio>
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Lightweight frame instrumentation. Every thread that records events gets its
+// own ring buffer, so recording never takes a lock - the owning thread is the
+// only writer and publishes its head index with a release store. Rings are
+// read back and written out as Chrome trace-event JSON (load the file in
+// chrome://tracing) once recording is finished.
+namespace profile {
+
+typedef long long ticks;
+
+enum EventKinds { SPAN, COUNTER };
+
+// A single trace record. Names must be string literals (or otherwise outlive
+// the export), we only keep the pointer.
+struct event {
+  const char *name;
+  ticks start;
+  ticks duration; // Only meaningful for spans.
+  double value;   // Only meaningful for counters.
+  int kind;
+};
+
+// Single producer ring. Once full, the oldest events are overwritten.
+struct ring {
+  static const unsigned int capacity = 1 << 16;
+  event events[capacity];
+  std::atomic<unsigned int> head;
+  int thread_id;
+  const char *thread_name;
+
+  ring(int id) : thread_id(id), thread_name(nullptr) { head.store(0); }
+
+  void push(const event &e) {
+    unsigned int h{head.load(std::memory_order_relaxed)};
+    events[h & (capacity - 1)] = e;
+    head.store(h + 1, std::memory_order_release);
+  }
+};
+
+static const int max_threads = 32;
+
+// Recording is off until someone asks for a trace; the cost of a disabled
+// scope is then a single branch.
+bool g_enabled = false;
+const char *g_trace_file = nullptr;
+ring *g_rings[max_threads];
+std::atomic<int> g_ring_count(0);
+__declspec(thread) ring *t_ring = nullptr;
+
+// What t_ring holds on a thread that found every ring taken, so it only asks
+// for one once. Only ever compared against, never dereferenced.
+char g_no_ring;
+ring *const no_ring = reinterpret_cast<ring *>(&g_no_ring);
+
+// QueryPerformanceCounter instead of std::chrono - the VS2013
+// high_resolution_clock only ticks once per system timer interrupt.
+inline ticks now() {
+  LARGE_INTEGER t;
+  QueryPerformanceCounter(&t);
+  return t.QuadPart;
+}
+
+inline ticks query_frequency() {
+  LARGE_INTEGER f;
+  QueryPerformanceFrequency(&f);
+  return f.QuadPart;
+}
+
+// Read once at startup rather than on first use, so threads timing stages
+// concurrently never race to fill it in.
+const ticks g_frequency = query_frequency();
+
+inline ticks frequency() { return g_frequency; }
+
+inline double to_micros(ticks t) {
+  return static_cast<double>(t) * 1000000.0 / static_cast<double>(frequency());
+}
+
+inline double to_millis(ticks t) {
+  return static_cast<double>(t) * 1000.0 / static_cast<double>(frequency());
+}
+
+// Turn on recording and choose where the trace ends up.
+void enable(const char *trace_file) {
+  g_trace_file = trace_file;
+  g_enabled = true;
+}
+
+// Fetch (or lazily create) the ring that belongs to the calling thread. The
+// allocation only happens on the first event a thread records.
+ring *thread_ring() {
+  if (t_ring)
+    return t_ring != no_ring ? t_ring : nullptr;
+
+  int id{g_ring_count.fetch_add(1)};
+  if (id >= max_threads) {
+    t_ring = no_ring; // Out of slots, this thread goes unrecorded.
+    return nullptr;
+  }
+
+  t_ring = new ring(id + 1);
+  g_rings[id] = t_ring;
+  return t_ring;
+}
+
+// Label the calling thread in the exported trace.
+void name_thread(const char *name) {
+  if (!g_enabled)
+    return;
+  if (ring *r = thread_ring())
+    r->thread_name = name;
+}
+
+inline void record_span(const char *name, ticks start, ticks end) {
+  if (ring *r = thread_ring()) {
+    event e = {name, start, end - start, 0.0, SPAN};
+    r->push(e);
+  }
+}
+
+// Record a sampled value, e.g. units updated or pool bytes in use.
+inline void count(const char *name, double value) {
+  if (!g_enabled)
+    return;
+  if (ring *r = thread_ring()) {
+    event e = {name, now(), 0, value, COUNTER};
+    r->push(e);
+  }
+}
+
+// Times the enclosing scope.
+class scoped_timer {
+public:
+  scoped_timer(const char *name) : m_name(name), m_start(0) {
+    if (g_enabled)
+      m_start = now();
+  }
+
+  ~scoped_timer() {
+    if (g_enabled && m_start)
+      record_span(m_name, m_start, now());
+  }
+
+protected:
+  const char *m_name;
+  ticks m_start;
+
+private:
+  scoped_timer(const scoped_timer &);
+  scoped_timer &operator=(const scoped_timer &);
+};
+
+// Like scoped_timer, but the elapsed time (in milliseconds) is also written to
+// |slot| on every run, whether or not a trace is being recorded. Used for the
+// frame stages whose latest timings the game itself looks at.
+class stage_timer {
+public:
+  stage_timer(const char *name, double &slot)
+      : m_name(name), m_slot(slot), m_start(now()) {}
+
+  ~stage_timer() {
+    ticks end{now()};
+    m_slot = to_millis(end - m_start);
+    if (g_enabled)
+      record_span(m_name, m_start, end);
+  }
+
+protected:
+  const char *m_name;
+  double &m_slot;
+  ticks m_start;
+
+private:
+  stage_timer(const stage_timer &);
+  stage_timer &operator=(const stage_timer &);
+};
+
+// Write every recorded event to |file| as Chrome trace-event JSON. This reads
+// the rings without synchronizing with their writers, so only call it once the
+// recording threads have stopped (or accept a torn last few events).
+bool export_chrome_trace(const char *file) {
+  FILE *out(0);
+  if (!file || fopen_s(&out, file, "wb") != 0)
+    return false;
+
+  ticks origin{0};
+  int count{g_ring_count.load()};
+  if (count > max_threads)
+    count = max_threads;
+
+  // Timestamps are written relative to the earliest event we still hold.
+  for (int i = 0; i < count; ++i) {
+    ring *r{g_rings[i]};
+    unsigned int head{r->head.load(std::memory_order_acquire)};
+    unsigned int first{head > ring::capacity ? head - ring::capacity : 0};
+    if (head != first) {
+      ticks start{r->events[first & (ring::capacity - 1)].start};
+      if (!origin || start < origin)
+        origin = start;
+    }
+  }
+
+  fprintf(out, "{\"traceEvents\":[\n");
+  bool separator{false};
+  for (int i = 0; i < count; ++i) {
+    ring *r{g_rings[i]};
+    if (r->thread_name) {
+      fprintf(out,
+              "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+              "\"args\":{\"name\":\"%s\"}}",
+              separator ? ",\n" : "", r->thread_id, r->thread_name);
+      separator = true;
+    }
+
+    unsigned int head{r->head.load(std::memory_order_acquire)};
+    unsigned int first{head > ring::capacity ? head - ring::capacity : 0};
+    for (unsigned int j = first; j != head; ++j) {
+      const event &e{r->events[j & (ring::capacity - 1)]};
+      double ts{to_micros(e.start - origin)};
+      if (e.kind == SPAN)
+        fprintf(out,
+                "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                separator ? ",\n" : "", e.name, ts, to_micros(e.duration),
+                r->thread_id);
+      else
+        fprintf(out,
+                "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"value\":%.3f}}",
+                separator ? ",\n" : "", e.name, ts, r->thread_id, e.value);
+      separator = true;
+    }
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  return true;
+}
+
+} // namespace profile
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Time the rest of the enclosing scope under |name|.
+#define PROFILE_SCOPE(name)                                                    \
+  profile::scoped_timer PROFILE_CONCAT(_profile_scope_, __LINE__)(name)
+
+// Time the rest of the enclosing scope under |name| and store it in |slot|.
+#define PROFILE_STAGE(name, slot)                                              \
+  profile::stage_timer PROFILE_CONCAT(_profile_stage_, __LINE__)(name, slot)
+
+#endif // _PROFILER_HPP
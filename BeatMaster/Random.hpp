@@ -0,0 +1,210 @@
+#ifndef _RANDOM_HPP
+#define _RANDOM_HPP
+#pragma once
+
+#include <emmintrin.h>
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Self-contained gameplay random numbers. Unlike rand(), every stream carries
+// its own state, so a session can be replayed exactly from its seed and
+// separate systems (or worker threads) never share hidden state.
+namespace rng {
+
+typedef unsigned int uint32;
+typedef unsigned long long uint64;
+
+// SplitMix64 - only used to expand a seed into a full generator state.
+inline uint64 splitmix64(uint64 &x) {
+  uint64 z = (x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+inline uint32 rotl(uint32 x, int k) { return (x << k) | (x >> (32 - k)); }
+
+// 24 random bits mapped onto [0, 1).
+inline float to_unit(uint32 x) {
+  return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// xoshiro128** - 32 bit state words keep it cheap on our Win32 builds, where a
+// 64 bit multiply (as PCG needs) is a library call.
+struct stream {
+  uint32 s[4];
+
+  stream() { seed(0); }
+  stream(uint64 value) { seed(value); }
+
+  void seed(uint64 value) {
+    uint64 a{splitmix64(value)};
+    uint64 b{splitmix64(value)};
+    s[0] = static_cast<uint32>(a);
+    s[1] = static_cast<uint32>(a >> 32);
+    s[2] = static_cast<uint32>(b);
+    s[3] = static_cast<uint32>(b >> 32);
+  }
+
+  uint32 next() {
+    uint32 result{rotl(s[1] * 5, 7) * 9};
+    uint32 t{s[1] << 9};
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 11);
+    return result;
+  }
+
+  // Integer in [0, bound) without the modulo bias of rand() % bound. Lemire's
+  // multiply-shift; the division only runs on the rare rejection path.
+  int range(int bound) {
+    if (bound <= 0)
+      return 0;
+    uint32 b{static_cast<uint32>(bound)};
+    uint64 m{static_cast<uint64>(next()) * b};
+    uint32 low{static_cast<uint32>(m)};
+    if (low < b) {
+      uint32 threshold{(0u - b) % b};
+      while (low < threshold) {
+        m = static_cast<uint64>(next()) * b;
+        low = static_cast<uint32>(m);
+      }
+    }
+    return static_cast<int>(m >> 32);
+  }
+
+  // Float in [0, 1).
+  float uniform() { return to_unit(next()); }
+
+  // Float in [lo, hi).
+  float uniform(float lo, float hi) { return lo + uniform() * (hi - lo); }
+
+  // Advance the stream by 2^64 draws. Streams that are a jump apart never
+  // overlap in practice, which is what split() relies on.
+  void jump() {
+    static const uint32 table[] = {0x8764000b, 0xf542d2d3, 0x6fa035c3,
+                                   0x77f2db5b};
+    uint32 t[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; ++i) {
+      for (int b = 0; b < 32; ++b) {
+        if (table[i] & (1u << b)) {
+          t[0] ^= s[0];
+          t[1] ^= s[1];
+          t[2] ^= s[2];
+          t[3] ^= s[3];
+        }
+        next();
+      }
+    }
+    s[0] = t[0];
+    s[1] = t[1];
+    s[2] = t[2];
+    s[3] = t[3];
+  }
+
+  // Hand out an independent child stream and move this one past it. Splitting
+  // in the same order always yields the same children, so a system (or worker)
+  // can own its stream and still be reproducible.
+  stream split() {
+    stream child(*this);
+    jump();
+    return child;
+  }
+
+  // Scalar batch helpers, see batch_stream for the vectorized versions.
+  void fill(float *out, int count, float lo, float hi) {
+    for (int i = 0; i < count; ++i)
+      out[i] = uniform(lo, hi);
+  }
+
+  void fill(int *out, int count, int bound) {
+    for (int i = 0; i < count; ++i)
+      out[i] = range(bound);
+  }
+};
+
+// Four xoshiro128** lanes stepped together with SSE2, for filling arrays in
+// bulk. Lane i starts where split() number i of the source stream would, so
+// the output only depends on that stream's state. SSE2 has no 32 bit lane
+// multiply; the generator's * 5 and * 9 are done as shift-and-add instead.
+class batch_stream {
+public:
+  batch_stream(stream &source) {
+    stream lanes[4];
+    for (int i = 0; i < 4; ++i)
+      lanes[i] = source.split();
+    for (int k = 0; k < 4; ++k)
+      m_s[k] = _mm_set_epi32(lanes[3].s[k], lanes[2].s[k], lanes[1].s[k],
+                             lanes[0].s[k]);
+  }
+
+  __m128i next() {
+    __m128i s1{m_s[1]};
+    __m128i x5{_mm_add_epi32(_mm_slli_epi32(s1, 2), s1)};
+    __m128i r{_mm_or_si128(_mm_slli_epi32(x5, 7), _mm_srli_epi32(x5, 25))};
+    __m128i result{_mm_add_epi32(_mm_slli_epi32(r, 3), r)};
+
+    __m128i t{_mm_slli_epi32(s1, 9)};
+    m_s[2] = _mm_xor_si128(m_s[2], m_s[0]);
+    m_s[3] = _mm_xor_si128(m_s[3], m_s[1]);
+    m_s[1] = _mm_xor_si128(m_s[1], m_s[2]);
+    m_s[0] = _mm_xor_si128(m_s[0], m_s[3]);
+    m_s[2] = _mm_xor_si128(m_s[2], t);
+    m_s[3] =
+        _mm_or_si128(_mm_slli_epi32(m_s[3], 11), _mm_srli_epi32(m_s[3], 21));
+    return result;
+  }
+
+  // Four floats in [0, 1).
+  __m128 uniform() {
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(next(), 8)),
+                      _mm_set1_ps(1.0f / 16777216.0f));
+  }
+
+  // Fill |out| with floats in [lo, hi).
+  void fill(float *out, int count, float lo, float hi) {
+    __m128 base{_mm_set1_ps(lo)};
+    __m128 scale{_mm_set1_ps(hi - lo)};
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+      _mm_storeu_ps(out + i, _mm_add_ps(base, _mm_mul_ps(uniform(), scale)));
+    if (i < count) {
+      float tail[4];
+      _mm_storeu_ps(tail, _mm_add_ps(base, _mm_mul_ps(uniform(), scale)));
+      for (int j = 0; i < count; ++i, ++j)
+        out[i] = tail[j];
+    }
+  }
+
+  // Fill |out| with integers in [0, bound). Scales 24 random bits, so the
+  // bias is at most bound / 2^24 - fine for screen positions and timers,
+  // use stream::range() where that matters.
+  void fill(int *out, int count, int bound) {
+    __m128 scale{_mm_set1_ps(static_cast<float>(bound))};
+    __m128i top{_mm_set1_epi32(bound > 0 ? bound - 1 : 0)};
+    int i = 0;
+    for (; i < count; i += 4) {
+      __m128i v{_mm_cvttps_epi32(_mm_mul_ps(uniform(), scale))};
+      // Guard the rounding edge case where u * bound lands on bound.
+      __m128i over{_mm_cmpgt_epi32(v, top)};
+      v = _mm_or_si128(_mm_andnot_si128(over, v), _mm_and_si128(over, top));
+      if (i + 4 <= count) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), v);
+      } else {
+        int tail[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(tail), v);
+        for (int j = 0; i + j < count; ++j)
+          out[i + j] = tail[j];
+      }
+    }
+  }
+
+protected:
+  __m128i m_s[4];
+};
+
+} // namespace rng
+
+#endif // _RANDOM_HPP
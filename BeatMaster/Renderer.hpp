@@ -17,23 +17,34 @@
 #include <vector>
 #include <iostream>
 #include <omp.h>
+#include "Input.hpp"
 #include "util.hpp"
 
-#define _WIDTH 640
-#define _HEIGHT 480
-#define _WW (1024)
-#define _WH (768)
 #define _BPP 32
 
 
 namespace detail {
 
+// Sizes picked at startup. The surface is what the game renders into, the
+// window is what that surface gets stretched onto.
+struct RendererConfig {
+  int width;
+  int height;
+  int window_width;
+  int window_height;
+  int pool_bytes; // Memory for the game, on top of the surface's buffers.
+
+  RendererConfig()
+      : width(640), height(480), window_width(1024), window_height(768),
+        pool_bytes(8 * 1048576) {}
+};
+
 class IBitmapRenderer {
 public:
   virtual ~IBitmapRenderer() {}
   virtual void RenderToBitmap(HDC screenDC, int w, int h) = 0;
   virtual void HandleOutput(VOID *output) = 0;
-  virtual void HandleDirection(int direction) = 0;
+  virtual void HandleKey(unsigned int key, bool pressed) = 0;
 };
 
 class RendererThread {
@@ -73,12 +84,16 @@ protected:
 typedef unsigned int Uint32;
 
 class RendererSurface {
-  static const int megabyte = 1048576;
+  static const int pool_slack = 4096; // Allocation headers and alignment.
 
 public:
-  RendererSurface(int w, int h, int bpp, IBitmapRenderer *renderer)
-      : m_w(w), m_h(h), m_bpp(bpp), m_bitmapRenderer(renderer),
-        mem_source(10 * megabyte) {
+  RendererSurface(const RendererConfig &config, int bpp,
+                  IBitmapRenderer *renderer)
+      : m_w(config.width), m_h(config.height), m_bpp(bpp),
+        m_windowW(config.window_width), m_windowH(config.window_height),
+        m_bitmapRenderer(renderer),
+        mem_source(2 * config.width * config.height * (bpp / 8) +
+                   config.pool_bytes + pool_slack) {
     m_pixels = mem_source.alloc(m_w * m_h * (m_bpp / 8));
     m_backBuffer = mem_source.alloc(m_w * m_h * (m_bpp / 8));
   }
@@ -98,9 +113,9 @@ public:
     m_dc = memDC;
   }
 
-  void SetDirection(int direction) {
+  void PostKey(unsigned int key, bool pressed) {
     if (m_bitmapRenderer)
-      m_bitmapRenderer->HandleDirection(direction);
+      m_bitmapRenderer->HandleKey(key, pressed);
   }
 
   void Flip(bool clear = false) {
@@ -116,7 +131,8 @@ public:
       m_bitmapRenderer->RenderToBitmap(m_dc, m_w, m_h);
 
     // BitBlt(m_screenDC, 0, 0, m_w, m_h, m_dc, 0, 0, SRCCOPY);
-    StretchBlt(m_screenDC, 0, 0, _WW, _WH, m_dc, 0, 0, m_w, m_h, SRCCOPY);
+    StretchBlt(m_screenDC, 0, 0, m_windowW, m_windowH, m_dc, 0, 0, m_w, m_h,
+               SRCCOPY);
 
     if (clear)
       util::memset(m_backBuffer, 0, (m_w * m_h));
@@ -130,6 +146,10 @@ public:
 
   int GetHeight() const { return m_h; }
 
+  int GetWindowWidth() const { return m_windowW; }
+
+  int GetWindowHeight() const { return m_windowH; }
+
   IBitmapRenderer *GetRenderer() const { return m_bitmapRenderer; }
 
   util::mem_pool &GetAllocator() { return mem_source; }
@@ -141,6 +161,8 @@ protected:
   int m_w;
   int m_h;
   int m_bpp;
+  int m_windowW;
+  int m_windowH;
   HDC m_screenDC;
   HDC m_dc;
   IBitmapRenderer *m_bitmapRenderer;
@@ -162,11 +184,12 @@ public:
     updateThread.Start(static_cast<LPVOID>(this));
     SetRunning(true);
   }
-  void SetDirection(int direction) { screen.SetDirection(direction); }
+  void PostKey(unsigned int key, bool pressed) { screen.PostKey(key, pressed); }
 
 public:
   Renderer(const char *const className, LPTHREAD_START_ROUTINE callback,
-           detail::IBitmapRenderer *renderer);
+           detail::IBitmapRenderer *renderer,
+           const detail::RendererConfig &config = detail::RendererConfig());
 
   ~Renderer() {
     updateThread.Join();
@@ -189,19 +212,19 @@ void HandleKey(WPARAM wp, bool pressed) {
     break;
   case VK_LEFT:
     if (g_renderer)
-      g_renderer->SetDirection(pressed ? 0 : -1);
+      g_renderer->PostKey(input::KEY_LEFT, pressed);
     break;
   case VK_UP:
     if (g_renderer)
-      g_renderer->SetDirection(pressed ? 1 : -1);
+      g_renderer->PostKey(input::KEY_UP, pressed);
     break;
   case VK_RIGHT:
     if (g_renderer)
-      g_renderer->SetDirection(pressed ? 2 : -1);
+      g_renderer->PostKey(input::KEY_RIGHT, pressed);
     break;
   case VK_DOWN:
     if (g_renderer)
-      g_renderer->SetDirection(pressed ? 3 : -1);
+      g_renderer->PostKey(input::KEY_DOWN, pressed);
     break;
   default:
     break;
@@ -215,7 +238,9 @@ long __stdcall WindowProcedure(HWND window, unsigned int msg, WPARAM wp,
     PostQuitMessage(0);
     return 0L;
   case WM_KEYDOWN:
-    HandleKey(wp, true);
+    // Bit 30 is set for auto-repeat, the key is already down.
+    if (!(lp & (1 << 30)))
+      HandleKey(wp, true);
     return 0L;
   case WM_KEYUP:
     HandleKey(wp, false);
@@ -240,8 +265,13 @@ BOOL CALLBACK MonitorEnumProc(HMONITOR hMonitor, HDC hdcMonitor,
 
 // Implementation of the renderer functions.
 Renderer::Renderer(const char *const className, LPTHREAD_START_ROUTINE callback,
-                   detail::IBitmapRenderer *renderer)
-    : screen(_WIDTH, _HEIGHT, _BPP, renderer), updateThread(callback) {
+                   detail::IBitmapRenderer *renderer,
+                   const detail::RendererConfig &config)
+    : screen(config, _BPP, renderer), updateThread(callback) {
+  const int width = config.width;
+  const int height = config.height;
+  const int windowW = config.window_width;
+  const int windowH = config.window_height;
   forward::g_renderer = this;
 
   HDC windowDC;
@@ -254,7 +284,7 @@ Renderer::Renderer(const char *const className, LPTHREAD_START_ROUTINE callback,
   if (RegisterClassEx(&wndclass)) {
     HWND window = 0;
     {
-      RECT displayRC = {0, 0, _WIDTH, _HEIGHT};
+      RECT displayRC = {0, 0, width, height};
       // Get info on which monitor we want to use.
 
       std::vector<RECT> monitors;
@@ -267,18 +297,18 @@ Renderer::Renderer(const char *const className, LPTHREAD_START_ROUTINE callback,
 
       // Now we want to center the window in the display rect.
       int x = displayRC.left +
-              (((displayRC.right - displayRC.left) / 2) - (_WW / 2));
+              (((displayRC.right - displayRC.left) / 2) - (windowW / 2));
       int y = displayRC.top +
-              (((displayRC.bottom - displayRC.top) / 2) - (_WH / 2));
+              (((displayRC.bottom - displayRC.top) / 2) - (windowH / 2));
 
       displayRC.left = x;
       displayRC.top = y;
-      displayRC.right = displayRC.left + _WW;
-      displayRC.bottom = displayRC.top + _WH;
+      displayRC.right = displayRC.left + windowW;
+      displayRC.bottom = displayRC.top + windowH;
 
       window = CreateWindowEx(0, className, "Utility Renderer", WS_POPUPWINDOW,
-                              displayRC.left, displayRC.top, _WW, _WH, 0, 0,
-                              GetModuleHandle(0), 0);
+                              displayRC.left, displayRC.top, windowW, windowH,
+                              0, 0, GetModuleHandle(0), 0);
     }
     if (window) {
 
@@ -296,12 +326,12 @@ Renderer::Renderer(const char *const className, LPTHREAD_START_ROUTINE callback,
       ZeroMemory(&bf, sizeof(BITMAPINFO));
 
       bf.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-      bf.bmiHeader.biWidth = _WIDTH;
-      bf.bmiHeader.biHeight = _HEIGHT;
+      bf.bmiHeader.biWidth = width;
+      bf.bmiHeader.biHeight = height;
       bf.bmiHeader.biPlanes = 1;
       bf.bmiHeader.biBitCount = _BPP;
       bf.bmiHeader.biCompression = BI_RGB;
-      bf.bmiHeader.biSizeImage = (_WIDTH * _HEIGHT * (_BPP / 8));
+      bf.bmiHeader.biSizeImage = (width * height * (_BPP / 8));
       bf.bmiHeader.biXPelsPerMeter = -1;
       bf.bmiHeader.biYPelsPerMeter = -1;
 
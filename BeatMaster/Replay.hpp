@@ -0,0 +1,273 @@
+#ifndef _REPLAY_HPP
+#define _REPLAY_HPP
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include "Alloc.hpp"
+#include "Session.hpp"
+#include "Share.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Input recording and headless playback. A log holds the session seed, the
+// settings that change what the session simulates and, for every frame, the
+// exact inputs game::session::step() consumed. Playing it back with the same
+// settings reproduces the recorded game bit for bit, which makes it a stable
+// workload for comparing frame times between builds.
+//
+// Log layout (little endian):
+//   4 bytes magic "BMRP", 4 bytes version, 8 bytes seed,
+//   4 bytes output width, 4 bytes output height, 4 bytes setting flags,
+//   4 bytes playfield width, 4 bytes playfield height,
+//   4 bytes pattern::table::fingerprint(),
+//   then per frame: 8 bytes millis (double), 2 bytes fps, 1 byte key mask.
+namespace replay {
+
+static const unsigned int magic = 0x50524d42; // "BMRP"
+static const unsigned int version = 3;
+
+// Bits of header::flags.
+enum Flags {
+  FLAG_ANIMATE_LIGHT = 1 << 0,
+  FLAG_COMPACT_TEXTURES = 1 << 1,
+  FLAG_BULLET_PATTERNS = 1 << 2
+};
+
+// Everything a log records besides its frames.
+struct header {
+  rng::uint64 seed;
+  int width, height; // Output size.
+  unsigned int flags;
+  int field_width, field_height; // game::settings width and height.
+  unsigned int patterns;         // Fingerprint of the patterns fired.
+};
+
+// The header for a log of |world|, played with |seed| at width x height.
+inline header describe(const game::session &world, rng::uint64 seed,
+                       int width, int height) {
+  const game::settings &o = world.config;
+  header h = {seed, width, height, 0, o.width, o.height,
+              world.patterns.fingerprint()};
+  h.flags |= o.animate_light ? FLAG_ANIMATE_LIGHT : 0;
+  h.flags |= o.compact_textures ? FLAG_COMPACT_TEXTURES : 0;
+  h.flags |= o.bullet_patterns ? FLAG_BULLET_PATTERNS : 0;
+  return h;
+}
+
+// True if a log recorded as |log| plays back the same as |now|, otherwise
+// says what differs.
+inline bool compatible(const header &log, const header &now) {
+  static const char *const flag_names[] = {
+      "--animate-light", "--compact-textures", "--patterns"};
+  bool same{true};
+  for (int i = 0; i < 3; ++i) {
+    if ((log.flags ^ now.flags) & (1u << i)) {
+      std::cout << "The replay log was recorded "
+                << (log.flags & (1u << i) ? "with " : "without ")
+                << flag_names[i] << std::endl;
+      same = false;
+    }
+  }
+  if (log.field_width != now.field_width ||
+      log.field_height != now.field_height) {
+    std::cout << "The replay log was recorded with --resolution "
+              << log.field_width << "x" << log.field_height << std::endl;
+    same = false;
+  }
+  if (same && log.patterns != now.patterns) {
+    std::cout << "The replay log was recorded with other patterns."
+              << std::endl;
+    same = false;
+  }
+  return same;
+}
+
+struct frame {
+  double millis;
+  unsigned short fps;
+  unsigned char keys;
+};
+
+class recorder {
+public:
+  recorder() : m_file(nullptr), m_frames(0) {}
+  ~recorder() { close(); }
+
+  bool open(const char *file, const header &h) {
+    close();
+    if (fopen_s(&m_file, file, "wb") != 0) {
+      std::cout << "Could not open replay log " << file << std::endl;
+      m_file = nullptr;
+      return false;
+    }
+    fwrite(&magic, sizeof(magic), 1, m_file);
+    fwrite(&version, sizeof(version), 1, m_file);
+    fwrite(&h.seed, sizeof(h.seed), 1, m_file);
+    fwrite(&h.width, sizeof(h.width), 1, m_file);
+    fwrite(&h.height, sizeof(h.height), 1, m_file);
+    fwrite(&h.flags, sizeof(h.flags), 1, m_file);
+    fwrite(&h.field_width, sizeof(h.field_width), 1, m_file);
+    fwrite(&h.field_height, sizeof(h.field_height), 1, m_file);
+    fwrite(&h.patterns, sizeof(h.patterns), 1, m_file);
+    return true;
+  }
+
+  // Append the inputs of one frame - stdio buffers these for us.
+  void record(unsigned int keys, double millis, double fps) {
+    if (!m_file)
+      return;
+    unsigned short f{static_cast<unsigned short>(fps)};
+    unsigned char k{static_cast<unsigned char>(keys)};
+    fwrite(&millis, sizeof(millis), 1, m_file);
+    fwrite(&f, sizeof(f), 1, m_file);
+    fwrite(&k, sizeof(k), 1, m_file);
+    ++m_frames;
+  }
+
+  void close() {
+    if (!m_file)
+      return;
+    fclose(m_file);
+    m_file = nullptr;
+    std::cout << "Recorded " << m_frames << " frames." << std::endl;
+  }
+
+  bool recording() const { return m_file != nullptr; }
+
+protected:
+  FILE *m_file;
+  int m_frames;
+
+private:
+  recorder(const recorder &);
+  recorder &operator=(const recorder &);
+};
+
+// Read a whole log into memory so playback never touches the disk.
+bool load(const char *file, header &h, std::vector<frame> &frames) {
+  FILE *input(0);
+  if (fopen_s(&input, file, "rb") != 0) {
+    std::cout << "Could not open replay log " << file << std::endl;
+    return false;
+  }
+
+  unsigned int m{0}, v{0};
+  fread(&m, sizeof(m), 1, input);
+  fread(&v, sizeof(v), 1, input);
+  if (m != magic || v != version) {
+    std::cout << "Not a replay log (or wrong version) " << file << std::endl;
+    fclose(input);
+    return false;
+  }
+  header read;
+  if (fread(&read.seed, sizeof(read.seed), 1, input) != 1 ||
+      fread(&read.width, sizeof(read.width), 1, input) != 1 ||
+      fread(&read.height, sizeof(read.height), 1, input) != 1 ||
+      fread(&read.flags, sizeof(read.flags), 1, input) != 1 ||
+      fread(&read.field_width, sizeof(read.field_width), 1, input) != 1 ||
+      fread(&read.field_height, sizeof(read.field_height), 1, input) != 1 ||
+      fread(&read.patterns, sizeof(read.patterns), 1, input) != 1 ||
+      read.width <= 0 || read.height <= 0) {
+    std::cout << "Truncated or damaged replay log " << file << std::endl;
+    fclose(input);
+    return false;
+  }
+  h = read;
+
+  frame f;
+  while (fread(&f.millis, sizeof(f.millis), 1, input) == 1 &&
+         fread(&f.fps, sizeof(f.fps), 1, input) == 1 &&
+         fread(&f.keys, sizeof(f.keys), 1, input) == 1)
+    frames.push_back(f);
+
+  fclose(input);
+  return true;
+}
+
+// FNV-1a over the frame, used to prove two runs rendered the same pixels.
+inline unsigned int checksum(const detail::Uint32 *pixels, int len,
+                             unsigned int hash = 2166136261u) {
+  for (int i = 0; i < len; ++i) {
+    hash ^= pixels[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Play a log back without a window, as fast as the simulation allows, and
+// report frame timings plus a checksum of every rendered frame. With
+// alloc::g_check set, fails if any frame after the first allocates. With an
+// |export_name| every frame is rendered straight into shared memory under
+// that name (see Share.hpp), without a copy.
+bool play(const char *file, const game::settings &options,
+          const char *graph_file = nullptr,
+          const char *export_name = nullptr) {
+  header log;
+  std::vector<frame> frames;
+  if (!load(file, log, frames))
+    return false;
+
+  int width{log.width}, height{log.height};
+  util::mem_pool pool(game::session::pool_bytes(options));
+  game::session world(pool, log.seed, options);
+  if (!compatible(log, describe(world, log.seed, width, height)))
+    return false;
+  std::vector<detail::Uint32> buffer(width * height);
+  math::vec2 iResolution(static_cast<double>(width),
+                         static_cast<double>(height));
+  share::writer exported;
+  if (export_name)
+    exported.open(export_name, width, height);
+
+  unsigned int hash{2166136261u}, last{0};
+  double total{0}, slowest{0}, fastest{0};
+  int allocating{0};
+  for (size_t i = 0; i < frames.size(); ++i) {
+    const frame &f{frames[i]};
+    profile::ticks start{profile::now()};
+    alloc::counter heap;
+    detail::Uint32 *pixels{exported.is_open() ? exported.begin() : &buffer[0]};
+    {
+      PROFILE_SCOPE("frame");
+      world.step(pixels, iResolution, f.millis, f.fps, f.keys);
+    }
+    // The first frame may still size tables that follow the output size.
+    if (alloc::g_check && i > 0 && heap.allocations()) {
+      if (allocating++ < 10)
+        std::cout << "Frame " << i << " allocated " << heap.allocations()
+                  << " times (" << heap.allocated_bytes() << " bytes)"
+                  << std::endl;
+    }
+    double elapsed{profile::to_millis(profile::now() - start)};
+    total += elapsed;
+    slowest = (i == 0 || elapsed > slowest) ? elapsed : slowest;
+    fastest = (i == 0 || elapsed < fastest) ? elapsed : fastest;
+    hash = checksum(pixels, width * height, hash);
+    if (exported.is_open()) {
+      last = checksum(pixels, width * height);
+      exported.publish(f.millis);
+    }
+  }
+
+  std::cout << "Replayed " << frames.size() << " frames in " << total
+            << " ms (avg " << (frames.empty() ? 0.0 : total / frames.size())
+            << " ms, min " << fastest << " ms, max " << slowest << " ms)"
+            << std::endl;
+  std::cout << "Checksum: " << std::hex << hash << std::dec << std::endl;
+  if (exported.is_open())
+    std::cout << "Shared " << exported.published()
+              << " frames, last frame checksum: " << std::hex << last
+              << std::dec << std::endl;
+  if (alloc::g_check)
+    std::cout << allocating << " steady state frames allocated" << std::endl;
+  if (!world.frame.empty()) {
+    world.frame.print(std::cout);
+    if (graph_file)
+      world.frame.write_dot(graph_file);
+  }
+  return !allocating;
+}
+
+} // namespace replay
+
+#endif // _REPLAY_HPP
@@ -0,0 +1,637 @@
+#ifndef _SESSION_HPP
+#define _SESSION_HPP
+#pragma once
+
+#include "Assets.hpp"
+#include "Game.hpp"
+#include "Patterns.hpp"
+#include "Random.hpp"
+#include "Tasks.hpp"
+#include "Tiles.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+namespace game {
+
+// Switches that change what a session simulates or renders. A replay log
+// records the ones that change the simulation and refuses to play back with
+// others (see replay::compatible).
+struct settings {
+  bool animate_light; // Move the light every frame instead of keeping it still.
+  int width;          // Internal render resolution of the playfield layers.
+  int height;
+  int shadow_scale; // Shadows are computed at 1/shadow_scale of that (1, 2, 4).
+  bool tiled;       // Render with tile_renderer instead of full screen passes.
+  int threads;      // Worker threads running step() as a task graph, 0 for
+                    // none (every stage on the calling thread).
+  bool compact_textures; // Sprites palette indexed, the background RGB565.
+  bool bullet_patterns;  // Enemies fire pattern volleys (see Patterns.hpp).
+  const char *pattern_file; // Patterns to fire, null for the built in ones.
+
+  settings()
+      : animate_light(false), width(_width), height(_height), shadow_scale(1),
+        tiled(false), threads(0), compact_textures(false),
+        bullet_patterns(false), pattern_file(nullptr) {}
+};
+
+// Render quality knobs that may change from one frame to the next, see
+// quality::governor. Unlike settings these never exceed what the session was
+// built with, so changing them never allocates.
+struct quality_level {
+  int resolution;     // Percent of the settings' width and height.
+  int shadow_scale;   // Shadow mask at 1/shadow_scale of the layers.
+  int blur_taps;      // Shadow blur width, 4, 2 or 0 for none.
+  int particle_limit; // Most particles alive at once.
+};
+
+// The per-frame stages of session::step(), in the order they run. The tiled
+// path only runs units, shadows and particles (binning them) and tiles.
+enum Stages {
+  STAGE_BACKGROUND,
+  STAGE_CLEAR_FG,
+  STAGE_UNITS,
+  STAGE_CLEAR_SG,
+  STAGE_SHADOWS,
+  STAGE_PARTICLES,
+  STAGE_COMPOSITE,
+  STAGE_TILES,
+  STAGE_COUNT
+};
+
+const char *const stage_names[STAGE_COUNT] = {
+    "background",      "clear_fg",  "draw_units", "clear_sg",
+    "compute_shadows", "particles", "draw_stage", "tiles"};
+
+// Static layers copied over every frame, in the order they go on.
+enum Overlays { OVERLAY_BAR, OVERLAY_COUNT };
+
+// What a session loads, by handle. The sprites come first, in UnitTypes
+// order.
+enum Assets {
+  ASSET_PLAYER,
+  ASSET_ENEMY,
+  ASSET_PROJECTILE,
+  ASSET_BACKGROUND,
+  ASSET_BAR,
+  ASSET_COUNT
+};
+
+// Everything a single game needs to simulate and render frames. The window
+// thread and the headless replay both drive one of these, so given the same
+// seed and the same per-frame inputs they produce the same pixels.
+struct session {
+  static const int max_particles = 65536;
+  static const int max_bullets = 16384; // With bullet_patterns on.
+  static const int asset_bytes = 4 * 1048576; // Stage background and sprites.
+  static const int max_bands = 16; // Most tasks the tiled render splits into.
+
+  util::mem_pool &pool;
+  assets::loader loading;
+  std::vector<texture> textures;
+  texture bg;
+  texture bar;
+  texture img;
+  texture fg;
+  coverage sg;
+  std::vector<math::vec8> units;
+  math::vec3 light;
+  double light_phase;
+  shadow_table shadows;
+  tile_renderer tiles;
+  settings config;
+  rng::stream random; // Root stream, every system splits its own from it.
+  rng::stream spawn;  // Unit placement and enemy respawns.
+  fx::particles effects;
+  pattern::table patterns;
+  pattern::bullets bullets;
+  quality_level quality;
+  int offset;
+  double stage_millis[STAGE_COUNT]; // How long each stage took last frame.
+  task::pool *workers;              // Null unless config.threads > 0.
+  task::graph frame;                // step() as tasks, when there are workers.
+  std::vector<tile_scratch> band_scratch;
+  double band_millis[max_bands];
+  static_layer overlays[OVERLAY_COUNT];
+
+  // Pool memory a session needs with |options|: the stage assets, the two
+  // colour layers, the shadow coverage, the particle and bullet arrays.
+  static int pool_bytes(const settings &options) {
+    math::vec2i size(options.width, options.height);
+    int layers = 2 * options.width * options.height * sizeof(detail::Uint32) +
+                 coverage::bytes(size);
+    int particles = 7 * ((max_particles + 4) * sizeof(float) + 32);
+    int bullets = pattern::bullets::bytes(options.bullet_patterns ? max_bullets
+                                                                  : 0);
+    return asset_bytes + layers + particles + bullets;
+  }
+
+  // The assets load on the workers (or threads of the loader's own). Only
+  // the sprites are waited for, they decide what collides; with
+  // |stream_assets| the background and bar are drawn as placeholders until
+  // they're ready, otherwise they're waited for too so every frame comes out
+  // the same.
+  session(util::mem_pool &allocator, rng::uint64 seed,
+          const settings &options = settings(), bool stream_assets = false)
+      : pool(allocator), loading(allocator),
+        bg(assets::placeholder(allocator, 0xff004433)),
+        bar(assets::placeholder(allocator, 0xff1b1b1d)),
+        img(math::vec2i(options.width, options.height), allocator),
+        fg(math::vec2i(options.width, options.height), allocator),
+        sg(math::vec2i(options.width, options.height), allocator,
+           options.shadow_scale),
+        // We place a light 'somewhere' in the scene for shadow projection.
+        light(_width * 0.5, _height * 0.5, 240.0), light_phase(0),
+        config(options), random(seed), spawn(random.split()),
+        effects(allocator, max_particles, random.split()),
+        bullets(allocator, options.bullet_patterns ? max_bullets : 0),
+        offset(0),
+        workers(options.threads > 0 ? new task::pool(options.threads)
+                                    : nullptr),
+        m_installed(0) {
+    int sprites{options.compact_textures ? FORMAT_INDEXED : FORMAT_ARGB};
+    loading.add("..//res//player.graw", sprites);
+    loading.add("..//res//enemy.graw", sprites);
+    loading.add("..//res//projectile.graw", sprites);
+    loading.add("..//res//bg[0].graw",
+                options.compact_textures ? FORMAT_RGB565 : FORMAT_ARGB);
+    loading.add("../res//bar.graw");
+    loading.start(workers);
+
+    // A sprite that failed to load is a magenta square, so it shows.
+    textures.reserve(3);
+    for (int i = ASSET_PLAYER; i <= ASSET_PROJECTILE; ++i) {
+      loading.wait(i);
+      textures.push_back(loading.failed(i)
+                             ? assets::placeholder(pool, 0xffff00ff)
+                             : loading.texture(i));
+    }
+    if (!stream_assets)
+      loading.wait_all();
+    update_assets();
+    for (int i = 0; i < STAGE_COUNT; ++i)
+      stage_millis[i] = 0;
+
+    // Everything a frame fills in is sized here, so steady state frames
+    // never allocate (see Alloc.hpp).
+    math::vec2i size(options.width, options.height);
+    spawn_units(units, spawn);
+    if (options.bullet_patterns) {
+      std::vector<pattern::spec> specs;
+      if (options.pattern_file &&
+          !pattern::load(options.pattern_file, specs))
+        std::cout << "Firing the built in patterns instead." << std::endl;
+      if (specs.empty())
+        specs = pattern::defaults();
+      patterns.compile(specs);
+    }
+    shadows.reserve(size);
+    if (config.tiled) {
+      int sprite_size{0};
+      for (size_t i = 0; i < textures.size(); ++i) {
+        const math::vec2i &b = textures[i].bounds;
+        int side = b.v[x_pos] > b.v[y_pos] ? b.v[x_pos] : b.v[y_pos];
+        sprite_size = side > sprite_size ? side : sprite_size;
+      }
+      tiles.reserve(size, stage_units + bullets.capacity(), sprite_size,
+                    max_particles);
+    }
+    quality_level full = {100, options.shadow_scale, 4, max_particles};
+    quality = full;
+    if (workers) {
+      if (config.tiled)
+        build_tiled_graph();
+      else
+        build_graph();
+    }
+  }
+
+  ~session() {
+    loading.wait_all(); // Lets go of workers before they're deleted.
+    delete workers;
+  }
+
+  // Whether every asset is in place (or has failed for good).
+  bool assets_ready() const { return m_installed == (1 << ASSET_COUNT) - 1; }
+
+  // Put the background and bar in place as they finish loading, then say
+  // how loading went. Nothing to do once that's happened; step() calls it
+  // before every frame.
+  void update_assets() {
+    if (assets_ready())
+      return;
+    texture *targets[ASSET_COUNT] = {nullptr, nullptr, nullptr, &bg, &bar};
+    for (int i = 0; i < ASSET_COUNT; ++i) {
+      if ((m_installed & (1 << i)) || !loading.done(i))
+        continue;
+      if (targets[i] && !loading.failed(i))
+        targets[i]->assign(loading.texture(i));
+      m_installed |= 1 << i;
+    }
+    if (assets_ready()) {
+      loading.wait_all();
+      loading.report(std::cout);
+    }
+  }
+
+  // Start a new game from |seed| on the same assets and storage. Plays out
+  // exactly like a session just created with |seed|; quality is kept.
+  void restart(rng::uint64 seed) {
+    random = rng::stream(seed);
+    spawn = random.split();
+    effects.reset(random.split());
+    light = math::vec3(_width * 0.5, _height * 0.5, 240.0);
+    light_phase = 0;
+    offset = 0;
+    units.clear();
+    spawn_units(units, spawn);
+    bullets.clear();
+  }
+
+  // Bytes save() writes right now. Varies with the particles alive.
+  int state_bytes() const {
+    return static_cast<int>(sizeof(state) +
+                            units.size() * sizeof(math::vec8)) +
+           bullets.state_bytes() + effects.state_bytes();
+  }
+
+  // Write the game state - everything one frame hands to the next, the
+  // layers are redrawn from it - to |out| as one contiguous block of plain
+  // data, state_bytes() long. Quality settings aren't part of it.
+  unsigned char *save(unsigned char *out) const {
+    state header = {random, spawn, light, light_phase, offset,
+                    static_cast<int>(units.size())};
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    memcpy(out, units.data(), units.size() * sizeof(math::vec8));
+    out += units.size() * sizeof(math::vec8);
+    out = bullets.save(out);
+    return effects.save(out);
+  }
+
+  // Continue from a block save() wrote, by this or another session with the
+  // same settings. Returns the end of the block.
+  const unsigned char *load(const unsigned char *in) {
+    state header;
+    memcpy(&header, in, sizeof(header));
+    in += sizeof(header);
+    random = header.random;
+    spawn = header.spawn;
+    light = header.light;
+    light_phase = header.light_phase;
+    offset = header.offset;
+    units.resize(header.units);
+    memcpy(units.data(), in, units.size() * sizeof(math::vec8));
+    in += units.size() * sizeof(math::vec8);
+    in = bullets.load(in);
+    return effects.load(in);
+  }
+
+  // Advance the game by one frame like step() would, without rendering it.
+  void simulate(double millis, double fps, unsigned int keys) {
+    ++offset;
+    update_units(units, effects, spawn, millis, fps, keys);
+    collide_units(textures, units, effects);
+    move_bullets(millis);
+    fire_projectiles(units, millis, fps, !config.bullet_patterns);
+    fire_bullets(fps);
+    if (config.animate_light)
+      animate_light(light, light_phase, millis);
+    effects.update(static_cast<float>(millis));
+  }
+
+  // Switch quality for the frames that follow. Layers shrink in place, the
+  // composite stretches whatever size they are over the output.
+  void set_quality(const quality_level &level) {
+    quality = level;
+    int percent = level.resolution < 10 ? 10 : level.resolution;
+    percent = percent > 100 ? 100 : percent;
+    math::vec2i size(config.width * percent / 100,
+                     config.height * percent / 100);
+    img.resize(size);
+    fg.resize(size);
+    sg.resize(size, level.shadow_scale);
+    effects.set_limit(level.particle_limit);
+  }
+
+  // Advance the game by one frame and composite it into |buffer|.
+  void step(detail::Uint32 *buffer, const math::vec2 &iResolution,
+            double millis, double fps, unsigned int keys) {
+    update_assets();
+    for (int i = 0; i < STAGE_COUNT; ++i)
+      stage_millis[i] = 0;
+    if (workers) {
+      frame_input input = {buffer, &iResolution, millis, fps, keys};
+      m_input = input;
+      frame.run(*workers);
+      for (int i = 0; config.tiled && i < max_bands; ++i)
+        stage_millis[STAGE_TILES] += band_millis[i];
+      return;
+    }
+    if (config.tiled) {
+      step_tiled(buffer, iResolution, millis, fps, keys);
+      return;
+    }
+
+    // Layers may be rendered at a different resolution than the playfield.
+    double sx = img.bounds.v[x_pos] / static_cast<double>(_width);
+    double sy = img.bounds.v[y_pos] / static_cast<double>(_height);
+
+    // Copy the background onto the image, one playfield worth of rows.
+    {
+      PROFILE_STAGE("background", stage_millis[STAGE_BACKGROUND]);
+      img.copy(bg, offset++, _height);
+    }
+
+    // Clear out the foreground texture.
+    {
+      PROFILE_STAGE("clear_fg", stage_millis[STAGE_CLEAR_FG]);
+      fg.clear();
+    }
+
+    // Next render the entities onto the fg texture.
+    {
+      PROFILE_STAGE("draw_units", stage_millis[STAGE_UNITS]);
+      draw_units(textures, fg, units, effects, spawn, millis, fps, keys,
+                 !config.bullet_patterns);
+      draw_bullets(millis, fps);
+    }
+
+    // Clear the shadow map
+    {
+      PROFILE_STAGE("clear_sg", stage_millis[STAGE_CLEAR_SG]);
+      sg.clear();
+    }
+    // Compute the shadow map from the rendered entities
+    {
+      PROFILE_STAGE("compute_shadows", stage_millis[STAGE_SHADOWS]);
+      if (config.animate_light)
+        animate_light(light, light_phase, millis);
+      math::vec3 projected(light.v[x_pos] * sx, light.v[y_pos] * sy,
+                           light.v[delta_x]);
+      compute_shadows(fg, sg, shadows, projected, quality.blur_taps);
+    }
+
+    // Effects go on after the shadow pass, sparks don't cast shadows.
+    {
+      PROFILE_STAGE("particles", stage_millis[STAGE_PARTICLES]);
+      effects.update(static_cast<float>(millis));
+      effects.draw(fg.tex, fg.bounds.v[x_pos], fg.bounds.v[y_pos],
+                   static_cast<float>(sx), static_cast<float>(sy));
+    }
+    profile::count("particles_live", effects.live());
+
+    // Composition everything onto the img buffer
+    {
+      PROFILE_STAGE("draw_stage", stage_millis[STAGE_COMPOSITE]);
+      update_overlays(img.bounds, iResolution);
+      draw_stage(buffer, iResolution, img, sg, fg, overlays, OVERLAY_COUNT,
+                 millis, keys);
+    }
+    profile::count("pool_bytes_used", pool.used());
+  }
+
+  // step() through tile_renderer: only the sprites, shadow casters and
+  // particles are worked out for the whole frame, everything else happens
+  // tile by tile. The img, fg and sg layers are left untouched.
+  void step_tiled(detail::Uint32 *buffer, const math::vec2 &iResolution,
+                  double millis, double fps, unsigned int keys) {
+    update_overlays(fg.bounds, iResolution);
+    tiles.begin(fg.bounds, iResolution, bg, offset++, _height, overlays,
+                OVERLAY_COUNT);
+
+    {
+      PROFILE_STAGE("draw_units", stage_millis[STAGE_UNITS]);
+      update_units(units, effects, spawn, millis, fps, keys);
+      collide_units(textures, units, effects);
+      move_bullets(millis);
+      tiles.bin_units(textures, units, &bullets);
+      fire_projectiles(units, millis, fps, !config.bullet_patterns);
+      fire_bullets(fps);
+    }
+
+    {
+      PROFILE_STAGE("compute_shadows", stage_millis[STAGE_SHADOWS]);
+      if (config.animate_light)
+        animate_light(light, light_phase, millis);
+      double sx = fg.bounds.v[x_pos] / static_cast<double>(_width);
+      double sy = fg.bounds.v[y_pos] / static_cast<double>(_height);
+      math::vec3 projected(light.v[x_pos] * sx, light.v[y_pos] * sy,
+                           light.v[delta_x]);
+      shadows.update(projected, fg.bounds);
+      tiles.bin_shadows(shadows, quality.blur_taps);
+    }
+
+    {
+      PROFILE_STAGE("particles", stage_millis[STAGE_PARTICLES]);
+      effects.update(static_cast<float>(millis));
+      tiles.bin_particles(effects);
+    }
+    profile::count("particles_live", effects.live());
+
+    {
+      PROFILE_STAGE("tiles", stage_millis[STAGE_TILES]);
+      tiles.render(buffer);
+    }
+    profile::count("pool_bytes_used", pool.used());
+  }
+
+protected:
+  int m_installed; // Bit per Assets handle in place (or given up on).
+
+  // Enemy bullets, with bullet_patterns on: move the ones out and settle
+  // what they hit, then (once the frame has them) fire the volleys due.
+  // Like the units' projectiles, new bullets show from the next frame.
+  void move_bullets(double millis) {
+    if (!config.bullet_patterns)
+      return;
+    math::vec4 field{8.0, 8.0, _width - 8.0, _height - 8.0};
+    bullets.update(static_cast<float>(millis), field);
+    bullets.collide(textures[PLAYER], units[units.size() - 1],
+                    textures[PROJECTILE], effects);
+  }
+  void fire_bullets(double fps) {
+    if (!config.bullet_patterns)
+      return;
+    pattern::fire_patterns(units, patterns, bullets, fps);
+    profile::count("bullets_live", bullets.live());
+  }
+
+  // move_bullets() and fire_bullets() around drawing the bullets onto fg,
+  // after the units.
+  void draw_bullets(double millis, double fps) {
+    if (!config.bullet_patterns)
+      return;
+    move_bullets(millis);
+    double sx = fg.bounds.v[x_pos] / static_cast<double>(_width);
+    double sy = fg.bounds.v[y_pos] / static_cast<double>(_height);
+    profile::count("bullet_pixels_written",
+                   bullets.draw(textures[PROJECTILE], fg, sx, sy));
+    fire_bullets(fps);
+  }
+
+  // Redraw the overlays that are out of date for |layer| sized stage layers
+  // shown at |iResolution|. Most frames that's none of them.
+  void update_overlays(const math::vec2i &layer,
+                       const math::vec2 &iResolution) {
+    update_bar(overlays[OVERLAY_BAR], bar, layer, iResolution);
+  }
+
+  // The fixed size part of save(), followed by the units and particles.
+  struct state {
+    rng::stream random;
+    rng::stream spawn;
+    math::vec3 light;
+    double light_phase;
+    int offset;
+    int units;
+  };
+
+  // What the graph's tasks need to know about the frame being stepped.
+  struct frame_input {
+    detail::Uint32 *buffer;
+    const math::vec2 *iResolution;
+    double millis;
+    double fps;
+    unsigned int keys;
+  };
+
+  // step() as a task graph: the same stages in the same order, each naming
+  // the layers and lists it reads and writes. Background and clearing the
+  // shadow mask don't depend on the units, so they overlap with them.
+  void build_graph() {
+    int bg_layer{frame.resource("img")};
+    int fg_layer{frame.resource("fg")};
+    int sg_layer{frame.resource("sg")};
+    int unit_list{frame.resource("units")};
+    int sparks{frame.resource("particles")};
+    int output{frame.resource("output")};
+
+    frame.add("background", [this]() {
+      PROFILE_STAGE("background", stage_millis[STAGE_BACKGROUND]);
+      img.copy(bg, offset++, _height);
+    }, {}, {bg_layer});
+
+    frame.add("clear_fg", [this]() {
+      PROFILE_STAGE("clear_fg", stage_millis[STAGE_CLEAR_FG]);
+      fg.clear();
+    }, {}, {fg_layer});
+
+    frame.add("draw_units", [this]() {
+      PROFILE_STAGE("draw_units", stage_millis[STAGE_UNITS]);
+      draw_units(textures, fg, units, effects, spawn, m_input.millis,
+                 m_input.fps, m_input.keys, !config.bullet_patterns);
+      draw_bullets(m_input.millis, m_input.fps);
+    }, {}, {fg_layer, unit_list, sparks});
+
+    frame.add("clear_sg", [this]() {
+      PROFILE_STAGE("clear_sg", stage_millis[STAGE_CLEAR_SG]);
+      sg.clear();
+    }, {}, {sg_layer});
+
+    frame.add("compute_shadows", [this]() {
+      PROFILE_STAGE("compute_shadows", stage_millis[STAGE_SHADOWS]);
+      if (config.animate_light)
+        animate_light(light, light_phase, m_input.millis);
+      double sx = img.bounds.v[x_pos] / static_cast<double>(_width);
+      double sy = img.bounds.v[y_pos] / static_cast<double>(_height);
+      math::vec3 projected(light.v[x_pos] * sx, light.v[y_pos] * sy,
+                           light.v[delta_x]);
+      compute_shadows(fg, sg, shadows, projected, quality.blur_taps);
+    }, {fg_layer}, {sg_layer});
+
+    frame.add("particles", [this]() {
+      PROFILE_STAGE("particles", stage_millis[STAGE_PARTICLES]);
+      effects.update(static_cast<float>(m_input.millis));
+      effects.draw(fg.tex, fg.bounds.v[x_pos], fg.bounds.v[y_pos],
+                   static_cast<float>(img.bounds.v[x_pos] /
+                                      static_cast<double>(_width)),
+                   static_cast<float>(img.bounds.v[y_pos] /
+                                      static_cast<double>(_height)));
+      profile::count("particles_live", effects.live());
+    }, {}, {fg_layer, sparks});
+
+    frame.add("draw_stage", [this]() {
+      PROFILE_STAGE("draw_stage", stage_millis[STAGE_COMPOSITE]);
+      update_overlays(img.bounds, *m_input.iResolution);
+      draw_stage(m_input.buffer, *m_input.iResolution, img, sg, fg, overlays,
+                 OVERLAY_COUNT, m_input.millis, m_input.keys);
+      profile::count("pool_bytes_used", pool.used());
+    }, {bg_layer, sg_layer, fg_layer}, {output});
+  }
+
+  // step_tiled() as a task graph. Shadow and particle binning overlap, and
+  // the tiles are rendered in bands of rows, each with its own scratch.
+  void build_tiled_graph() {
+    static const char *const band_names[max_bands] = {
+        "tiles 0", "tiles 1", "tiles 2",  "tiles 3",  "tiles 4",  "tiles 5",
+        "tiles 6", "tiles 7", "tiles 8",  "tiles 9",  "tiles 10", "tiles 11",
+        "tiles 12", "tiles 13", "tiles 14", "tiles 15"};
+    int layout{frame.resource("layout")};
+    int unit_list{frame.resource("units")};
+    int sparks{frame.resource("particles")};
+    int sprite_bins{frame.resource("sprite bins")};
+    int shadow_bins{frame.resource("shadow bins")};
+    int particle_bins{frame.resource("particle bins")};
+
+    frame.add("tile_setup", [this]() {
+      update_overlays(fg.bounds, *m_input.iResolution);
+      tiles.begin(fg.bounds, *m_input.iResolution, bg, offset++, _height,
+                  overlays, OVERLAY_COUNT);
+    }, {}, {layout});
+
+    frame.add("draw_units", [this]() {
+      PROFILE_STAGE("draw_units", stage_millis[STAGE_UNITS]);
+      update_units(units, effects, spawn, m_input.millis, m_input.fps,
+                   m_input.keys);
+      collide_units(textures, units, effects);
+      move_bullets(m_input.millis);
+      tiles.bin_units(textures, units, &bullets);
+      fire_projectiles(units, m_input.millis, m_input.fps,
+                       !config.bullet_patterns);
+      fire_bullets(m_input.fps);
+    }, {layout}, {unit_list, sparks, sprite_bins});
+
+    frame.add("compute_shadows", [this]() {
+      PROFILE_STAGE("compute_shadows", stage_millis[STAGE_SHADOWS]);
+      if (config.animate_light)
+        animate_light(light, light_phase, m_input.millis);
+      double sx = fg.bounds.v[x_pos] / static_cast<double>(_width);
+      double sy = fg.bounds.v[y_pos] / static_cast<double>(_height);
+      math::vec3 projected(light.v[x_pos] * sx, light.v[y_pos] * sy,
+                           light.v[delta_x]);
+      shadows.update(projected, fg.bounds);
+      tiles.bin_shadows(shadows, quality.blur_taps);
+    }, {layout, sprite_bins}, {shadow_bins});
+
+    frame.add("particles", [this]() {
+      PROFILE_STAGE("particles", stage_millis[STAGE_PARTICLES]);
+      effects.update(static_cast<float>(m_input.millis));
+      tiles.bin_particles(effects);
+      profile::count("particles_live", effects.live());
+    }, {layout}, {sparks, particle_bins});
+
+    // Bands write disjoint rows of the output, so they don't declare it.
+    int bands{2 * (workers->threads() + 1)};
+    bands = bands < max_bands ? bands : max_bands;
+    band_scratch.resize(bands);
+    for (int b = 0; b < max_bands; ++b)
+      band_millis[b] = 0;
+    for (int b = 0; b < bands; ++b) {
+      frame.add(band_names[b], [this, b, bands]() {
+        PROFILE_STAGE("tiles", band_millis[b]);
+        int rows{tiles.tile_rows()};
+        tiles.render_rows(b * rows / bands, (b + 1) * rows / bands,
+                          band_scratch[b], m_input.buffer);
+      }, {layout, sprite_bins, shadow_bins, particle_bins}, {});
+    }
+  }
+
+  frame_input m_input;
+
+private:
+  session(const session &);
+  session &operator=(const session &);
+};
+
+} // namespace game
+
+#endif // _SESSION_HPP
@@ -0,0 +1,334 @@
+#ifndef _SHARE_HPP
+#define _SHARE_HPP
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include "Profiler.hpp"
+#include "Renderer.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// Finished frames published into a named shared memory ring, so another
+// process can show, record or encode the game while it runs. The writer
+// never waits for anyone: it always takes the next slot round the ring, and
+// a reader that is too slow simply misses frames. Every slot carries a
+// sequence number, odd while its frame is being written and even once it is
+// complete, so a reader can use a frame in place and check afterwards that
+// it wasn't being overwritten underneath it.
+//
+// Mapping layout: a 64 byte header, then |slots| slots of |slot_bytes| each.
+// A slot is a 64 byte slot header followed by width * height 32 bit ARGB
+// pixels. Frame n (counting from 0) goes into slot n % slots.
+namespace share {
+
+static const unsigned int magic = 0x53464d42; // "BMFS"
+static const unsigned int version = 1;
+
+struct header {
+  unsigned int magic;
+  unsigned int version;
+  int width, height;
+  int slots;
+  int slot_bytes;
+  std::atomic<unsigned int> published; // Frames complete so far.
+  std::atomic<unsigned int> attached;  // 1 while the writer is running.
+};
+
+struct slot {
+  std::atomic<unsigned int> sequence; // 2n + 1 writing frame n, 2n + 2 done.
+  unsigned int frame;
+  double millis; // How long the game took over the frame.
+};
+
+static const int header_bytes = 64;
+static const int slot_header_bytes = 64;
+static_assert(sizeof(header) <= header_bytes, "header outgrew header_bytes");
+static_assert(sizeof(slot) <= slot_header_bytes,
+              "slot outgrew slot_header_bytes");
+
+// Bytes one slot takes for |width| x |height| frames, kept 64 byte aligned.
+inline int slot_bytes(int width, int height) {
+  return (slot_header_bytes + width * height * 4 + 63) & ~63;
+}
+
+// The game's side. Publishes frames without blocking or allocating.
+class writer {
+public:
+  writer() : m_mapping(nullptr), m_view(nullptr), m_header(nullptr) {}
+  ~writer() { close(); }
+
+  // Create the shared memory called |name| for |width| x |height| frames.
+  // Fails if something already shares frames (or anything else) under
+  // |name|: its layout isn't ours to reset, nor its size to write to.
+  bool open(const char *name, int width, int height, int slots = 4) {
+    close();
+    unsigned long long bytes{header_bytes +
+                             static_cast<unsigned long long>(slots) *
+                                 slot_bytes(width, height)};
+    m_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                  static_cast<DWORD>(bytes >> 32),
+                                  static_cast<DWORD>(bytes), name);
+    if (m_mapping && GetLastError() == ERROR_ALREADY_EXISTS) {
+      std::cout << "Something is already shared as " << name << std::endl;
+      close();
+      return false;
+    }
+    if (m_mapping)
+      m_view = static_cast<unsigned char *>(
+          MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    if (!m_view) {
+      std::cout << "Could not create shared frames " << name << std::endl;
+      close();
+      return false;
+    }
+
+    m_header = reinterpret_cast<header *>(m_view);
+    m_header->magic = magic;
+    m_header->version = version;
+    m_header->width = width;
+    m_header->height = height;
+    m_header->slots = slots;
+    m_header->slot_bytes = slot_bytes(width, height);
+    m_header->published.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < slots; ++i)
+      slot_at(i)->sequence.store(0, std::memory_order_relaxed);
+    m_header->attached.store(1, std::memory_order_release);
+    std::cout << "Sharing " << width << "x" << height << " frames as " << name
+              << std::endl;
+    return true;
+  }
+
+  void close() {
+    if (m_header)
+      m_header->attached.store(0, std::memory_order_release);
+    if (m_view)
+      UnmapViewOfFile(m_view);
+    if (m_mapping)
+      CloseHandle(m_mapping);
+    m_mapping = nullptr;
+    m_view = nullptr;
+    m_header = nullptr;
+  }
+
+  bool is_open() const { return m_header != nullptr; }
+  int width() const { return m_header->width; }
+  int height() const { return m_header->height; }
+  unsigned int published() const {
+    return m_header->published.load(std::memory_order_relaxed);
+  }
+
+  // The pixels of the next frame, straight in shared memory, to render the
+  // frame into. Call publish() once it's done.
+  detail::Uint32 *begin() {
+    unsigned int n{published()};
+    slot *s{slot_at(n % m_header->slots)};
+    s->sequence.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s->frame = n;
+    return pixels(s);
+  }
+
+  // Hand the frame begin() gave out to the readers.
+  void publish(double millis) {
+    unsigned int n{published()};
+    slot *s{slot_at(n % m_header->slots)};
+    s->millis = millis;
+    s->sequence.store(2 * n + 2, std::memory_order_release);
+    m_header->published.store(n + 1, std::memory_order_release);
+  }
+
+  // Publish a frame rendered somewhere else, at the cost of copying it.
+  void publish(const detail::Uint32 *frame, double millis) {
+    memcpy(begin(), frame,
+           m_header->width * m_header->height * sizeof(detail::Uint32));
+    publish(millis);
+  }
+
+protected:
+  slot *slot_at(int i) const {
+    return reinterpret_cast<slot *>(m_view + header_bytes +
+                                    i * m_header->slot_bytes);
+  }
+  static detail::Uint32 *pixels(slot *s) {
+    return reinterpret_cast<detail::Uint32 *>(
+        reinterpret_cast<unsigned char *>(s) + slot_header_bytes);
+  }
+
+  HANDLE m_mapping;
+  unsigned char *m_view;
+  header *m_header;
+
+private:
+  writer(const writer &);
+  writer &operator=(const writer &);
+};
+
+// A frame as a reader sees it: in shared memory, until the writer laps it.
+struct view {
+  const detail::Uint32 *pixels;
+  unsigned int frame;
+  double millis;
+  unsigned int sequence; // What the slot's sequence was when we took it.
+  const slot *from;
+};
+
+// The other process's side. Only ever reads the shared memory.
+class reader {
+public:
+  reader()
+      : m_mapping(nullptr), m_view(nullptr), m_header(nullptr), m_next(0),
+        m_missed(0) {}
+  ~reader() { close(); }
+
+  bool open(const char *name) {
+    close();
+    m_mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+    if (m_mapping)
+      m_view = static_cast<const unsigned char *>(
+          MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_view) {
+      std::cout << "Nothing is sharing frames as " << name << std::endl;
+      close();
+      return false;
+    }
+    m_header = reinterpret_cast<const header *>(m_view);
+    if (m_header->magic != magic || m_header->version != version) {
+      std::cout << name << " isn't shared frames (or the wrong version)"
+                << std::endl;
+      close();
+      return false;
+    }
+    m_next = m_header->published.load(std::memory_order_acquire);
+    m_missed = 0;
+    return true;
+  }
+
+  void close() {
+    if (m_view)
+      UnmapViewOfFile(m_view);
+    if (m_mapping)
+      CloseHandle(m_mapping);
+    m_mapping = nullptr;
+    m_view = nullptr;
+    m_header = nullptr;
+  }
+
+  int width() const { return m_header->width; }
+  int height() const { return m_header->height; }
+  bool writer_attached() const {
+    return m_header->attached.load(std::memory_order_acquire) != 0;
+  }
+
+  // Frames published since open() that next() never returned.
+  unsigned int missed() const { return m_missed; }
+
+  // The newest complete frame, if there's one we haven't had yet. Older ones
+  // we never got to are skipped (and counted in missed()). Check the frame
+  // with still_valid() once done with its pixels.
+  bool next(view &out) {
+    unsigned int published{m_header->published.load(std::memory_order_acquire)};
+    if (published == m_next)
+      return false;
+    unsigned int n{published - 1};
+    const slot *s{slot_at(n % m_header->slots)};
+    unsigned int sequence{s->sequence.load(std::memory_order_acquire)};
+    if (sequence != 2 * n + 2) // Lapped already.
+      return false;
+    out.pixels = reinterpret_cast<const detail::Uint32 *>(
+        reinterpret_cast<const unsigned char *>(s) + slot_header_bytes);
+    out.frame = n;
+    out.millis = s->millis;
+    out.sequence = sequence;
+    out.from = s;
+    m_missed += n - m_next;
+    m_next = published;
+    return true;
+  }
+
+  // Whether |frame|'s pixels were left alone all the while we used them.
+  bool still_valid(const view &frame) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame.from->sequence.load(std::memory_order_relaxed) ==
+           frame.sequence;
+  }
+
+protected:
+  const slot *slot_at(int i) const {
+    return reinterpret_cast<const slot *>(m_view + header_bytes +
+                                          i * m_header->slot_bytes);
+  }
+
+  HANDLE m_mapping;
+  const unsigned char *m_view;
+  const header *m_header;
+  unsigned int m_next; // Frame number after the last one returned.
+  unsigned int m_missed;
+
+private:
+  reader(const reader &);
+  reader &operator=(const reader &);
+};
+
+// Reference consumer for --watch: follow the frames shared as |name|, read
+// every pixel of each (a stand-in for showing or encoding it) and report
+// once a second. Stops when the writer goes away, or after |frames| frames
+// if that's more than 0.
+inline bool watch(const char *name, int frames = 0) {
+  reader in;
+  if (!in.open(name))
+    return false;
+  std::cout << "Watching " << in.width() << "x" << in.height()
+            << " frames from " << name << std::endl;
+
+  int bytes{in.width() * in.height() * 4};
+  int seen{0}, torn{0}, second_seen{0};
+  unsigned int hash{0};
+  profile::ticks start{profile::now()}, second{start};
+  view frame;
+  while (frames <= 0 || seen < frames) {
+    // Looked at first: once the writer is gone, next() sees all it shared.
+    bool attached{in.writer_attached()};
+    if (!in.next(frame)) {
+      if (!attached)
+        break;
+      SwitchToThread();
+    } else {
+      // Sum the frame a row at a time, like a display or encoder would
+      // read it, then make sure it was whole.
+      hash = 2166136261u;
+      for (int i = 0; i < in.width() * in.height(); ++i)
+        hash = (hash ^ frame.pixels[i]) * 16777619u;
+      if (in.still_valid(frame)) {
+        ++seen;
+        ++second_seen;
+      } else {
+        ++torn;
+      }
+    }
+
+    profile::ticks now{profile::now()};
+    if (profile::to_millis(now - second) >= 1000.0) {
+      double millis{profile::to_millis(now - second)};
+      std::cout << "  " << second_seen * 1000.0 / millis << " frames/s, "
+                << second_seen * (bytes / 1048576.0) * 1000.0 / millis
+                << " MB/s, " << in.missed() << " missed, " << torn
+                << " torn so far" << std::endl;
+      second = now;
+      second_seen = 0;
+    }
+  }
+
+  double millis{profile::to_millis(profile::now() - start)};
+  std::cout << "Watched " << seen << " frames in " << millis << " ms ("
+            << (millis > 0 ? seen * 1000.0 / millis : 0.0) << " frames/s), "
+            << in.missed() << " missed, " << torn << " torn" << std::endl;
+  std::cout << "  Last frame checksum: " << std::hex << hash << std::dec
+            << std::endl;
+  return true;
+}
+
+} // namespace share
+
+#endif // _SHARE_HPP
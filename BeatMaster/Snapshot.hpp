@@ -0,0 +1,105 @@
+#ifndef _SNAPSHOT_HPP
+#define _SNAPSHOT_HPP
+#pragma once
+
+#include <vector>
+#include "Session.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// A ring of recent game states for rollback, rewind and re-simulating from
+// an earlier frame. Snapshots are session::save() blocks packed back to back
+// into one arena sized up front; adding one drops the oldest until it fits,
+// so a running game never allocates for it.
+namespace snapshot {
+
+class ring {
+public:
+  // |bytes| of arena for at most |slots| snapshots.
+  ring(int bytes, int slots = 64)
+      : m_arena(bytes), m_entries(slots), m_first(0), m_count(0), m_head(0) {}
+
+  int size() const { return m_count; }
+  int capacity() const { return static_cast<int>(m_entries.size()); }
+  void clear() { m_count = m_first = m_head = 0; }
+
+  // Frame of snapshot |i|, oldest first.
+  int frame(int i) const { return at(i).frame; }
+  int bytes(int i) const { return at(i).bytes; }
+
+  // Save |world| as it is at |frame|. Frames must be pushed in increasing
+  // order. False (and nothing saved) if one state is bigger than the arena.
+  bool push(const game::session &world, int frame) {
+    int need{world.state_bytes()};
+    int arena{static_cast<int>(m_arena.size())};
+    if (need > arena || m_entries.empty())
+      return false;
+
+    // Start over at the front when the rest of the arena is too short; the
+    // snapshots past the head are the oldest and go first.
+    if (m_head + need > arena) {
+      while (m_count && at(0).offset >= m_head)
+        drop_oldest();
+      m_head = 0;
+    }
+    while (m_count && overlaps(at(0), m_head, need))
+      drop_oldest();
+    if (m_count == capacity())
+      drop_oldest();
+
+    entry e = {frame, m_head, need};
+    m_entries[(m_first + m_count) % capacity()] = e;
+    ++m_count;
+    world.save(&m_arena[m_head]);
+    m_head += need;
+    return true;
+  }
+
+  // Put the newest snapshot taken at or before |frame| back into |world|.
+  // Returns the frame it was taken at, -1 if there is none that old.
+  int restore(game::session &world, int frame) const {
+    for (int i = m_count - 1; i >= 0; --i) {
+      if (at(i).frame <= frame) {
+        world.load(&m_arena[at(i).offset]);
+        return at(i).frame;
+      }
+    }
+    return -1;
+  }
+
+  // Forget the snapshots taken after |frame|, e.g. after rolling back to it.
+  void discard_after(int frame) {
+    while (m_count && at(m_count - 1).frame > frame)
+      --m_count;
+    m_head = m_count ? at(m_count - 1).offset + at(m_count - 1).bytes : 0;
+  }
+
+protected:
+  struct entry {
+    int frame;
+    int offset; // Into the arena.
+    int bytes;
+  };
+
+  const entry &at(int i) const {
+    return m_entries[(m_first + i) % capacity()];
+  }
+
+  void drop_oldest() {
+    m_first = (m_first + 1) % capacity();
+    --m_count;
+  }
+
+  static bool overlaps(const entry &e, int offset, int bytes) {
+    return e.offset < offset + bytes && offset < e.offset + e.bytes;
+  }
+
+  std::vector<unsigned char> m_arena;
+  std::vector<entry> m_entries;
+  int m_first; // Oldest entry.
+  int m_count;
+  int m_head; // Where the next snapshot goes.
+};
+
+} // namespace snapshot
+
+#endif // _SNAPSHOT_HPP
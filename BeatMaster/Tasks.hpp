@@ -0,0 +1,420 @@
+#ifndef _TASKS_HPP
+#define _TASKS_HPP
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "Profiler.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+// A small work-stealing thread pool and a task graph on top of it. A graph
+// is built once from tasks that declare which resources (layers, the unit
+// list, ...) they read and write, in the order they would run one after the
+// other. Every run then starts each task as soon as the tasks it depends on
+// are done, and records when and where each one ran, so the critical path of
+// the last run can be printed or written out as a Graphviz file.
+namespace task {
+
+// Something the pool can run. |worker| is the index of the running thread's
+// queue.
+struct job {
+  virtual ~job() {}
+  virtual void execute(int worker) = 0;
+};
+
+// A worker's queue of jobs. The owner pushes and pops at the bottom (newest
+// first, warm in its cache), thieves take from the top (oldest first). A spin
+// lock is plenty, a frame only ever has a handful of jobs in flight.
+class job_queue {
+public:
+  static const unsigned int capacity = 256;
+
+  job_queue() : m_top(0), m_bottom(0) { m_lock.clear(); }
+
+  bool push(job *j) {
+    lock();
+    bool fits{m_bottom - m_top < capacity};
+    if (fits)
+      m_jobs[m_bottom++ & (capacity - 1)] = j;
+    unlock();
+    return fits;
+  }
+
+  job *pop() {
+    lock();
+    job *j{m_bottom != m_top ? m_jobs[--m_bottom & (capacity - 1)] : nullptr};
+    unlock();
+    return j;
+  }
+
+  job *steal() {
+    lock();
+    job *j{m_bottom != m_top ? m_jobs[m_top++ & (capacity - 1)] : nullptr};
+    unlock();
+    return j;
+  }
+
+protected:
+  void lock() {
+    while (m_lock.test_and_set(std::memory_order_acquire))
+      YieldProcessor();
+  }
+  void unlock() { m_lock.clear(std::memory_order_release); }
+
+  std::atomic_flag m_lock;
+  unsigned int m_top;
+  unsigned int m_bottom;
+  job *m_jobs[capacity];
+  char m_pad[64];
+};
+
+// Most workers worth asking a pool for; past a core each they only contend.
+static const int max_workers = 64;
+
+class pool;
+__declspec(thread) pool *t_pool = nullptr;
+__declspec(thread) int t_worker = 0;
+
+class pool {
+public:
+  // Start |threads| workers, or one less than the number of cores for 0.
+  // Queue 0 belongs to whichever outside thread submits and waits.
+  pool(int threads = 0) : m_running(true) {
+    if (threads <= 0) {
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      threads = info.dwNumberOfProcessors > 1 ? info.dwNumberOfProcessors - 1
+                                              : 1;
+    }
+    m_count = threads;
+    m_queues = new job_queue[m_count + 1];
+    m_wake = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+    m_threads = new HANDLE[m_count];
+    m_starts = new start[m_count];
+    for (int i = 0; i < m_count; ++i) {
+      m_starts[i].owner = this;
+      m_starts[i].index = i + 1;
+      m_threads[i] = CreateThread(NULL, 0, &pool::run_worker, &m_starts[i], 0,
+                                  NULL);
+    }
+  }
+
+  ~pool() {
+    m_running.store(false);
+    ReleaseSemaphore(m_wake, m_count, NULL);
+    for (int i = 0; i < m_count; ++i) {
+      WaitForSingleObject(m_threads[i], INFINITE);
+      CloseHandle(m_threads[i]);
+    }
+    CloseHandle(m_wake);
+    delete[] m_threads;
+    delete[] m_starts;
+    delete[] m_queues;
+  }
+
+  int threads() const { return m_count; }
+
+  // Queue |j| on the calling thread's queue and wake a worker for it. Runs it
+  // right away if that queue is full.
+  void submit(job *j) {
+    int index{t_pool == this ? t_worker : 0};
+    if (!m_queues[index].push(j)) {
+      j->execute(index);
+      return;
+    }
+    ReleaseSemaphore(m_wake, 1, NULL);
+  }
+
+  // Run and steal jobs on the calling thread until |remaining| drops to zero.
+  void help(const std::atomic<int> &remaining) {
+    int index{t_pool == this ? t_worker : 0};
+    while (remaining.load(std::memory_order_acquire) > 0) {
+      if (job *j = take(index))
+        j->execute(index);
+      else
+        SwitchToThread();
+    }
+  }
+
+protected:
+  struct start {
+    pool *owner;
+    int index;
+  };
+
+  static DWORD WINAPI run_worker(LPVOID parameter) {
+    start *s{static_cast<start *>(parameter)};
+    t_pool = s->owner;
+    t_worker = s->index;
+    s->owner->work(s->index);
+    return 0;
+  }
+
+  void work(int index) {
+    static const char *const names[] = {"worker 1", "worker 2", "worker 3",
+                                        "worker 4", "worker 5", "worker 6",
+                                        "worker 7", "worker 8"};
+    profile::name_thread(index <= 8 ? names[index - 1] : "worker");
+    while (true) {
+      WaitForSingleObject(m_wake, INFINITE);
+      if (!m_running.load())
+        return;
+      // Keep going while there's anything to do, then go back to sleep.
+      while (job *j = take(index))
+        j->execute(index);
+    }
+  }
+
+  // Our own newest job, or the oldest one of somebody else.
+  job *take(int index) {
+    if (job *j = m_queues[index].pop())
+      return j;
+    for (int i = 1; i <= m_count; ++i)
+      if (job *j = m_queues[(index + i) % (m_count + 1)].steal())
+        return j;
+    return nullptr;
+  }
+
+  std::atomic<bool> m_running;
+  int m_count;
+  job_queue *m_queues;
+  HANDLE *m_threads;
+  start *m_starts;
+  HANDLE m_wake;
+
+private:
+  pool(const pool &);
+  pool &operator=(const pool &);
+};
+
+// Tasks don't show up in a trace by themselves, the stages they run are timed
+// with PROFILE_STAGE like everywhere else.
+class graph {
+public:
+  graph() : m_pool(nullptr), m_start(0), m_end(0) { m_remaining.store(0); }
+
+  ~graph() {
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+      delete m_nodes[i];
+  }
+
+  bool empty() const { return m_nodes.empty(); }
+
+  // Name something tasks read or write. Returns its handle.
+  int resource(const char *name) {
+    m_resources.push_back(name);
+    m_writer.push_back(-1);
+    m_readers.push_back(std::vector<int>());
+    return static_cast<int>(m_writer.size()) - 1;
+  }
+
+  // Add a task. Tasks must be added in the order they would run one after
+  // the other: a task waits for the last earlier task that wrote anything it
+  // touches, and a writer also waits for earlier readers of what it writes.
+  int add(const char *name, const std::function<void()> &work,
+          std::initializer_list<int> reads, std::initializer_list<int> writes) {
+    int id{static_cast<int>(m_nodes.size())};
+    node *n{new node(this, name, work)};
+    m_nodes.push_back(n);
+
+    for (auto r = reads.begin(); r != reads.end(); ++r) {
+      depend(id, m_writer[*r], *r);
+      m_readers[*r].push_back(id);
+    }
+    for (auto w = writes.begin(); w != writes.end(); ++w) {
+      depend(id, m_writer[*w], *w);
+      for (size_t i = 0; i < m_readers[*w].size(); ++i)
+        depend(id, m_readers[*w][i], *w);
+      m_readers[*w].clear();
+      m_writer[*w] = id;
+    }
+    return id;
+  }
+
+  // Run every task once on |workers| (and the calling thread) and return
+  // when they're all done.
+  void run(pool &workers) {
+    m_pool = &workers;
+    m_remaining.store(static_cast<int>(m_nodes.size()));
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+      m_nodes[i]->pending.store(
+          static_cast<int>(m_nodes[i]->predecessors.size()));
+    m_start = profile::now();
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+      if (m_nodes[i]->predecessors.empty())
+        workers.submit(m_nodes[i]);
+    workers.help(m_remaining);
+    m_end = profile::now();
+  }
+
+  // Wall time of the last run.
+  double last_millis() const { return profile::to_millis(m_end - m_start); }
+
+  // When each task of the last run took place and which chain of tasks
+  // decided how long the run took.
+  void print(std::ostream &out) const {
+    std::vector<int> path;
+    double length{critical_path(path)};
+    double work{0};
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+      work += m_nodes[i]->millis();
+
+    out << "task graph: " << m_nodes.size() << " tasks, " << std::fixed
+        << std::setprecision(3) << last_millis() << " ms wall, " << work
+        << " ms work, " << (m_pool ? m_pool->threads() + 1 : 1)
+        << " threads" << std::endl;
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+      const node &n{*m_nodes[i]};
+      out << "  " << std::left << std::setw(18) << n.name << std::right
+          << " start " << std::setw(7) << profile::to_millis(n.start - m_start)
+          << " ms, took " << std::setw(7) << n.millis() << " ms, thread "
+          << n.worker << ", after";
+      if (n.predecessors.empty())
+        out << " -";
+      for (size_t p = 0; p < n.predecessors.size(); ++p)
+        out << " " << m_nodes[n.predecessors[p]]->name;
+      out << std::endl;
+    }
+    out << "critical path (" << length << " ms):";
+    for (size_t i = 0; i < path.size(); ++i)
+      out << (i ? " -> " : " ") << m_nodes[path[i]]->name;
+    out << std::endl;
+    out.unsetf(std::ios::fixed);
+    out << std::setprecision(6);
+  }
+
+  // Write the graph of the last run in Graphviz dot format, with each task's
+  // time, the resources each edge waits on and the critical path drawn in
+  // red.
+  bool write_dot(const char *file) const {
+    FILE *out(0);
+    if (!file || fopen_s(&out, file, "wb") != 0)
+      return false;
+    std::vector<int> path;
+    critical_path(path);
+    std::vector<bool> critical(m_nodes.size(), false);
+    for (size_t i = 0; i < path.size(); ++i)
+      critical[path[i]] = true;
+
+    fprintf(out, "digraph frame {\n  rankdir=LR;\n  node [shape=box];\n");
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+      fprintf(out, "  t%d [label=\"%s\\n%.3f ms\"%s];\n",
+              static_cast<int>(i), m_nodes[i]->name, m_nodes[i]->millis(),
+              critical[i] ? ", color=red" : "");
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+      const node &n{*m_nodes[i]};
+      for (size_t p = 0; p < n.predecessors.size(); ++p) {
+        int from{n.predecessors[p]};
+        bool hot{critical[i] && critical[from]};
+        fprintf(out, "  t%d -> t%d [label=\"", from, static_cast<int>(i));
+        const std::vector<int> &shared{n.resources[p]};
+        for (size_t r = 0; r < shared.size(); ++r)
+          fprintf(out, "%s%s", r ? ", " : "", m_resources[shared[r]]);
+        fprintf(out, "\"%s];\n", hot ? ", color=red" : "");
+      }
+    }
+    fprintf(out, "}\n");
+    fclose(out);
+    return true;
+  }
+
+protected:
+  struct node : public job {
+    graph *owner;
+    const char *name;
+    std::function<void()> work;
+    std::vector<int> predecessors;
+    std::vector<std::vector<int> > resources; // Waited on, per predecessor.
+    std::vector<int> successors;
+    std::atomic<int> pending;
+    profile::ticks start;
+    profile::ticks end;
+    int worker;
+
+    node(graph *g, const char *n, const std::function<void()> &w)
+        : owner(g), name(n), work(w), start(0), end(0), worker(0) {
+      pending.store(0);
+    }
+
+    double millis() const { return profile::to_millis(end - start); }
+
+    virtual void execute(int index) {
+      worker = index;
+      start = profile::now();
+      work();
+      end = profile::now();
+      for (size_t i = 0; i < successors.size(); ++i) {
+        node *next{owner->m_nodes[successors[i]]};
+        if (next->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          owner->m_pool->submit(next);
+      }
+      owner->m_remaining.fetch_sub(1, std::memory_order_release);
+    }
+  };
+
+  // Make |task| wait for task |on| because of |resource|.
+  void depend(int task, int on, int resource) {
+    if (on < 0)
+      return;
+    node &n{*m_nodes[task]};
+    for (size_t i = 0; i < n.predecessors.size(); ++i) {
+      if (n.predecessors[i] != on)
+        continue;
+      std::vector<int> &shared{n.resources[i]};
+      for (size_t r = 0; r < shared.size(); ++r)
+        if (shared[r] == resource)
+          return;
+      shared.push_back(resource);
+      return;
+    }
+    n.predecessors.push_back(on);
+    n.resources.push_back(std::vector<int>(1, resource));
+    m_nodes[on]->successors.push_back(task);
+  }
+
+  // Longest chain of measured task times, returned first to last. Tasks are
+  // stored in dependency order, so one pass is enough.
+  double critical_path(std::vector<int> &path) const {
+    std::vector<double> finish(m_nodes.size(), 0.0);
+    std::vector<int> via(m_nodes.size(), -1);
+    int last{-1};
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+      const node &n{*m_nodes[i]};
+      for (size_t p = 0; p < n.predecessors.size(); ++p) {
+        int from{n.predecessors[p]};
+        if (via[i] < 0 || finish[from] > finish[via[i]])
+          via[i] = from;
+      }
+      finish[i] = n.millis() + (via[i] < 0 ? 0.0 : finish[via[i]]);
+      if (last < 0 || finish[i] > finish[last])
+        last = static_cast<int>(i);
+    }
+    path.clear();
+    for (int i = last; i >= 0; i = via[i])
+      path.insert(path.begin(), i);
+    return last < 0 ? 0.0 : finish[last];
+  }
+
+  std::vector<node *> m_nodes;
+  std::vector<const char *> m_resources; // Names, by handle.
+  std::vector<int> m_writer;
+  std::vector<std::vector<int> > m_readers;
+  pool *m_pool;
+  std::atomic<int> m_remaining;
+  profile::ticks m_start;
+  profile::ticks m_end;
+
+private:
+  graph(const graph &);
+  graph &operator=(const graph &);
+};
+
+} // namespace task
+
+#endif // _TASKS_HPP
@@ -0,0 +1,482 @@
+#ifndef _TILES_HPP
+#define _TILES_HPP
+#pragma once
+
+#include <vector>
+#include "Game.hpp"
+#include "Patterns.hpp"
+// Copyright (c) - 2015, Shaheed Abdol.
+
+namespace game {
+
+// Renders a frame in tile_size x tile_size blocks of the playfield layers
+// instead of as a series of full screen passes. Sprites, the shadows they
+// cast and particles are first sorted into the tiles they touch; every tile
+// then builds its foreground and shadow coverage in a small scratch buffer,
+// blurs the shadows, and writes its share of the output frame - the only full
+// size buffer touched. The pixels come out the same as the full screen path
+// (draw_units, compute_shadows, particles, draw_stage) at full resolution
+// shadows, which the tiled path always uses.
+static const int tile_size = 32;
+
+// Working memory for rendering one tile, one of these per thread. The
+// coverage has room for the rows and columns past the tile the blur reads.
+struct tile_scratch {
+  static const int apron = 3;
+  static const int stride = tile_size + apron;
+  detail::Uint32 fg[tile_size * tile_size];
+  unsigned char cover[stride * stride];
+};
+
+class tile_renderer {
+public:
+  tile_renderer()
+      : m_width(0), m_height(0), m_columns(0), m_rows(0), m_output_width(0),
+        m_output_height(0), m_overlays(nullptr), m_overlay_count(0),
+        m_table(nullptr), m_reach(0), m_stage_format(FORMAT_ARGB),
+        m_stage_palette(nullptr) {}
+
+  // Make room for layers up to |layer|, |units| sprites no bigger than
+  // |sprite_size| playfield pixels and |particles| particles up front. Only
+  // the tables that follow the output size are left to the first frame.
+  void reserve(const math::vec2i &layer, int units, int sprite_size,
+               int particles) {
+    int tiles = ((layer.v[x_pos] + tile_size - 1) / tile_size) *
+                ((layer.v[y_pos] + tile_size - 1) / tile_size);
+    // Tiles one sprite or its shadow can touch: the shadow is a little
+    // larger than the sprite, twice the size is plenty.
+    int scale = layer.v[x_pos] / _width > layer.v[y_pos] / _height
+                    ? layer.v[x_pos] / _width + 1
+                    : layer.v[y_pos] / _height + 1;
+    int span = 2 * sprite_size * scale / tile_size + 2;
+    int touched = units * (span * span < tiles ? span * span : tiles);
+    m_stage_rows.reserve(layer.v[y_pos]);
+    m_stage_columns.reserve(layer.v[x_pos]);
+    m_shadow_rows.reserve(layer.v[y_pos]);
+    m_sprites.reserve(units);
+    m_sprite_boxes.reserve(units);
+    m_caster_boxes.reserve(units);
+    m_sprite_bin.reserve(touched);
+    m_caster_bin.reserve(touched);
+    m_sprite_start.reserve(tiles + 1);
+    m_caster_start.reserve(tiles + 1);
+    m_particle_start.reserve(tiles + 1);
+    m_sprite_fill.reserve(tiles);
+    m_caster_fill.reserve(tiles);
+    m_particle_fill.reserve(tiles);
+    m_splat_at.reserve(particles);
+    m_splat_color.reserve(particles);
+    m_particle_tile.reserve(particles);
+    m_particle_at.reserve(particles);
+    m_particle_color.reserve(particles);
+  }
+
+  // Set up the layer and output sizes and the background for this frame.
+  // |stage| is sampled like texture::copy(stage, row_offset, rows) would,
+  // the |overlays| go over it like draw_stage puts them.
+  void begin(const math::vec2i &layer, const math::vec2 &iResolution,
+             const texture &stage, int row_offset, int rows,
+             const static_layer *overlays, int overlay_count) {
+    m_width = layer.v[x_pos];
+    m_height = layer.v[y_pos];
+    m_columns = (m_width + tile_size - 1) / tile_size;
+    m_rows = (m_height + tile_size - 1) / tile_size;
+    m_output_width = static_cast<int>(iResolution.v[x_pos]);
+    m_output_height = static_cast<int>(iResolution.v[y_pos]);
+    m_overlays = overlays;
+    m_overlay_count = overlay_count;
+
+    // Background lookups, per layer row and column.
+    m_stage_rows.resize(m_height);
+    m_stage_columns.resize(m_width);
+    int step = (stage.bounds.v[x_pos] << 16) / m_width;
+    m_stage_format = stage.format;
+    m_stage_palette = stage.palette;
+    int pitch = stage.bounds.v[x_pos] * stage.texel_bytes();
+    for (int y = 0; y < m_height; ++y)
+      m_stage_rows[y] =
+          stage.data() + ((row_offset + (y * rows) / m_height) %
+                          stage.bounds.v[y_pos]) * pitch;
+    for (int x = 0, u = 0; x < m_width; ++x, u += step)
+      m_stage_columns[x] = u >> 16;
+
+    // Which layer pixel every output pixel shows, stepped exactly the way
+    // draw_stage steps, and where each tile's share of the output starts.
+    double ratio_x = static_cast<double>(m_width) / iResolution.v[x_pos];
+    double ratio_y = static_cast<double>(m_height) / iResolution.v[y_pos];
+    step_through(m_output_x, m_output_width, ratio_x, m_width);
+    step_through(m_output_y, m_output_height, ratio_y, m_height);
+    split(m_tile_x, m_output_x, m_columns);
+    split(m_tile_y, m_output_y, m_rows);
+    m_output_stage.resize(m_output_width);
+    for (int x = 0; x < m_output_width; ++x)
+      m_output_stage[x] = m_stage_columns[m_output_x[x]];
+  }
+
+  // Sort the units' sprites into the tiles they cover, in drawing order,
+  // then the |bullets| drawn as projectiles if there are any.
+  void bin_units(const std::vector<texture> &tex,
+                 const std::vector<math::vec8> &units,
+                 const pattern::bullets *bullets = nullptr) {
+    double sx = m_width / static_cast<double>(_width);
+    double sy = m_height / static_cast<double>(_height);
+    m_sprites.clear();
+    for (size_t i = 0; i < units.size(); ++i) {
+      const math::vec8 &u = units[i];
+      m_sprites.push_back(sprite_rect(tex[static_cast<int>(u.v[type])],
+                                      u.v[x_pos], u.v[y_pos], sx, sy,
+                                      m_width, m_height));
+    }
+    for (int i = 0; bullets && i < bullets->live(); ++i)
+      m_sprites.push_back(sprite_rect(tex[PROJECTILE], bullets->x(i),
+                                      bullets->y(i), sx, sy, m_width,
+                                      m_height));
+
+    m_sprite_boxes.clear();
+    for (size_t i = 0; i < m_sprites.size(); ++i) {
+      const sprite_rect &s = m_sprites[i];
+      if (!s.empty()) {
+        box b = {static_cast<int>(i), s.xs, s.ys, s.xe, s.ye};
+        m_sprite_boxes.push_back(b);
+      }
+    }
+    bin(m_sprite_boxes, m_sprite_start, m_sprite_bin, m_sprite_fill);
+    profile::count("units_updated", static_cast<double>(units.size()));
+  }
+
+  // Sort the sprites into the tiles their shadows (plus the blur's reach)
+  // fall on. |table| must be up to date for the layer size. Doesn't touch
+  // anything bin_particles() does, so the two may run at the same time.
+  void bin_shadows(const shadow_table &table, int blur_taps) {
+    m_table = &table;
+    m_reach = blur_taps >= 4 ? 3 : (blur_taps >= 2 ? 1 : 0);
+
+    // Shadow row per layer row; the table keeps row offsets.
+    m_shadow_rows.resize(m_height);
+    for (int y = 0; y < m_height; ++y)
+      m_shadow_rows[y] = table.rows[y] < 0 ? -1 : table.rows[y] / m_width;
+
+    m_caster_boxes.clear();
+    for (size_t i = 0; i < m_sprites.size(); ++i) {
+      const sprite_rect &s = m_sprites[i];
+      box b = {static_cast<int>(i), m_width, m_height, -1, -1};
+      for (int x = s.xs; x < s.xe; ++x) {
+        int c = table.columns[x];
+        if (c >= 0) {
+          b.left = c < b.left ? c : b.left;
+          b.right = c + 1 > b.right ? c + 1 : b.right;
+        }
+      }
+      for (int y = s.ys; y < s.ye; ++y) {
+        int r = m_shadow_rows[y];
+        if (r >= 0) {
+          b.top = r < b.top ? r : b.top;
+          b.bottom = r + 1 > b.bottom ? r + 1 : b.bottom;
+        }
+      }
+      if (b.left >= b.right || b.top >= b.bottom)
+        continue;
+      // A blurred pixel reads up to m_reach pixels right of and below it.
+      b.left = b.left - m_reach < 0 ? 0 : b.left - m_reach;
+      b.top = b.top - m_reach < 0 ? 0 : b.top - m_reach;
+      m_caster_boxes.push_back(b);
+    }
+    bin(m_caster_boxes, m_caster_start, m_caster_bin, m_caster_fill);
+  }
+
+  // Sort this frame's particles into the tiles they land on.
+  void bin_particles(const fx::particles &effects) {
+    float sx = static_cast<float>(m_width) / _width;
+    float sy = static_cast<float>(m_height) / _height;
+    m_splat_at.resize(effects.capacity());
+    m_splat_color.resize(effects.capacity());
+    m_particle_tile.resize(effects.capacity());
+    m_particle_at.resize(effects.capacity());
+    m_particle_color.resize(effects.capacity());
+    int count = effects.splat(m_splat_at.empty() ? nullptr : &m_splat_at[0],
+                              m_splat_color.empty() ? nullptr
+                                                    : &m_splat_color[0],
+                              m_width, m_height, sx, sy);
+
+    // Counting sort by tile, keeping each tile's particles in order.
+    m_particle_start.assign(m_columns * m_rows + 1, 0);
+    for (int i = 0; i < count; ++i) {
+      int x = m_splat_at[i] % m_width;
+      int y = m_splat_at[i] / m_width;
+      int t = (y / tile_size) * m_columns + x / tile_size;
+      m_particle_tile[i] = t;
+      ++m_particle_start[t + 1];
+    }
+    for (int t = 0; t < m_columns * m_rows; ++t)
+      m_particle_start[t + 1] += m_particle_start[t];
+    m_particle_fill.assign(m_particle_start.begin(),
+                           m_particle_start.end() - 1);
+    for (int i = 0; i < count; ++i) {
+      int x = m_splat_at[i] % m_width % tile_size;
+      int y = m_splat_at[i] / m_width % tile_size;
+      int slot = m_particle_fill[m_particle_tile[i]]++;
+      m_particle_at[slot] = y * tile_size + x;
+      m_particle_color[slot] = m_splat_color[i];
+    }
+  }
+
+  int tile_count() const { return m_columns * m_rows; }
+  int tile_rows() const { return m_rows; }
+
+  // Render tile |index| and write its part of the output frame. Tiles don't
+  // share any output pixels, so different tiles may render concurrently
+  // given their own scratch.
+  void render_tile(int index, tile_scratch &scratch,
+                   detail::Uint32 *buffer) const {
+    int column = index % m_columns;
+    int row = index / m_columns;
+    int left = column * tile_size;
+    int top = row * tile_size;
+    int right = left + tile_size < m_width ? left + tile_size : m_width;
+    int bottom = top + tile_size < m_height ? top + tile_size : m_height;
+
+    // Foreground: sprites in order, then particles added on top.
+    ::memset(scratch.fg, 0, sizeof(scratch.fg));
+    for (int i = m_sprite_start[index]; i < m_sprite_start[index + 1]; ++i)
+      blit_sprite(m_sprites[m_sprite_bin[i]], scratch.fg, tile_size, left,
+                  top, right, bottom);
+    for (int i = m_particle_start[index]; i < m_particle_start[index + 1];
+         ++i) {
+      detail::Uint32 &dst = scratch.fg[m_particle_at[i]];
+      __m128i sum{_mm_adds_epu8(_mm_cvtsi32_si128(dst),
+                                _mm_cvtsi32_si128(m_particle_color[i]))};
+      dst = static_cast<detail::Uint32>(_mm_cvtsi128_si32(sum));
+    }
+
+    // Shadow coverage for the tile and the apron its blur reads.
+    int cover_right =
+        right + m_reach < m_width ? right + m_reach : m_width;
+    int cover_bottom =
+        bottom + m_reach < m_height ? bottom + m_reach : m_height;
+    ::memset(scratch.cover, 0, sizeof(scratch.cover));
+    for (int i = m_caster_start[index]; i < m_caster_start[index + 1]; ++i)
+      cast(m_sprites[m_caster_bin[i]], scratch, left, top, cover_right,
+           cover_bottom);
+    blur(scratch, left, top, right, bottom, cover_bottom);
+
+    // Composite into the output pixels that show this tile.
+    const unsigned char *cover = scratch.cover;
+    for (int oy = m_tile_y[row]; oy < m_tile_y[row + 1]; ++oy) {
+      detail::Uint32 *out = buffer + oy * m_output_width;
+      int ox = m_tile_x[column];
+      int end = m_tile_x[column + 1];
+      if (const static_layer *overlay = overlay_at(oy)) {
+        memcpy(out + ox, overlay->row(oy) + ox,
+               (end - ox) * sizeof(detail::Uint32));
+        continue;
+      }
+      int y = m_output_y[oy];
+      const unsigned char *stage = m_stage_rows[y];
+      const detail::Uint32 *fg = scratch.fg + (y - top) * tile_size - left;
+      const unsigned char *shadow =
+          cover + (y - top) * tile_scratch::stride - left;
+      for (; ox < end; ++ox) {
+        int x = m_output_x[ox];
+        detail::Uint32 result = stage_texel(stage, m_output_stage[ox]);
+        if (shadow[x])
+          result = shade(result, shadow[x]);
+        out[ox] = fg[x] ? fg[x] : result;
+      }
+    }
+  }
+
+  // Render the tiles in rows [first, last) with |scratch|.
+  void render_rows(int first, int last, tile_scratch &scratch,
+                   detail::Uint32 *buffer) const {
+    for (int i = first * m_columns; i < last * m_columns; ++i)
+      render_tile(i, scratch, buffer);
+  }
+
+  // Render every tile on the calling thread.
+  void render(detail::Uint32 *buffer) {
+    render_rows(0, m_rows, m_scratch, buffer);
+  }
+
+protected:
+  // Texel |u| of a background row as ARGB, expanding compact formats.
+  detail::Uint32 stage_texel(const unsigned char *row, int u) const {
+    if (m_stage_format == FORMAT_RGB565)
+      return from_565(reinterpret_cast<const unsigned short *>(row)[u]);
+    if (m_stage_format == FORMAT_INDEXED)
+      return m_stage_palette[row[u]];
+    return reinterpret_cast<const detail::Uint32 *>(row)[u];
+  }
+
+  // The last overlay over output row |y|, null if there's none.
+  const static_layer *overlay_at(int y) const {
+    for (int i = m_overlay_count - 1; i >= 0; --i)
+      if (m_overlays[i].covers(y))
+        return &m_overlays[i];
+    return nullptr;
+  }
+
+  // A rectangle of layer pixels belonging to sprite |item|.
+  struct box {
+    int item;
+    int left, top, right, bottom;
+  };
+
+  // Layer coordinate for each of |count| output pixels, stepping by |ratio|.
+  static void step_through(std::vector<int> &out, int count, double ratio,
+                           int limit) {
+    out.resize(count);
+    double current = 0;
+    for (int i = 0; i < count; ++i, current += ratio) {
+      int at = static_cast<int>(current);
+      out[i] = at < limit ? at : limit - 1;
+    }
+  }
+
+  // First output pixel of every tile (and one past the last) along an axis.
+  static void split(std::vector<int> &start, const std::vector<int> &layer,
+                    int tiles) {
+    start.resize(tiles + 1);
+    int i = 0;
+    for (int t = 0; t <= tiles; ++t) {
+      while (i < static_cast<int>(layer.size()) && layer[i] < t * tile_size)
+        ++i;
+      start[t] = i;
+    }
+  }
+
+  // Counting sort |boxes| into every tile they overlap, in order.
+  void bin(const std::vector<box> &boxes, std::vector<int> &start,
+           std::vector<int> &items, std::vector<int> &fill) {
+    int tiles = m_columns * m_rows;
+    start.assign(tiles + 1, 0);
+    for (size_t i = 0; i < boxes.size(); ++i)
+      for_tiles(boxes[i], [&start](int t, int) { ++start[t + 1]; });
+    for (int t = 0; t < tiles; ++t)
+      start[t + 1] += start[t];
+    items.resize(start[tiles]);
+    fill.assign(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < boxes.size(); ++i)
+      for_tiles(boxes[i],
+                [&items, &fill](int t, int item) { items[fill[t]++] = item; });
+  }
+
+  template <typename F> void for_tiles(const box &b, F f) const {
+    for (int ty = b.top / tile_size; ty <= (b.bottom - 1) / tile_size; ++ty)
+      for (int tx = b.left / tile_size; tx <= (b.right - 1) / tile_size; ++tx)
+        f(ty * m_columns + tx, b.item);
+  }
+
+  // Mark the pixels sprite |s| shadows inside [left, right) x [top, bottom).
+  // The columns and rows it projects into that range are contiguous, so we
+  // find them first and only walk those.
+  void cast(const sprite_rect &s, tile_scratch &scratch, int left, int top,
+            int right, int bottom) const {
+    const int *columns = &m_table->columns[0];
+    int xs = s.xe, xe = s.xs;
+    for (int x = s.xs; x < s.xe; ++x) {
+      if (columns[x] >= left && columns[x] < right) {
+        xs = x < xs ? x : xs;
+        xe = x + 1;
+      }
+    }
+    for (int y = s.ys; y < s.ye; ++y) {
+      int r = m_shadow_rows[y];
+      if (r < top || r >= bottom)
+        continue;
+      const unsigned char *src = s.row(y);
+      if (!src)
+        break;
+      unsigned char *dst = scratch.cover + (r - top) * tile_scratch::stride;
+      for (int x = xs; x < xe; ++x) {
+        int u = s.column(x);
+        if (u < 0)
+          break;
+        int c = columns[x];
+        if (s.opaque(src, u) && c >= left && c < right)
+          dst[c - left] = 255;
+      }
+    }
+  }
+
+  // blur_coverage() for one tile: every pixel averages itself and the next
+  // m_reach along the row, then down the column, except within m_reach of
+  // the layer's right and bottom edge. 16 pixels at a time where a whole
+  // block is blurred, the rest one by one.
+  void blur(tile_scratch &scratch, int left, int top, int right, int bottom,
+            int cover_bottom) const {
+    if (!m_reach)
+      return;
+    bool wide = m_reach == 3;
+    const int stride = tile_scratch::stride;
+    int last_x = m_width - m_reach; // Columns from here on aren't blurred.
+    int last_y = m_height - m_reach;
+    int width = (right < last_x ? right : last_x) - left;
+    for (int y = 0; y < cover_bottom - top; ++y) {
+      unsigned char *p = scratch.cover + y * stride;
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+        store(p + x, wide ? average4(load(p + x), load(p + x + 1),
+                                     load(p + x + 2), load(p + x + 3))
+                          : _mm_avg_epu8(load(p + x), load(p + x + 1)));
+      for (; x < width; ++x)
+        p[x] = wide ? average4(p[x], p[x + 1], p[x + 2], p[x + 3])
+                    : average2(p[x], p[x + 1]);
+    }
+    int height = (bottom < last_y ? bottom : last_y) - top;
+    for (int y = 0; y < height; ++y) {
+      unsigned char *p = scratch.cover + y * stride;
+      int x = 0;
+      for (; x + 16 <= right - left; x += 16)
+        store(p + x, wide ? average4(load(p + x), load(p + x + stride),
+                                     load(p + x + 2 * stride),
+                                     load(p + x + 3 * stride))
+                          : _mm_avg_epu8(load(p + x), load(p + x + stride)));
+      for (; x < right - left; ++x)
+        p[x] = wide ? average4(p[x], p[x + stride], p[x + 2 * stride],
+                               p[x + 3 * stride])
+                    : average2(p[x], p[x + stride]);
+    }
+  }
+
+  static __m128i load(const unsigned char *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  }
+  static void store(unsigned char *p, __m128i v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+  }
+  static __m128i average4(__m128i a, __m128i b, __m128i c, __m128i d) {
+    return _mm_avg_epu8(_mm_avg_epu8(a, b), _mm_avg_epu8(c, d));
+  }
+  static unsigned char average4(unsigned char a, unsigned char b,
+                                unsigned char c, unsigned char d) {
+    return game::average4(a, b, c, d);
+  }
+
+  int m_width, m_height;   // Layer size.
+  int m_columns, m_rows;   // Tiles across and down.
+  int m_output_width, m_output_height;
+  const static_layer *m_overlays;
+  int m_overlay_count;
+  const shadow_table *m_table;
+  int m_reach;
+  std::vector<const unsigned char *> m_stage_rows; // In m_stage_format.
+  int m_stage_format;
+  const detail::Uint32 *m_stage_palette;
+  std::vector<int> m_stage_columns;
+  std::vector<int> m_output_x, m_output_y, m_tile_x, m_tile_y;
+  std::vector<int> m_output_stage; // m_stage_columns for each output column.
+  std::vector<sprite_rect> m_sprites;
+  std::vector<box> m_sprite_boxes, m_caster_boxes;
+  std::vector<int> m_sprite_start, m_sprite_bin;
+  std::vector<int> m_caster_start, m_caster_bin;
+  std::vector<int> m_shadow_rows;
+  std::vector<int> m_splat_at, m_particle_tile, m_particle_at;
+  std::vector<detail::Uint32> m_splat_color, m_particle_color;
+  std::vector<int> m_particle_start;
+  std::vector<int> m_sprite_fill, m_caster_fill, m_particle_fill;
+  tile_scratch m_scratch;
+};
+
+} // namespace game
+
+#endif // _TILES_HPP
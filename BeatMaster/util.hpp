@@ -1,6 +1,8 @@
 #ifndef _UTIL_HPP
 #define _UTIL_HPP
 
+#include <atomic>
+
 namespace util {
 
 // Length is measured in sizeof unsigned int.
@@ -18,6 +20,8 @@ inline void memcpy(void *dst, void *src, int len) {
     ++sr_a;
     --half_len;
   }
+  if (len & 1)
+    *ds_a = *sr_a;
 }
 
 // Length is measured in sizeof unsigned int.
@@ -32,16 +36,20 @@ inline void memset(void *dst, unsigned int v, int len) {
     ++ds_a;
     --half_len;
   }
+  if (len & 1)
+    *ds_a = v;
 }
 
 // This structure represents a linear chunk of RAM. We pre-allocate the memory
 // so that subsequent allocations from the pool can succeed quickly. As it
 // stands, we cannot deallocate form the pool, but that will be added in future.
+// Allocating is thread safe, so assets can be loaded into the pool on other
+// threads (see Assets.hpp) while the game sets up.
 struct mem_pool {
 protected:
   int m_bytes;
   unsigned char *m_pool;
-  unsigned char *m_end;
+  std::atomic<unsigned char *> m_end;
 
 public:
   // Allocate the pool with the required size. Initialize the memory to 0.
@@ -54,6 +62,11 @@ public:
   // Simply free up the reserved memory.
   ~mem_pool() { delete[] m_pool; }
 
+  // Bytes handed out so far, including the per-allocation headers.
+  int used() const { return static_cast<int>(m_end.load() - m_pool); }
+
+  int size() const { return m_bytes; }
+
   // Allocate a chunk of this memory to whatever purpose.
   unsigned char *alloc(int bytes) {
     unsigned char *ret{0};
@@ -61,13 +74,18 @@ public:
       return ret;
 
     // We could find a chunk that fits somewhere at the end of the block.
-    if ((m_pool + m_bytes) - (m_end + sizeof(int) + sizeof(bool)) >= bytes) {
-      int *start{reinterpret_cast<int *>(m_end)};
+    // Claim it by moving the end past it, unless another thread got there
+    // first, then look again.
+    unsigned char *end{m_end.load()};
+    while ((m_pool + m_bytes) - (end + sizeof(int) + sizeof(bool)) >= bytes) {
+      if (!m_end.compare_exchange_weak(
+              end, end + bytes + sizeof(int) + sizeof(bool)))
+        continue;
+      int *start{reinterpret_cast<int *>(end)};
       *start = bytes;
-      ret = m_end + sizeof(int);
+      ret = end + sizeof(int);
       *ret = true; // memory is allocated.
       ++ret;
-      m_end += bytes + sizeof(int) + sizeof(bool);
       return ret;
     }
 
@@ -97,6 +115,55 @@ public:
   }
 };
 
+// Bounded single producer / single consumer queue. One thread may push and
+// one (other) thread may pop, neither ever blocks or takes a lock. The indices
+// live on separate cache lines so the two sides don't fight over them.
+template <typename T, int N> class spsc_queue {
+  static_assert((N & (N - 1)) == 0, "spsc_queue size must be a power of 2");
+
+public:
+  spsc_queue() {
+    m_head.store(0);
+    m_tail.store(0);
+  }
+
+  // Producer side. Returns false (and drops the item) when the queue is full.
+  bool push(const T &item) {
+    unsigned int tail{m_tail.load(std::memory_order_relaxed)};
+    if (tail - m_head.load(std::memory_order_acquire) == N)
+      return false;
+    m_items[tail & (N - 1)] = item;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when there is nothing to take.
+  bool pop(T &item) {
+    unsigned int head{m_head.load(std::memory_order_relaxed)};
+    if (head == m_tail.load(std::memory_order_acquire))
+      return false;
+    item = m_items[head & (N - 1)];
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return m_head.load(std::memory_order_acquire) ==
+           m_tail.load(std::memory_order_acquire);
+  }
+
+protected:
+  std::atomic<unsigned int> m_head;
+  char m_pad0[64 - sizeof(std::atomic<unsigned int>)];
+  std::atomic<unsigned int> m_tail;
+  char m_pad1[64 - sizeof(std::atomic<unsigned int>)];
+  T m_items[N];
+
+private:
+  spsc_queue(const spsc_queue &);
+  spsc_queue &operator=(const spsc_queue &);
+};
+
 } // namespace util
 
 #endif // _UTIL_HPP
\ No newline at end of file